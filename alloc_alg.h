@@ -23,6 +23,35 @@
 /*************************************************************************
  * {{{ malloc helper functions
  *************************************************************************/
+/* ptr이 pmem region 안에 있는지. hybrid allocator는 region마다 다르다. */
+static inline tb_bool_t
+alloc_in_pmem(alloc_t *alloc, void *ptr)
+{
+    return alloc->alloctype == REGION_ALLOC_PMEM ||
+           (alloc->alloctype == REGION_ALLOC_HYBRID &&
+            pbuddy_in_pool(alloc->pool, ptr));
+} /* alloc_in_pmem */
+
+/* pmem에 있는 ptr이 놓인 pool의 persist 방식 (TB_PERSIST_*). volatile pool이면
+ * tb_pmem_memcpy_as 등이 flush 하지 않는다. */
+static inline int
+alloc_pmem_persist(alloc_t *alloc, void *ptr)
+{
+    pbuddy_pool_t *pool = (alloc->pool != NULL) ? alloc->pool : PBUDDY_POOL;
+
+    return pbuddy_pool_of(pool, ptr)->persist;
+} /* alloc_pmem_persist */
+
+/* SYS, HYBRID allocator가 DRAM region을 받는 곳 */
+static inline region_t *
+alloc_dram_region(size_t pagesize)
+{
+    if (use_root_allocator)
+        return (region_t *)tb_root_malloc(pagesize);
+    else
+        return (region_t *)get_new_page(pagesize);
+} /* alloc_dram_region */
+
 /* allocate a large request from the best fitting chunk in a treebin */
 static inline chunk_t *
 tmalloc_large(alloc_t *alloc, csize_t reqsize, csize_t chunkbits)
@@ -334,6 +363,7 @@ malloc_internal(
             break;
         case REGION_ALLOC_SYS:
         case REGION_ALLOC_PMEM:
+        case REGION_ALLOC_HYBRID:
             /* 현재까지 받은 total size의 절반 크기의 page 생성.
              * (단, 최소값 4K, 최대값 1M.)
              * (단, 사용자의 요청이 1M보다 크면 물론 사용자가 요청한 크기만큼.)
@@ -350,15 +380,23 @@ malloc_internal(
 
             pagesize = TB_MAX(pagesize, size);
 
-            if (alloc->alloctype == REGION_ALLOC_PMEM) {
-                /* 2의 제곱수로 변경 */
-                pagesize = get_pbuddy_alloc_size(pagesize);
-                region = (region_t *)pbuddy_malloc(pagesize);
+            /* hybrid는 DRAM budget 안이면 DRAM에서 받고, budget을 넘거나
+             * DRAM에서 받지 못하면 pmem에서 받는다. */
+            if (alloc->alloctype == REGION_ALLOC_HYBRID &&
+                alloc->dram_size + pagesize <= alloc->dram_budget) {
+                region = alloc_dram_region(pagesize);
+                if (region != NULL)
+                    alloc->dram_size += pagesize;
+            }
+
+            if (region == NULL && alloc->alloctype != REGION_ALLOC_SYS) {
+                /* pool의 page 단위로 올림. 2의 제곱수로 올리고 남는
+                 * 뒷부분은 buddy에 바로 돌려준다. */
+                pagesize = get_pbuddy_pool_exact_size(alloc->pool, pagesize);
+                region = (region_t *)pbuddy_pool_malloc_exact(alloc->pool, pagesize);
             }
-            else if (use_root_allocator) 
-                region = (region_t *)tb_root_malloc(pagesize);
-            else
-                region = (region_t *)get_new_page(pagesize);
+            else if (region == NULL)
+                region = alloc_dram_region(pagesize);
 
             break;
 
@@ -430,7 +468,11 @@ realloc_internal(alloc_t *alloc, chunk_t *chunk, uint64_t reqsize)
     if (newchunk != 0) {
         void *newmem = CHUNK2MEM(newchunk);
         /* oldsize < reqsize 일 때만 이리로 온다. */
-        memcpy(newmem, CHUNK2MEM(chunk), oldsize - CHUNK_OVERHEAD);
+        if (alloc_in_pmem(alloc, newmem))
+            tb_pmem_memcpy_as(alloc_pmem_persist(alloc, newmem), newmem,
+                              CHUNK2MEM(chunk), oldsize - CHUNK_OVERHEAD);
+        else
+            memcpy(newmem, CHUNK2MEM(chunk), oldsize - CHUNK_OVERHEAD);
 #ifdef _ALLOC_USE_DBGINFO
 #ifdef TB_DEBUG
         memset(CHUNK2MEM(chunk), 0xCA, oldsize - CHUNK_OVERHEAD);
@@ -555,7 +597,18 @@ footer_check:
                     free_page(region, region_size);
                 break;
             case REGION_ALLOC_PMEM:
-                pbuddy_free(region, region_size);
+                pbuddy_pool_free(alloc->pool, region);
+                break;
+            case REGION_ALLOC_HYBRID:
+                if (alloc_in_pmem(alloc, region))
+                    pbuddy_pool_free(alloc->pool, region);
+                else {
+                    alloc->dram_size -= region_size;
+                    if (use_root_allocator)
+                        tb_root_free(region);
+                    else
+                        free_page(region, region_size);
+                }
                 break;
             default:
                 assert(0);
@@ -48,6 +48,14 @@ typedef uint64_t csize_t;   /* chunk size */
 #define GET_CHUNK_BITS(head)                                                   \
      (((csize_t) (head)) & ALLOC_IDX_MASK)
 
+/* placement policy와 allocation hint로 고른 sub heap. tier마다 하나씩,
+ * TRANSIENT hint용으로 tier마다 하나씩 더 있다. sub heap의 chunk는
+ * alloc_idx가 ALLOC_SUB_HEAP_IDX(sub heap 번호)이다. */
+#define ALLOC_SUB_HEAP_CNT        (2 * ALLOC_TIER_CNT)
+#define ALLOC_SUB_HEAP(tier, transient)                                        \
+     ((int) (tier) + ((transient) ? ALLOC_TIER_CNT : 0))
+#define ALLOC_SUB_HEAP_IDX(n)     ((n) + 1)
+
 #define GET_ALLOC_IDX(chunk)                                                   \
      ( (((csize_t) (chunk)->head) & ALLOC_IDX_MASK ) >> ALLOC_IDX_SHIFT )
 
@@ -540,6 +548,23 @@ typedef struct alloc_s {
 
     region_alloctype_t alloctype;
 
+    /* REGION_ALLOC_PMEM, REGION_ALLOC_HYBRID일 때 region을 받아오는 pmem pool */
+    pbuddy_pool_t *pool;
+
+    /* REGION_ALLOC_HYBRID: DRAM에서 받을 region 크기의 상한과 현재 크기 */
+    uint64_t dram_budget;
+    uint64_t dram_size;
+
+    /* size별 placement policy (allocator_set_placement). 이 allocator와 다른
+     * tier로 정해지거나 hint로 따로 둘 요청은 sub_heaps에서 받는다. sub heap의
+     * chunk는 alloc_idx로 free 할 때 구분된다. */
+    int place_rule_cnt;
+    alloc_place_rule_t place_rules[ALLOC_PLACE_MAX_RULES];
+    struct alloc_s *sub_heaps[ALLOC_SUB_HEAP_CNT];
+
+    /* tier별로 현재 할당되어 있는 chunk 크기의 합 */
+    uint64_t tier_used[ALLOC_TIER_CNT];
+
     /* 1. allocator index in the shared pool allocator set
      * 2. allocator index in the ROOT allocator set
      * 3. allocator index in the region allocator pool
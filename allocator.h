@@ -54,6 +54,7 @@ enum allocator_type_e {
     ALLOC_TYPE_REGION_ROOT,
     ALLOC_TYPE_REGION_SYS,
     ALLOC_TYPE_REGION_PMEM,
+    ALLOC_TYPE_REGION_HYBRID,
     ALLOC_TYPE_MAX
 };
 typedef enum allocator_type_e allocator_type_t;
@@ -61,10 +62,41 @@ typedef enum allocator_type_e allocator_type_t;
 enum region_alloctype_e {
     REGION_ALLOC_ROOT,
     REGION_ALLOC_SYS,
-    REGION_ALLOC_PMEM
+    REGION_ALLOC_PMEM,
+    REGION_ALLOC_HYBRID
 };
 typedef enum region_alloctype_e region_alloctype_t;
 
+/* region이 놓이는 메모리 종류 */
+enum alloc_tier_e {
+    ALLOC_TIER_DRAM = 0,
+    ALLOC_TIER_PMEM,
+    ALLOC_TIER_CNT
+};
+typedef enum alloc_tier_e alloc_tier_t;
+
+/* size별 placement policy의 한 줄. max_size 이하의 요청은 tier에서 받는다.
+ * 마지막 줄보다 큰 요청은 마지막 줄의 tier를 따른다. */
+typedef struct alloc_place_rule_s {
+    uint64_t max_size;
+    alloc_tier_t tier;
+} alloc_place_rule_t;
+
+#define ALLOC_PLACE_MAX_RULES 8
+
+/* tb_malloc_hint/tb_calloc_hint의 flags.
+ * - HOT       : 자주 쓰는 객체. placement policy와 상관없이 DRAM에서 받는다.
+ * - COLD      : 잘 쓰지 않는 객체. pmem을 쓸 수 있으면 pmem에서 받는다.
+ * - STREAMING : 한 번 쓰고 다시 읽지 않는 buffer. tb_calloc_hint가 크기와
+ *               tier에 상관없이 non-temporal store로 초기화한다.
+ * - TRANSIENT : 금방 free할 객체. 오래 쓰는 객체와 region을 나눠 쓰지
+ *               않도록 따로 둔 region에서 받는다.
+ * HOT과 COLD를 같이 주면 HOT을 따른다. */
+#define TB_ALLOC_HINT_HOT       0x1
+#define TB_ALLOC_HINT_COLD      0x2
+#define TB_ALLOC_HINT_STREAMING 0x4
+#define TB_ALLOC_HINT_TRANSIENT 0x8
+
 struct allocator_s {
     allocator_type_t alloc_type;
     const allocator_desc_t *desc;
@@ -92,6 +124,7 @@ struct allocator_s {
  *
  * - func_malloc, func_calloc, func_realloc, func_free: Self-explanatory.
  * - func_delete: Allocator destructor.
+ * - func_malloc_hint, func_calloc_hint: malloc/calloc with TB_ALLOC_HINT_* flags.
  *
  * Normally, one should use the "allocator API" macros defined below.
  *
@@ -108,6 +141,10 @@ struct allocator_s {
 #define _DSTREAM_T
 typedef struct dstream_s dstream_t;
 #endif
+#ifndef _PBUDDY_POOL_T
+#define _PBUDDY_POOL_T
+typedef struct pbuddy_pool_s pbuddy_pool_t;
+#endif /* _PBUDDY_POOL_T */
 struct allocator_desc_s {
     void *(*func_malloc)(allocator_t *allocator, int64_t bytes, const char *file, int line);
     void *(*func_valloc)(allocator_t *allocator, int64_t bytes, const char *file, int line);
@@ -120,6 +157,10 @@ struct allocator_desc_s {
     void (*func_tracedump)(dstream_t *dstream, allocator_t *allocator,
                            const char *indent);
     void (*func_throw)(allocator_t *allocator);
+    void *(*func_malloc_hint)(allocator_t *allocator, int64_t bytes, int flags,
+                              const char *file, int line);
+    void *(*func_calloc_hint)(allocator_t *allocator, int64_t bytes, int flags,
+                              const char *file, int line);
 };
 
 /*************************************************
@@ -138,10 +179,30 @@ void tballoc_clear(void);
 #define region_pallocator_new(parent, use_mutex)                  \
     region_allocator_new_internal(parent, use_mutex, true, __FILE__, __LINE__)
 
+/* PBUDDY_POOL 대신 pool(pbuddy_pool_open)에서 region을 받는 allocator.
+ * 이 allocator를 parent로 region_pallocator_new를 부르면 같은 pool을 쓴다. */
+#define region_pallocator_new_pool(parent, use_mutex, pool)             \
+    region_pool_allocator_new_internal(parent, use_mutex, pool, __FILE__, __LINE__)
+
+/* region을 DRAM에서 dram_budget까지 받고, 그 뒤로는 pmem pool에서 받는
+ * allocator. tb_free는 어느 쪽 region이든 그대로 쓸 수 있다.
+ * dram_budget이 0이면 _HYBRID_DRAM_BUDGET을 쓴다. */
+#define region_hallocator_new(parent, use_mutex, dram_budget)           \
+    region_hybrid_allocator_new_internal(parent, use_mutex, dram_budget, \
+                                         __FILE__, __LINE__)
+
 allocator_t *region_allocator_new_internal(allocator_t *parent,
                                            tb_bool_t use_mutex,
                                            tb_bool_t use_pmem,
                                            const char *file, int line);
+allocator_t *region_pool_allocator_new_internal(allocator_t *parent,
+                                                tb_bool_t use_mutex,
+                                                pbuddy_pool_t *pool,
+                                                const char *file, int line);
+allocator_t *region_hybrid_allocator_new_internal(allocator_t *parent,
+                                                  tb_bool_t use_mutex,
+                                                  uint64_t dram_budget,
+                                                  const char *file, int line);
 /* Destructor. */
 #define allocator_delete(allocator) \
     ( ((allocator)->desc->func_delete)(allocator, __FILE__, __LINE__) )
@@ -149,8 +210,18 @@ allocator_t *region_allocator_new_internal(allocator_t *parent,
 void allocator_cleanup(allocator_t *allocator);
 
 void allocator_setname(allocator_t *allocator, const char *fmt, ...);
+
+tb_bool_t allocator_set_placement(allocator_t *allocator,
+                                  const alloc_place_rule_t *rules, int rule_cnt);
 #define allocator_getname(allocator) ((allocator)->name)
 
+/* from에서 할당받은 ptr을 to로 옮긴다. realloc처럼 옮긴 주소를 돌려주며,
+ * 실패하면 NULL을 돌려주고 ptr은 from에 그대로 남는다. */
+#define tb_move(ptr, from_alloc, to_alloc)                                     \
+    tb_move_internal(ptr, from_alloc, to_alloc, __FILE__, __LINE__)
+void *tb_move_internal(void *ptr, allocator_t *from_alloc, allocator_t *to_alloc,
+                       const char *file, int line);
+
 #define allocator_log_on(alloc)  ((alloc)->logging = true)
 #define allocator_log_off(alloc) ((alloc)->logging = false)
 
@@ -178,6 +249,10 @@ void tb_root_free(void *in_ptr);
     _tb_valloc(allocator, bytes, __FILE__, __LINE__)
 #define tb_calloc(allocator, bytes)                                            \
     _tb_calloc(allocator, bytes, __FILE__, __LINE__)
+#define tb_malloc_hint(allocator, bytes, flags)                                \
+    _tb_malloc_hint(allocator, bytes, flags, __FILE__, __LINE__)
+#define tb_calloc_hint(allocator, bytes, flags)                                \
+    _tb_calloc_hint(allocator, bytes, flags, __FILE__, __LINE__)
 #define tb_realloc(allocator, ptr, bytes)                                      \
     _tb_realloc(allocator, ptr, bytes, __FILE__, __LINE__)
 #define tb_strdup(allocator, src)                                              \
@@ -223,6 +298,26 @@ _tb_calloc(allocator_t *allocator, int64_t bytes, const char *file, int line)
     return ptr;
 } /* _tbx_calloc */
 
+static inline void *
+_tb_malloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                const char *file, int line)
+{
+    TB_THR_ASSERT(allocator != NULL);
+
+    return (allocator->desc->func_malloc_hint)(allocator, bytes, flags,
+                                               file, line);
+} /* _tb_malloc_hint */
+
+static inline void *
+_tb_calloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                const char *file, int line)
+{
+    TB_THR_ASSERT(allocator != NULL);
+
+    return (allocator->desc->func_calloc_hint)(allocator, bytes, flags,
+                                               file, line);
+} /* _tb_calloc_hint */
+
 static inline void *
 _tb_realloc(allocator_t *allocator, void *ptr, int64_t bytes, const char *file,
             int line)
@@ -278,6 +373,7 @@ _tb_strndup(allocator_t *allocator, const char *src, int n, const char *file,
 
 uint64_t get_total_size(allocator_t *alloc);
 uint64_t get_total_used(allocator_t *alloc);
+uint64_t get_tier_used(allocator_t *alloc, alloc_tier_t tier);
 uint64_t get_alloc_used_size_including_childs(allocator_t *allocator);
 uint64_t get_chunk_size(uint64_t req_size);
 
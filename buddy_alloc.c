@@ -4,12 +4,14 @@
  *
  *
  * buddy 방식이기 때문에, 2^n 크기로만 메모리를 할당할 수 있고, 할당할 수 있는
- * 최소값은 BUDDY_PAGESIZE로 4096 (4kb) 이다.
+ * 최소값은 allocator의 page 크기(2^page_shift)이다. 기본값은 BUDDY_PAGESIZE로
+ * 4096 (4kb) 이다.
  * buddy 방식은 간단하고, 효율도 좋고, external fragmentation이 없다는 장점이
  * 있으나, 할당하는 양이 2^n 이라 internal fragmentation이 늘어나게 될 수 있다.
  *
  */
 
+#define _GNU_SOURCE /* fallocate */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -19,14 +21,22 @@
 #include <string.h>
 #include <stddef.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <time.h>
 #include <sys/mman.h>
 #include "list.h"
 #include "buddy_alloc.h"
+#include "pmem_persist.h"
 
-#define _CHUNKSIZE(bin_idx) (BUDDY_PAGESIZE << (bin_idx))
+/* allocator의 page(bin #0 chunk) 크기 */
+#define _PAGESIZE ((uint64_t)1 << alloc->page_shift)
+
+#define _CHUNKSIZE(bin_idx) (_PAGESIZE << (bin_idx))
 
 #define _CHUNK2BITMAP(chunk, bin_idx) \
-    (((char *)(chunk)-alloc->page_start) >> ((bin_idx) + BUDDY_PAGE_SHIFT))
+    (((char *)(chunk)-alloc->page_start) >> ((bin_idx) + alloc->page_shift))
 
 #define _CHUNK_AT_OFFSET(chunk, offset) \
     ((buddy_chunk_t *)((char *)(chunk) + offset))
@@ -36,250 +46,1578 @@
 
 #define _BITMASK(bitmap_idx) (1 << ((bitmap_idx)&7))
 
+/* 2^n 크기 -> bin 번호 (ex. page가 4K이면 4096 -> 0, 8192 -> 1) */
+#define _SIZE2BIN(size) (__builtin_ctzll(size) - alloc->page_shift)
+
+/* magazine을 채우거나 비울 때 한 번에 옮기는 chunk 개수 */
+#define _MAG_BATCH(depth) (((depth) + 1) / 2)
+
+/* free 경로에서 punch 대상을 다시 찾기까지의 최소 간격 (초) */
+#define _PUNCH_MIN_INTERVAL 1
+
+/* punch 된 chunk에서 filesystem에 돌려준 크기 (header가 있는 첫 page 제외) */
+#define _PUNCHED_SIZE(bin_idx) \
+    (_CHUNKSIZE(bin_idx) > BUDDY_PAGESIZE ? _CHUNKSIZE(bin_idx) - BUDDY_PAGESIZE : 0)
+
+/* bins[]에 chunk를 넣고 뺄 때는 binmap도 같이 갱신해야 하므로 항상 아래
+ * 함수를 사용한다. punched_bytes도 bins에 있는 chunk 기준으로 여기서 센다. */
+static inline void
+buddy_bin_add(pbuddy_alloc_t *alloc, buddy_chunk_t *chunk, int bin_idx)
+{
+    list_add_tail(&chunk->link, &(alloc->bins[bin_idx]));
+    alloc->binmap |= (1ULL << bin_idx);
+    alloc->free_cnt[bin_idx]++;
+    if (chunk->punched)
+        alloc->punched_bytes += _PUNCHED_SIZE(bin_idx);
+}
+
+static inline void
+buddy_bin_del(pbuddy_alloc_t *alloc, buddy_chunk_t *chunk, int bin_idx)
+{
+    list_del(&chunk->link);
+    alloc->free_cnt[bin_idx]--;
+    if (list_empty(&(alloc->bins[bin_idx])))
+        alloc->binmap &= ~(1ULL << bin_idx);
+    if (chunk->punched)
+        alloc->punched_bytes -= _PUNCHED_SIZE(bin_idx);
+}
+
+/* hole punching에서 쓰는 시각 (초) */
+static inline uint64_t
+buddy_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void *buddy_malloc_internal(pbuddy_alloc_t *alloc, int bin_idx);
 static void buddy_free_internal(pbuddy_alloc_t *alloc, void *page, uint64_t size,
                                 bool use_mutex);
+static void buddy_coalesce(pbuddy_alloc_t *alloc, buddy_chunk_t *chunk,
+                           int bin_idx, bool punched, uint64_t free_time);
+static void buddy_free_range(pbuddy_alloc_t *alloc, uint64_t first_page,
+                             uint64_t last_page, bool punched);
+static void buddy_magazine_flush(pbuddy_alloc_t *alloc, buddy_magazine_t *mag);
+static void buddy_magazine_reclaim(pbuddy_alloc_t *alloc);
+static void buddy_magazine_release(buddy_magazine_t *mag);
+static void buddy_mag_register(pbuddy_alloc_t *alloc);
+static void buddy_mag_unregister(pbuddy_alloc_t *alloc);
+
+/* order별 배열들(bins, free_cnt, bitmap, bitmap_size, mag_depth)의 크기 */
+#define _ORDER_ARRAYS_SIZE(bins_cnt)                                   \
+    (((uint64_t)(bins_cnt) *                                           \
+      (sizeof(list_t) + sizeof(uint64_t) + sizeof(char *) +            \
+       sizeof(uint64_t) + sizeof(int)) +                               \
+      7) & ~7ULL)
+
+/**
+ * @brief       allocator의 최소 order (page 크기)
+ *
+ * @param[in]   page_shift : 0이면 BUDDY_PAGE_SHIFT (4K)
+ */
+int
+buddy_page_shift(int page_shift)
+{
+    if (page_shift <= 0)
+        return BUDDY_PAGE_SHIFT;
+
+    return MIN(MAX(page_shift, BUDDY_PAGE_SHIFT), BUDDY_MAX_SHIFT);
+}
+
+/**
+ * @brief       allocator의 최대 order
+ *
+ * @param[in]   max_size   : allocator에서 사용할 memory의 전체 크기
+ * @param[in]   page_shift : buddy_page_shift 참고
+ * @param[in]   max_shift  : 0보다 크면 최대 order를 이 값 이하로 제한한다.
+ *
+ * max_size 안에 들어가는 가장 큰 2^n이 최대 chunk 크기가 된다.
+ */
+int
+buddy_max_shift(uint64_t max_size, int page_shift, int max_shift)
+{
+    int shift;
+
+    page_shift = buddy_page_shift(page_shift);
+    shift = page_shift;
+
+    if (max_size >= (1ULL << page_shift))
+        shift = 63 - __builtin_clzll(max_size);
+    if (max_shift > 0)
+        shift = MIN(shift, max_shift);
+
+    return MIN(MAX(shift, page_shift), BUDDY_MAX_SHIFT);
+}
+
+/**
+ * @brief       buddy allocator header와 bitmap에 필요한 공간의 크기
+ *
+ * @param[in]   max_size   : allocator에서 사용할 memory의 전체 크기
+ * @param[in]   page_shift : buddy_page_shift 참고
+ * @param[in]   max_shift  : buddy_max_shift 참고
+ *
+ * bitmap과 order map은 page 개수에 비례하므로, page를 크게 잡으면 줄어든다.
+ */
+uint64_t
+buddy_allocator_metasize(uint64_t max_size, int page_shift, int max_shift)
+{
+    int i, bins_cnt;
+    uint64_t bytes, bits;
+    uint64_t byte_sum = 0;
+
+    bins_cnt = buddy_max_shift(max_size, page_shift, max_shift) -
+               buddy_page_shift(page_shift) + 1;
+
+    bits = max_size >> buddy_page_shift(page_shift);
+    for (i = 0; i < bins_cnt; i++)
+    {
+        bytes = bits / 8 + 1; /* 마지막에 sentinel bit 필요 */
+        byte_sum += bytes;
+        bits = (bits + 1) / 2;
+    }
+
+    /* order map */
+    byte_sum += max_size >> buddy_page_shift(page_shift);
+
+    return sizeof(pbuddy_alloc_t) + _ORDER_ARRAYS_SIZE(bins_cnt) +
+           byte_sum * sizeof(char);
+}
+
+/* header 바로 뒤에 붙어있는 order별 배열, bitmap, order map의 위치를 잡는다.
+ * alloc->page_shift, alloc->bins_cnt가 설정되어 있어야 하고, reset이면 bitmap을 모두
+ * allocated(1)로, order map을 0으로 초기화한다. */
+static void
+buddy_layout_setup(pbuddy_alloc_t *alloc, uint64_t max_size, bool reset)
+{
+    char *bitmap;          // bitmap 영역
+    char *arrays;
+    uint64_t bytes, bits;
+    int i;
+
+    arrays = (char *)alloc + sizeof(pbuddy_alloc_t);
+    alloc->bins = (list_t *)arrays;
+    arrays += alloc->bins_cnt * sizeof(list_t);
+    alloc->free_cnt = (uint64_t *)arrays;
+    arrays += alloc->bins_cnt * sizeof(uint64_t);
+    alloc->bitmap = (char **)arrays;
+    arrays += alloc->bins_cnt * sizeof(char *);
+    alloc->bitmap_size = (uint64_t *)arrays;
+    arrays += alloc->bins_cnt * sizeof(uint64_t);
+    alloc->mag_depth = (int *)arrays;
+
+    bitmap = (char *)alloc + sizeof(pbuddy_alloc_t) +
+             _ORDER_ARRAYS_SIZE(alloc->bins_cnt);
+
+    bits = max_size / _PAGESIZE;
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        bytes = bits / 8 + 1; /* 마지막에 sentinel bit 필요 */
+        alloc->bitmap[i] = bitmap;
+        alloc->bitmap_size[i] = bytes;
+        if (reset)
+            memset(bitmap, 0xff, bytes);
+
+        bitmap += bytes;
+        bits = (bits + 1) / 2;
+    }
+
+    alloc->omap = (uint8_t *)bitmap;
+    if (reset)
+        memset(alloc->omap, 0, max_size / _PAGESIZE);
+}
+
+/* mutex, free list, thread magazine 등 process가 살아있는 동안만 의미가
+ * 있는 부분을 초기화한다. */
+static void
+buddy_runtime_setup(pbuddy_alloc_t *alloc)
+{
+    pthread_mutexattr_t attr;
+    int i;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&alloc->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        INIT_LIST_HEAD(&alloc->bins[i]);
+        alloc->free_cnt[i] = 0;
+    }
+    alloc->binmap = 0;
+
+    buddy_mag_register(alloc);
+    INIT_LIST_HEAD(&alloc->magazines);
+    for (i = 0; i < alloc->bins_cnt; i++)
+        alloc->mag_depth[i] = 0;
+    alloc->mag_hit_cnt = 0;
+    alloc->mag_miss_cnt = 0;
+
+    alloc->punch_fd = -1;
+    alloc->punch_offset = 0;
+    alloc->punch_size = 0;
+    alloc->punch_age = 0;
+    alloc->punch_next = 0;
+    alloc->punch_eager = false;
+    alloc->punch_cnt = 0;
+    alloc->punched_bytes = 0;
+
+    alloc->persist = TB_PERSIST_NONE;
+}
+
+/**
+ * @brief         buddy_allocator 생성
+ *
+ * @param[in]   size       : allocator에서 사용할 memory의 전체 크기
+ * @param[in]   page_shift : 최소 order (0이면 4K)
+ * @param[in]   max_shift  : 최대 order 제한 (0이면 max_size에 맞춘다)
+ *
+ * fixed memory allocator를 위한 buddy allocator를 작성한다.
+ * fixed memory allocator 이므로 처음에 할당받은 memory만 가지고 작업하게 된다.
+ * header와 bitmap은 malloc으로 받은 DRAM에 둔다.
+ */
+pbuddy_alloc_t *
+buddy_allocator_new(void *page_start, uint64_t max_size, uint64_t size,
+                    int page_shift, int max_shift, char *file_fullpath)
+{
+    pbuddy_alloc_t *alloc; // 헤더
+
+    alloc = (pbuddy_alloc_t *)malloc(buddy_allocator_metasize(max_size, page_shift,
+                                                              max_shift));
+    if (alloc == NULL)
+        return NULL;
+
+    buddy_allocator_init(alloc, page_start, max_size, size, page_shift, max_shift,
+                         file_fullpath);
+    alloc->meta_inplace = false;
+
+    return alloc;
+} /* buddy_allocator_new */
+
+/**
+ * @brief       주어진 공간(meta)에 buddy allocator를 만든다.
+ *
+ * @param[in]   meta     : buddy_allocator_metasize(max_size, page_shift, max_shift)
+ *                         이상의 공간
+ *
+ * meta를 pmem file 안에 두면 header와 bitmap이 같이 저장되므로, 나중에
+ * buddy_allocator_attach로 다시 열 수 있다.
+ */
+pbuddy_alloc_t *
+buddy_allocator_init(void *meta, void *page_start, uint64_t max_size,
+                     uint64_t size, int page_shift, int max_shift,
+                     char *file_fullpath)
+{
+    pbuddy_alloc_t *alloc = (pbuddy_alloc_t *)meta;
+    uint64_t bits;
+    uint64_t available_bits;
+
+    alloc->page_shift = buddy_page_shift(page_shift);
+    alloc->max_shift = buddy_max_shift(max_size, page_shift, max_shift);
+    alloc->bins_cnt = alloc->max_shift - alloc->page_shift + 1;
+
+    buddy_layout_setup(alloc, max_size, true);
+    buddy_runtime_setup(alloc);
+
+    alloc->meta_inplace = true;
+    alloc->page_start = (char *)page_start;
+    alloc->reserved = buddy_allocator_metasize(max_size, page_shift, max_shift);
+
+    /* 추후 expand 고려해서 쓸 수 있는 전체 buddy page 개수 */
+    bits = max_size / _PAGESIZE;
+    /* 현재 buddy_malloc으로 쓸수 있는 buddy page 개수 */
+    available_bits = size / _PAGESIZE;
+
+    /* page #0..#(bits - 1) : free pages
+     * page #bits           : sentinal page
+     */
+
+    alloc->file_fullpath = file_fullpath;
+    alloc->alloc_size = max_size;
+    alloc->max_available_size = bits * _PAGESIZE;
+    alloc->available_size = available_bits * _PAGESIZE;
+    alloc->total_used = available_bits * _PAGESIZE;
+    alloc->periodic_total_used_max = 0;
+
+    /*
+     * buddy allocator 구조 다 만든 후 buddy_malloc으로 받을 수 있게
+     * free 해 주는데, 여기서! 실제 쓸 수 있는 곳 까지만 free 해 준다
+     * 그러면 아직 뒷 부분은 free가 안 되서 malloc 받을 수 없다! 추후에
+     * resize 때 TOTAL_SHM_SIZE가 늘어나면 그 때 늘어난 만큼 더 free 해 준다!
+     */
+    buddy_free_range(alloc, 0, available_bits, false);
+
+    return alloc;
+} /* buddy_allocator_init */
+
+/**
+ * @brief       저장되어 있던 buddy allocator를 다시 연다.
+ *
+ * @param[in]   meta        : buddy_allocator_init 했던 header의 현재 주소
+ * @param[in]   page_start  : page 영역의 현재 주소 (이전과 달라도 됨)
+ *
+ * header 안의 pointer들은 이전 process의 주소이므로 모두 다시 잡고,
+ * free list는 bitmap에서 0인 bit(free chunk)를 찾아 다시 만든다.
+ * 이전에 thread magazine에 들어있던 chunk는 allocated 상태로 남는다.
+ */
+pbuddy_alloc_t *
+buddy_allocator_attach(void *meta, void *page_start, char *file_fullpath)
+{
+    pbuddy_alloc_t *alloc = (pbuddy_alloc_t *)meta;
+    buddy_chunk_t *chunk;
+    uint64_t idx, nbits, word;
+    char *bitmap;
+    int i;
+
+    /* page_shift, max_shift, bins_cnt는 저장되어 있던 값을 그대로 쓴다. */
+    buddy_layout_setup(alloc, alloc->alloc_size, false);
+    buddy_runtime_setup(alloc);
+
+    alloc->meta_inplace = true;
+    alloc->page_start = (char *)page_start;
+    alloc->file_fullpath = file_fullpath;
+
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        bitmap = alloc->bitmap[i];
+        nbits = (alloc->available_size / _PAGESIZE) >> i;
+
+        for (idx = 0; idx < nbits; idx++)
+        {
+            /* 대부분은 allocated이므로 64bit 단위로 건너뛴다. */
+            if ((idx & 63) == 0 && idx + 64 <= nbits)
+            {
+                memcpy(&word, bitmap + idx / 8, sizeof(word));
+                if (word == ~0ULL)
+                {
+                    idx += 63;
+                    continue;
+                }
+            }
+
+            if ((*_BITMAP_BYTE(i, idx) & _BITMASK(idx)) == 0)
+            {
+                chunk = _CHUNK_AT_OFFSET(page_start, idx * _CHUNKSIZE(i));
+                /* punched는 파일에 남아있는 값 그대로, 시각은 이전 process
+                 * 기준이므로 지금으로 다시 잡는다. */
+                chunk->free_time = buddy_now();
+                buddy_bin_add(alloc, chunk, i);
+            }
+        }
+    }
+
+    return alloc;
+} /* buddy_allocator_attach */
+
+/**
+ * @brief       order map을 기준으로 free list와 bitmap을 다시 만든다.
+ *
+ * @param[in]   alloc   : buddy_allocator_attach로 연 allocator
+ *
+ * 정상 종료되지 않은 pool에서는 bitmap이 할당 중간 상태이거나, thread
+ * magazine에 있던 chunk들이 allocated로 남아있을 수 있다. order map에
+ * 기록된 할당만 살아있는 것으로 보고, 나머지 page들은 모두 free 한다.
+ * 사용자에게 주소가 넘어가기 전에 죽은 할당은 order map에 없으므로 같이
+ * 회수된다.
+ *
+ * @return      회수한 크기 (이전 bitmap 기준 사용량과의 차이)
+ */
+uint64_t
+buddy_allocator_recover(pbuddy_alloc_t *alloc)
+{
+    uint64_t page_idx, gap_start, npages, old_used;
+    uint8_t omap;
+    int i;
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    old_used = alloc->total_used;
+
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        INIT_LIST_HEAD(&alloc->bins[i]);
+        alloc->free_cnt[i] = 0;
+        memset(alloc->bitmap[i], 0xff, alloc->bitmap_size[i]);
+    }
+    alloc->binmap = 0;
+    alloc->punched_bytes = 0;
+    alloc->total_used = alloc->available_size;
+
+    npages = alloc->available_size / _PAGESIZE;
+    gap_start = 0;
+    for (page_idx = 0; page_idx < npages;)
+    {
+        omap = alloc->omap[page_idx];
+        if (omap == 0)
+        {
+            page_idx++;
+            continue;
+        }
+
+        if (gap_start < page_idx)
+            buddy_free_range(alloc, gap_start, page_idx, false);
+        page_idx += 1ULL << ((omap & BUDDY_OMAP_ORDER) - 1);
+        gap_start = page_idx;
+    }
+    if (gap_start < npages)
+        buddy_free_range(alloc, gap_start, npages, false);
+
+    alloc->periodic_total_used_max = alloc->total_used;
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    return old_used - alloc->total_used;
+} /* buddy_allocator_recover */
+
+void buddy_allocator_expand(pbuddy_alloc_t *alloc, uint64_t old_size, uint64_t new_size)
+{
+    uint64_t old_bits, new_bits;
+
+    assert(old_size < new_size);
+
+    /* 새로운 size만큼 뒷 부분 free 해주면 이후에 buddy malloc 가능 */
+    old_bits = (old_size - alloc->reserved) / _PAGESIZE;
+    new_bits = (new_size - alloc->reserved) / _PAGESIZE;
+
+    alloc->available_size = new_bits * _PAGESIZE;
+    alloc->total_used += (new_bits - old_bits) * _PAGESIZE;
+    alloc->periodic_total_used_max = MAX(alloc->total_used,
+                                         alloc->periodic_total_used_max);
+
+    buddy_free_range(alloc, old_bits, new_bits, false);
+}
+
+/**
+ * @brief       page #first_page..#(last_page - 1) 구간을 free 상태로 만든다.
+ *
+ * 구간을 page 단위로 하나씩 free 하지 않고, 앞에서부터 정렬이 맞는 가장 큰
+ * chunk로 잘라서 free 한다. 이렇게 자른 chunk끼리는 (최대 크기가 아니라면)
+ * 서로 buddy가 될 수 없으므로, coalescing은 구간 앞쪽 경계에서 기존 free
+ * chunk와 만날 때만 일어난다. 따라서 비용은 page 개수가 아니라 잘라낸 chunk
+ * 개수에 비례한다. (bitmap은 생성 시 memset으로 한 번에 채워져 있다.)
+ *
+ * punched이면 구간 전체가 이미 파일에서 punch 되어 있는 것이다. 조각마다
+ * header를 쓰면서 그 page는 다시 block이 잡히지만, _PUNCHED_SIZE가 header
+ * page를 빼고 세므로 punched_bytes는 실제 hole 크기와 맞는다.
+ *
+ * mutex는 호출하는 쪽에서 필요하면 잡는다.
+ */
+static inline int
+buddy_range_piece(pbuddy_alloc_t *alloc, uint64_t page_idx, uint64_t last_page)
+{
+    int bin_idx;
+
+    /* page_idx 위치에 정렬되는 최대 order */
+    if (page_idx == 0)
+        bin_idx = alloc->bins_cnt - 1;
+    else
+        bin_idx = MIN(__builtin_ctzll(page_idx), alloc->bins_cnt - 1);
+
+    /* 남은 구간 안에 들어가는 최대 order */
+    return MIN(bin_idx, 63 - __builtin_clzll(last_page - page_idx));
+}
+
+static void
+buddy_free_range(pbuddy_alloc_t *alloc, uint64_t first_page, uint64_t last_page,
+                 bool punched)
+{
+    uint64_t page_idx = first_page;
+    uint64_t free_time = (alloc->punch_size > 0) ? buddy_now() : 0;
+    int bin_idx;
+
+    while (page_idx < last_page)
+    {
+        bin_idx = buddy_range_piece(alloc, page_idx, last_page);
+
+        alloc->total_used -= _CHUNKSIZE(bin_idx);
+        buddy_coalesce(alloc,
+                       (buddy_chunk_t *)(alloc->page_start + page_idx * _PAGESIZE),
+                       bin_idx, punched, free_time);
+
+        page_idx += 1ULL << bin_idx;
+    }
+} /* buddy_free_range */
+
+/**
+ * @brief       buddy allocator 삭제
+ *
+ * @param[in]   alloc
+ *
+ * thread magazine들을 해제한다. header가 malloc으로 받은 것이면 같이
+ * 해제하고, buddy_allocator_init으로 만든 것이면 magazine의 chunk들을
+ * 먼저 free list로 돌려서 bitmap에 반영한 뒤 header는 그대로 남겨둔다.
+ * 실제 page 영역(mmap 등)은 호출한 쪽에서 이 함수 이후에 정리해야 한다.
+ */
+void buddy_allocator_delete(pbuddy_alloc_t *alloc)
+{
+    buddy_magazine_t *mag;
+
+    buddy_mag_unregister(alloc);
+
+    while (!list_empty(&alloc->magazines))
+    {
+        mag = list_entry(alloc->magazines.next, buddy_magazine_t, link);
+        if (alloc->meta_inplace)
+            buddy_magazine_flush(alloc, mag);
+        list_del(&mag->link);
+        free(mag);
+    }
+
+    pthread_mutex_destroy(&alloc->mutex);
+    if (!alloc->meta_inplace)
+        free(alloc);
+} /* buddy_allocator_delete */
+
+/**
+ * @brief       order별 magazine depth 설정
+ *
+ * @param[in]   alloc
+ * @param[in]   size     대상 chunk 크기 (2^n)
+ * @param[in]   depth    thread 당 보관할 최대 chunk 개수, 0이면 사용 안 함
+ *
+ * @warning 해당 order의 chunk가 이미 magazine에 들어간 뒤에 depth를 0으로
+ *          줄이면, 남은 chunk들은 thread가 종료될 때 반납된다.
+ */
+void buddy_set_magazine_depth(pbuddy_alloc_t *alloc, uint64_t size, int depth)
+{
+    int bin_idx;
+
+    size = get_buddy_alloc_size(size);
+    assert(depth >= 0);
+
+    if (size < _PAGESIZE)
+        return;
+
+    bin_idx = _SIZE2BIN(size);
+    if (bin_idx >= alloc->bins_cnt)
+        return;
+
+    alloc->mag_depth[bin_idx] = depth;
+}
+
+/**
+ * @brief       free chunk를 파일에서 punch 해서 filesystem에 돌려주도록 설정
+ *
+ * @param[in]   fd           page 영역이 mapping 된 파일
+ * @param[in]   file_offset  page_start의 파일 내 offset
+ * @param[in]   min_size     이 크기 이상인 free chunk만 punch, 0이면 사용 안 함
+ * @param[in]   age          free 된 뒤 이 시간(초)이 지나야 punch
+ * @param[in]   eager        punch 된 chunk를 다시 줄 때 fallocate로 미리
+ *                           block을 잡아둔다. false이면 처음 접근할 때
+ *                           page fault로 잡힌다.
+ *
+ * chunk의 header가 있는 첫 page는 남겨두므로 min_size는 2 page 이상이다.
+ * punch는 free 하는 경로에서, 마지막 trim 이후 age/2(최소 1초)가 지났을 때
+ * 같이 한다.
+ * fallocate 하는 동안에는 mutex를 놓는다. buddy_trim으로 직접 할 수도 있다.
+ */
+void buddy_set_punch(pbuddy_alloc_t *alloc, int fd, uint64_t file_offset,
+                     uint64_t min_size, uint64_t age, bool eager)
+{
+    pthread_mutex_lock(&alloc->mutex);
+
+    alloc->punch_fd = fd;
+    alloc->punch_offset = file_offset;
+    alloc->punch_size = (min_size == 0 || fd < 0) ? 0 :
+                        get_buddy_alloc_size(MAX(min_size, MAX(2 * BUDDY_PAGESIZE, _PAGESIZE)));
+    alloc->punch_age = age;
+    alloc->punch_next = 0;
+    alloc->punch_eager = eager;
+
+    pthread_mutex_unlock(&alloc->mutex);
+}
+
+/**
+ * @brief       order map을 내보낼 방식 설정
+ *
+ * @param[in]   persist  page 영역이 있는 mapping의 persist 방식 (TB_PERSIST_*)
+ *
+ * buddy_flush_omap이 이 방식으로 flush 한다. 생성하거나 다시 열면
+ * TB_PERSIST_NONE이다.
+ */
+void buddy_set_persist(pbuddy_alloc_t *alloc, int persist)
+{
+    alloc->persist = persist;
+}
+
+/*
+ * min_size 이상이고 age 이상 지난 free chunk들을 punch 한다. mutex를 잡고
+ * 부르며, fallocate 하는 동안에는 mutex를 놓는다.
+ *
+ * 대상 chunk는 bins에서 빼고 bitmap에 allocated로 표시해 두므로, 그 사이에
+ * 다른 thread가 할당하거나 buddy와 합치지 않는다. punch가 끝나면 다시 mutex를
+ * 잡고 free 할 때처럼 buddy와 합치면서 bins에 돌려놓는다.
+ */
+static uint64_t
+buddy_trim_internal(pbuddy_alloc_t *alloc, uint64_t min_size, uint64_t age,
+                    uint64_t now)
+{
+    list_t pending[64];
+    buddy_chunk_t *chunk, *next;
+    uint64_t offset, file_offset, bitmap_idx, bytes = 0, cnt = 0;
+    int i, fd, first_bin;
+    bool failed = false;
+
+    fd = alloc->punch_fd;
+    if (fd < 0)
+        return 0;
+
+    file_offset = alloc->punch_offset;
+    min_size = get_buddy_alloc_size(MAX(min_size, MAX(2 * BUDDY_PAGESIZE, _PAGESIZE)));
+    first_bin = _SIZE2BIN(min_size);
+
+    for (i = first_bin; i < alloc->bins_cnt; i++)
+    {
+        INIT_LIST_HEAD(&pending[i]);
+        list_for_each_entry_safe(chunk, next, &alloc->bins[i], link, buddy_chunk_t)
+        {
+            if (chunk->punched || now - chunk->free_time < age)
+                continue;
+
+            buddy_bin_del(alloc, chunk, i);
+            bitmap_idx = _CHUNK2BITMAP(chunk, i);
+            *_BITMAP_BYTE(i, bitmap_idx) |= _BITMASK(bitmap_idx);
+            list_add_tail(&chunk->link, &pending[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    for (i = first_bin; i < alloc->bins_cnt && !failed; i++)
+    {
+        list_for_each_entry(chunk, &pending[i], link, buddy_chunk_t)
+        {
+            offset = file_offset + ((char *)chunk - alloc->page_start);
+            if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          offset + BUDDY_PAGESIZE, _CHUNKSIZE(i) - BUDDY_PAGESIZE))
+            {
+                /* 지원하지 않는 filesystem이면 더 시도하지 않는다. */
+                printf("fallocate(PUNCH_HOLE) failed (errno:%d, %s), "
+                       "hole punching is disabled\n", errno, strerror(errno));
+                failed = true;
+                break;
+            }
+
+            chunk->punched = true;
+            bytes += _CHUNKSIZE(i) - BUDDY_PAGESIZE;
+            cnt++;
+        }
+    }
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    if (failed)
+    {
+        alloc->punch_fd = -1;
+        alloc->punch_size = 0;
+    }
+    alloc->punch_cnt += cnt;
+
+    for (i = first_bin; i < alloc->bins_cnt; i++)
+    {
+        list_for_each_entry_safe(chunk, next, &pending[i], link, buddy_chunk_t)
+        {
+            list_del(&chunk->link);
+            buddy_coalesce(alloc, chunk, i, chunk->punched, chunk->free_time);
+        }
+    }
+
+    return bytes;
+}
+
+/**
+ * @brief       free chunk들을 바로 punch 한다.
+ *
+ * @param[in]   min_size    이 크기 이상인 free chunk만
+ * @param[in]   age         free 된 뒤 이 시간(초)이 지난 chunk만
+ * @return      punch 한 크기
+ *
+ * buddy_set_punch로 파일이 설정되어 있어야 한다.
+ */
+uint64_t buddy_trim(pbuddy_alloc_t *alloc, uint64_t min_size, uint64_t age)
+{
+    uint64_t bytes;
+
+    pthread_mutex_lock(&alloc->mutex);
+    bytes = buddy_trim_internal(alloc, min_size, age, buddy_now());
+    pthread_mutex_unlock(&alloc->mutex);
+
+    return bytes;
+}
+
+/* free 경로에서 부른다. mutex를 잡고 부르며, punch 하는 동안에는 놓는다. */
+static inline void
+buddy_punch_check(pbuddy_alloc_t *alloc)
+{
+    uint64_t now;
+
+    if (alloc->punch_size == 0)
+        return;
+
+    now = buddy_now();
+    if (now < alloc->punch_next)
+        return;
+
+    /* mutex를 놓는 동안 다른 thread가 또 trim 하지 않도록 먼저 갱신한다.
+     * trim은 bin 전체를 훑으므로 age가 작아도 너무 자주 하지 않는다. */
+    alloc->punch_next = now + MAX(alloc->punch_age / 2, _PUNCH_MIN_INTERVAL);
+    buddy_trim_internal(alloc, alloc->punch_size, alloc->punch_age, now);
+}
+
+/* punch 된 chunk를 내줄 때 eager이면 block을 미리 잡아둔다. */
+static inline void
+buddy_punch_refault(pbuddy_alloc_t *alloc, buddy_chunk_t *chunk, uint64_t size)
+{
+    int fd = alloc->punch_fd;
+
+    if (!chunk->punched || !alloc->punch_eager || fd < 0)
+        return;
+
+    if (fallocate(fd, 0, alloc->punch_offset + ((char *)chunk - alloc->page_start),
+                  size))
+        printf("fallocate failed (errno:%d, %s)\n", errno, strerror(errno));
+}
+
+static inline void
+buddy_magazine_push(buddy_magazine_t *mag, int bin_idx, buddy_chunk_t *chunk)
+{
+    chunk->link.next = (list_link_t *)mag->top[bin_idx];
+    mag->top[bin_idx] = chunk;
+    mag->cnt[bin_idx]++;
+}
+
+static inline buddy_chunk_t *
+buddy_magazine_pop(buddy_magazine_t *mag, int bin_idx)
+{
+    buddy_chunk_t *chunk = mag->top[bin_idx];
+
+    mag->top[bin_idx] = (buddy_chunk_t *)chunk->link.next;
+    mag->cnt[bin_idx]--;
+
+    return chunk;
+}
+
+/* magazine stack lock. 다른 thread와는 reclaim 할 때만 경합하므로 짧게 돈다.
+ * alloc->mutex도 잡아야 하면 항상 mutex를 먼저 잡는다. */
+static inline void
+buddy_magazine_lock(buddy_magazine_t *mag)
+{
+    while (__atomic_exchange_n(&mag->lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&mag->lock, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static inline void
+buddy_magazine_unlock(buddy_magazine_t *mag)
+{
+    __atomic_store_n(&mag->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* thread magazine 표의 칸. gen이 allocator의 mag_gen과 다르면 같은 id를
+ * 쓰던 예전 allocator의 것이고, 그 magazine은 이미 해제되었다. */
+typedef struct buddy_mag_slot_s
+{
+    buddy_magazine_t *mag;
+    uint64_t gen;
+} buddy_mag_slot_t;
+
+/* thread마다 하나. allocator의 mag_id로 index 한다. */
+typedef struct buddy_mag_table_s
+{
+    int cnt;
+    buddy_mag_slot_t slots[];
+} buddy_mag_table_t;
+
+#define BUDDY_MAG_MAX_ALLOCS    4096
+
+static pthread_once_t buddy_mag_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buddy_mag_key;
+static bool buddy_mag_key_ok = false;
+
+/* id별로 살아있는 allocator의 mag_gen, 0이면 빈 id. buddy_mag_mutex로 보호 */
+static pthread_mutex_t buddy_mag_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t buddy_mag_owner[BUDDY_MAG_MAX_ALLOCS];
+static uint64_t buddy_mag_gen = 0;
+
+/* thread 종료 시 불리는 pthread key destructor. 아직 살아있는 allocator의
+ * magazine만 반납한다. */
+static void
+buddy_mag_table_release(void *arg)
+{
+    buddy_mag_table_t *table = (buddy_mag_table_t *)arg;
+    int i;
+
+    pthread_mutex_lock(&buddy_mag_mutex);
+    for (i = 0; i < table->cnt; i++)
+    {
+        if (table->slots[i].mag != NULL &&
+            table->slots[i].gen == buddy_mag_owner[i])
+            buddy_magazine_release(table->slots[i].mag);
+    }
+    pthread_mutex_unlock(&buddy_mag_mutex);
+
+    free(table);
+}
+
+static void
+buddy_mag_key_init(void)
+{
+    buddy_mag_key_ok =
+        (pthread_key_create(&buddy_mag_key, buddy_mag_table_release) == 0);
+}
+
+/* allocator에 magazine 표의 id를 준다. key를 만들지 못했거나 id가 모자라면
+ * mag_id는 -1이고 magazine을 쓰지 않는다. */
+static void
+buddy_mag_register(pbuddy_alloc_t *alloc)
+{
+    int i;
+
+    alloc->mag_id = -1;
+    alloc->mag_gen = 0;
+
+    pthread_once(&buddy_mag_once, buddy_mag_key_init);
+    if (!buddy_mag_key_ok)
+        return;
+
+    pthread_mutex_lock(&buddy_mag_mutex);
+    for (i = 0; i < BUDDY_MAG_MAX_ALLOCS; i++)
+    {
+        if (buddy_mag_owner[i] == 0)
+        {
+            alloc->mag_id = i;
+            alloc->mag_gen = buddy_mag_owner[i] = ++buddy_mag_gen;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&buddy_mag_mutex);
+}
+
+/* 이후로 종료되는 thread는 이 allocator의 magazine을 건드리지 않는다. */
+static void
+buddy_mag_unregister(pbuddy_alloc_t *alloc)
+{
+    if (alloc->mag_id < 0)
+        return;
+
+    pthread_mutex_lock(&buddy_mag_mutex);
+    buddy_mag_owner[alloc->mag_id] = 0;
+    pthread_mutex_unlock(&buddy_mag_mutex);
+
+    alloc->mag_id = -1;
+}
+
+/* 호출한 thread의 magazine 표에 id 칸이 있도록 늘린다. */
+static buddy_mag_table_t *
+buddy_mag_table_get(int id)
+{
+    buddy_mag_table_t *table, *old;
+    int cnt;
+
+    old = table = (buddy_mag_table_t *)pthread_getspecific(buddy_mag_key);
+    if (table != NULL && id < table->cnt)
+        return table;
+
+    cnt = MAX(id + 1, table != NULL ? table->cnt * 2 : 8);
+    cnt = MIN(cnt, BUDDY_MAG_MAX_ALLOCS);
+    table = (buddy_mag_table_t *)realloc(table, sizeof(buddy_mag_table_t) +
+                                                cnt * sizeof(buddy_mag_slot_t));
+    if (table == NULL)
+        return NULL;
+
+    if (old == NULL)
+        table->cnt = 0;
+    memset(&table->slots[table->cnt], 0,
+           (cnt - table->cnt) * sizeof(buddy_mag_slot_t));
+    table->cnt = cnt;
+
+    if (table != old && pthread_setspecific(buddy_mag_key, table) != 0)
+    {
+        /* 예전 표는 realloc으로 이미 옮겨졌으므로 key에 남은 값을 지운다. */
+        pthread_setspecific(buddy_mag_key, NULL);
+        buddy_mag_table_release(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/* 호출한 thread의 magazine. 처음 부르면 생성해서 alloc에 등록한다.
+ * magazine을 쓸 수 없으면 NULL. */
+static buddy_magazine_t *
+buddy_magazine_get(pbuddy_alloc_t *alloc)
+{
+    buddy_mag_table_t *table;
+    buddy_mag_slot_t *slot;
+    buddy_magazine_t *mag;
+
+    if (alloc->mag_id < 0)
+        return NULL;
+
+    table = (buddy_mag_table_t *)pthread_getspecific(buddy_mag_key);
+    if (table != NULL && alloc->mag_id < table->cnt &&
+        table->slots[alloc->mag_id].gen == alloc->mag_gen)
+        return table->slots[alloc->mag_id].mag;
+
+    table = buddy_mag_table_get(alloc->mag_id);
+    if (table == NULL)
+        return NULL;
+
+    mag = (buddy_magazine_t *)calloc(1, sizeof(buddy_magazine_t) +
+                                        alloc->bins_cnt * (sizeof(buddy_chunk_t *) +
+                                                           sizeof(int)));
+    if (mag == NULL)
+        return NULL;
+
+    mag->alloc = alloc;
+    mag->top = (buddy_chunk_t **)(mag + 1);
+    mag->cnt = (int *)(mag->top + alloc->bins_cnt);
+
+    pthread_mutex_lock(&alloc->mutex);
+    list_add_tail(&mag->link, &alloc->magazines);
+    pthread_mutex_unlock(&alloc->mutex);
+
+    slot = &table->slots[alloc->mag_id];
+    slot->mag = mag;
+    slot->gen = alloc->mag_gen;
+
+    return mag;
+}
+
+/* magazine의 chunk를 모두 공용 bin으로 반납. mutex를 잡은 상태에서 부른다. */
+static void
+buddy_magazine_flush(pbuddy_alloc_t *alloc, buddy_magazine_t *mag)
+{
+    int i;
+
+    buddy_magazine_lock(mag);
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        while (mag->cnt[i] > 0)
+            buddy_free_internal(alloc, buddy_magazine_pop(mag, i),
+                                _CHUNKSIZE(i), false);
+    }
+    buddy_magazine_unlock(mag);
+}
+
+/* 모든 thread의 magazine을 비운다. mutex를 잡은 상태에서 부른다. */
+static void
+buddy_magazine_reclaim(pbuddy_alloc_t *alloc)
+{
+    buddy_magazine_t *mag;
+
+    list_for_each_entry(mag, &alloc->magazines, link, buddy_magazine_t)
+        buddy_magazine_flush(alloc, mag);
+}
+
+/*
+ * 공용 bin에서 chunk를 떼어온다. 남은 게 없으면 thread magazine들에 묶여있던
+ * chunk를 모두 돌려받아 coalescing 될 기회를 준 뒤 한 번 더 시도한다. mutex를
+ * 잡고 부른다.
+ */
+static void *
+buddy_malloc_reclaim(pbuddy_alloc_t *alloc, int bin_idx)
+{
+    void *chunk;
+
+    chunk = buddy_malloc_internal(alloc, bin_idx);
+    if (chunk == NULL && !list_empty(&alloc->magazines))
+    {
+        buddy_magazine_reclaim(alloc);
+        chunk = buddy_malloc_internal(alloc, bin_idx);
+    }
+
+    return chunk;
+}
+
+/* 종료하는 thread의 magazine을 반납한다. buddy_mag_mutex를 잡고 부른다. */
+static void
+buddy_magazine_release(buddy_magazine_t *mag)
+{
+    pbuddy_alloc_t *alloc = mag->alloc;
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    buddy_magazine_flush(alloc, mag);
+    alloc->mag_hit_cnt += mag->hit_cnt;
+    alloc->mag_miss_cnt += mag->miss_cnt;
+    list_del(&mag->link);
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    free(mag);
+}
+
+/**
+ * @brief        buddy memory allocator
+ *
+ * @param[in]   alloc
+ * @param[in]   size
+ *
+ * buddy allocator에서 메모리를 받아가는 함수.
+ * 반드시 2^n 크기로 요청해야만 한다. 최대 chunk 크기보다 크면 NULL.
+ *
+ * magazine을 사용하는 order이면 thread magazine에서 먼저 꺼내오고, 비어
+ * 있을 때만 mutex를 잡고 공용 bin에서 batch로 채워온다. 공용 bin도 비어
+ * 있으면 모든 thread의 magazine을 비운 뒤 다시 찾는다.
+ */
+void *
+buddy_malloc(pbuddy_alloc_t *alloc, uint64_t size)
+{
+    void *chunk;
+
+    size = MAX(get_buddy_alloc_size(size), _PAGESIZE);
+
+    chunk = buddy_reserve(alloc, size);
+    if (chunk != NULL)
+        (void)buddy_omap_set(alloc, chunk, size, false);
+
+    return chunk;
+} /* buddy_malloc */
+
+/**
+ * @brief       order map에 기록하지 않고 chunk를 떼어온다.
+ *
+ * buddy_malloc과 같지만, 다시 열 때 복구되지 않는다. 할당을 다른 곳에
+ * 기록한 뒤에 buddy_omap_set으로 order map에 남긴다. 그 전에 죽으면 chunk는
+ * buddy_allocator_recover가 회수한다.
+ */
+void *
+buddy_reserve(pbuddy_alloc_t *alloc, uint64_t size)
+{
+    buddy_magazine_t *mag = NULL;
+    buddy_chunk_t *chunk = NULL, *extra;
+    int i, batch;
+    int bin_idx;             /* bitmap 몇 번째 레벨 (ex. 8192 -> 0) */
+
+    /* 2의 제곱수 확인 */
+    size = MAX(get_buddy_alloc_size(size), _PAGESIZE);
+    assert((size & (size - 1)) == 0);
+
+    bin_idx = _SIZE2BIN(size);
+    if (bin_idx >= alloc->bins_cnt)
+        return NULL;
+
+    if (alloc->mag_depth[bin_idx] > 0)
+        mag = buddy_magazine_get(alloc);
+
+    if (mag == NULL)
+    {
+        pthread_mutex_lock(&alloc->mutex);
+        chunk = buddy_malloc_reclaim(alloc, bin_idx);
+        pthread_mutex_unlock(&alloc->mutex);
+
+        goto out;
+    }
+
+    buddy_magazine_lock(mag);
+    if (mag->cnt[bin_idx] > 0)
+        chunk = buddy_magazine_pop(mag, bin_idx);
+    buddy_magazine_unlock(mag);
+
+    if (chunk != NULL)
+    {
+        mag->hit_cnt++;
+        goto out;
+    }
+
+    mag->miss_cnt++;
+    batch = _MAG_BATCH(alloc->mag_depth[bin_idx]);
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    chunk = buddy_malloc_reclaim(alloc, bin_idx);
+
+    buddy_magazine_lock(mag);
+    for (i = 1; chunk != NULL && i < batch; i++)
+    {
+        extra = buddy_malloc_internal(alloc, bin_idx);
+        if (extra == NULL)
+            break;
+        buddy_magazine_push(mag, bin_idx, extra);
+    }
+    buddy_magazine_unlock(mag);
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+out:
+    if (chunk != NULL)
+        buddy_punch_refault(alloc, chunk, size);
+
+    return chunk;
+} /* buddy_reserve */
+
+/* 공용 bin에서 bin_idx 크기의 chunk 하나를 떼어온다. mutex를 잡고 부른다. */
+static void *
+buddy_malloc_internal(pbuddy_alloc_t *alloc, int bin_idx)
+{
+    buddy_chunk_t *chunk, *buddy;
+    uint64_t size = _CHUNKSIZE(bin_idx);
+    uint64_t avail;
+    int i;
+    uint64_t bitmap_idx;     /* 그 레벨 bitmap 중 몇 번째 chunk */
+    int bitmask;
+    char *bitmap_byte;
+
+    /*
+     * bin_idx는 요구하는 size가 몇 레벨 chunk에 해당되는지 나타냄
+     * bitmap_idx는 해당 레벨 chunk 중 앞에서부터 몇 번째 chunk인지 나타냄
+     * 예) size = 8192, 앞에서부터 3번째까지 8192 chunk 모두 사용 중이면
+     * bin_idx = 1 (2번째로 작은 chunk, bitmap_idx = 3 (앞에서부터 4번째)
+     */
+
+    /* bin_idx 이상에서 비어있지 않은 가장 작은 bin을 binmap으로 바로 찾는다. */
+    avail = alloc->binmap >> bin_idx;
+    if (avail == 0)
+        return NULL;
+
+    i = __builtin_ctzll(avail);
+    bin_idx += i;
+
+    chunk = list_entry(alloc->bins[bin_idx].next, buddy_chunk_t, link);
+    buddy_bin_del(alloc, chunk, bin_idx);
+
+    bitmap_idx = _CHUNK2BITMAP(chunk, bin_idx);
+    bitmap_byte = _BITMAP_BYTE(bin_idx, bitmap_idx);
+    bitmask = _BITMASK(bitmap_idx);
+
+    *bitmap_byte |= bitmask;
+
+    for (; i > 0; i--)
+    {
+        bin_idx--;
+
+        buddy = _CHUNK_AT_OFFSET(chunk, (ptrdiff_t)_CHUNKSIZE(bin_idx));
+        buddy->punched = chunk->punched;
+        buddy->free_time = chunk->free_time;
+
+        buddy_bin_add(alloc, buddy, bin_idx);
+
+        bitmap_idx = _CHUNK2BITMAP(buddy, bin_idx);
+        bitmap_byte = _BITMAP_BYTE(bin_idx, bitmap_idx);
+        bitmask = _BITMASK(bitmap_idx);
+
+        *bitmap_byte &= ~bitmask;
+    }
+
+    alloc->total_used += size;
+    alloc->periodic_total_used_max = MAX(alloc->total_used,
+                                         alloc->periodic_total_used_max);
+
+    return chunk;
+} /* buddy_malloc_internal */
+
+/* page가 이 allocator에서 할당된 chunk의 첫 page이면 그 order map 값을,
+ * 아니면 0을 돌려준다. buddy_malloc_exact 할당의 뒤쪽 조각도 0이다. */
+static inline uint8_t
+buddy_omap_lookup(pbuddy_alloc_t *alloc, void *page, uint64_t *page_idx)
+{
+    uint64_t offset;
+
+    if ((char *)page < alloc->page_start)
+        return 0;
+
+    offset = (char *)page - alloc->page_start;
+    if (offset >= alloc->available_size || (offset & (_PAGESIZE - 1)) != 0)
+        return 0;
+
+    *page_idx = offset / _PAGESIZE;
+    if (alloc->omap[*page_idx] & BUDDY_OMAP_CONT)
+        return 0;
+
+    return alloc->omap[*page_idx];
+}
+
+/* page가 앞 allocator의 할당에 이어지는 조각(BUDDY_OMAP_CONT)인 이 allocator의
+ * 첫 page이면 그 order map 값을, 아니면 0을 돌려준다. */
+static inline uint8_t
+buddy_omap_lookup_cont(pbuddy_alloc_t *alloc, void *page, uint64_t *page_idx)
+{
+    if (page != alloc->page_start || alloc->available_size == 0 ||
+        (alloc->omap[0] & BUDDY_OMAP_CONT) == 0)
+        return 0;
+
+    *page_idx = 0;
+
+    return alloc->omap[0];
+}
+
+/* page_idx의 조각(order map 값 omap) 다음 조각이 같은 할당에 이어지면 그
+ * index를, 아니면 0을 돌려준다. */
+static inline uint64_t
+buddy_omap_next(pbuddy_alloc_t *alloc, uint64_t page_idx, uint8_t omap)
+{
+    page_idx += 1ULL << ((omap & BUDDY_OMAP_ORDER) - 1);
+    if (page_idx >= alloc->available_size / _PAGESIZE ||
+        (alloc->omap[page_idx] & BUDDY_OMAP_CONT) == 0)
+        return 0;
+
+    return page_idx;
+}
 
 /**
- * @brief         buddy_allocator 생성
+ * @brief   buddy memory deallocator
  *
- * @param[in]   size     : allocator에서 사용할 memory의 전체 크기
+ * @param[in]      alloc
+ * @param[in,out]  page
  *
- * fixed memory allocator를 위한 buddy allocator를 작성한다.
- * fixed memory allocator 이므로 처음에 할당받은 memory만 가지고 작업하게 된다.
+ * buddy_malloc, buddy_malloc_exact로 받은 메모리를 반납하는 함수.
+ * 크기는 order map에서 찾는다.
  *
+ * @return  이 allocator가 준 주소가 아니거나 이미 free 된 주소이면 false.
  */
-pbuddy_alloc_t *
-buddy_allocator_new(void *page_start, uint64_t max_size, uint64_t size, char *file_fullpath)
+bool buddy_free(pbuddy_alloc_t *alloc, void *page)
 {
-    pbuddy_alloc_t *alloc; // 헤더
-    char *bitmap;          // bitmap 영역
-    int i;
-    int bytes, bits;
-    int available_bits;
-    char *page;
+    uint64_t size;
 
-    int byte_sum = 0;
-    bits = max_size / BUDDY_PAGESIZE;
-    for (i = 0; i < BUDDY_BINS_CNT; i++)
+    size = buddy_omap_clear(alloc, page, false);
+    if (size == 0)
     {
-        bytes = bits / 8 + 1; /* 마지막에 sentinel bit 필요 */
-        byte_sum += bytes;
-        bits = (bits + 1) / 2;
+        printf("buddy_free: %p is not allocated from %p (double free?)\n",
+               page, alloc);
+        return false;
     }
 
-    uint64_t reserved = sizeof(pbuddy_alloc_t) + byte_sum * sizeof(char);
-    alloc = (pbuddy_alloc_t *)malloc(reserved);
-
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&alloc->mutex, &attr);
-    pthread_mutexattr_destroy(&attr);
+    buddy_release(alloc, page, size);
 
-    for (i = 0; i < BUDDY_BINS_CNT; i++)
-        INIT_LIST_HEAD(&alloc->bins[i]);
+    return true;
+} /* buddy_free */
 
-    bitmap = (char *)alloc + sizeof(pbuddy_alloc_t);
+/**
+ * @brief       buddy_omap_clear로 지운 할당을 allocator에 돌려준다.
+ *
+ * @param[in]   size     buddy_omap_clear가 돌려준 크기
+ *
+ * 정렬이 맞는 2^n chunk 하나이면 그대로 반납하고, 아니면 buddy_omap_set이
+ * 기록했던 것과 같은 조각들로 나누어 반납한다.
+ */
+void buddy_release(pbuddy_alloc_t *alloc, void *page, uint64_t size)
+{
+    buddy_magazine_t *mag = NULL;
+    uint64_t page_idx, last_page;
+    int i, cnt, bin_idx;
 
-    bits = max_size / BUDDY_PAGESIZE;
-    for (i = 0; i < BUDDY_BINS_CNT; i++)
+    page_idx = ((char *)page - alloc->page_start) / _PAGESIZE;
+    if ((size & (size - 1)) != 0 || _SIZE2BIN(size) >= alloc->bins_cnt ||
+        (page_idx & ((size / _PAGESIZE) - 1)) != 0)
     {
-        bytes = bits / 8 + 1; /* 마지막에 sentinel bit 필요 */
-        alloc->bitmap[i] = bitmap;
-        alloc->bitmap_size[i] = bytes;
-        memset(bitmap, 0xff, bytes);
-
-        bitmap += bytes;
-        bits = (bits + 1) / 2;
-    }
-
-    alloc->page_start = (char *)page_start;
-    alloc->reserved = reserved;
-
-    /* 추후 expand 고려해서 쓸 수 있는 전체 buddy page 개수 */
-    bits = max_size / BUDDY_PAGESIZE;
-    /* 현재 buddy_malloc으로 쓸수 있는 buddy page 개수 */
-    available_bits = size / BUDDY_PAGESIZE;
-
-    /* page #0..#(bits - 1) : free pages
-     * page #bits           : sentinal page
-     */
-
-    alloc->file_fullpath = file_fullpath;
-    alloc->alloc_size = max_size;
-    alloc->max_available_size = bits * BUDDY_PAGESIZE;
-    alloc->available_size = available_bits * BUDDY_PAGESIZE;
-    alloc->total_used = available_bits * BUDDY_PAGESIZE;
-    alloc->periodic_total_used_max = 0;
-
-    /*
-     * buddy allocator 구조 다 만든 후 buddy_malloc으로 받을 수 있게
-     * 처음 부터 끝까지 BUDDY_PAGESIZE 단위로 free 해 주는 과정 중에
-     * 여기서! 실제 쓸 수 있는 곳 까지만 free 해 준다 그러면 아직
-     * 뒷 부분은 free가 안 되서 malloc 받을 수 없다! 추후에 resize 때
-     * TOTAL_SHM_SIZE가 늘어나면 그 때 늘어난 만큼 더 free 해 준다!
-     */
-
-    for (i = 0, page = page_start; i < available_bits; i++, page += BUDDY_PAGESIZE)
-        buddy_free_internal(alloc, page, BUDDY_PAGESIZE, false);
+        /* buddy_malloc_exact로 받은 메모리: 조각마다 반납한다. 각 조각은
+         * buddy가 free이면 coalescing 되므로, 할당 때 돌려준 뒤쪽 page들이
+         * 아직 free라면 원래 크기의 chunk로 다시 합쳐진다. */
+        last_page = page_idx + size / _PAGESIZE;
 
-    return alloc;
-} /* buddy_allocator_new */
-
-void buddy_allocator_expand(pbuddy_alloc_t *alloc, uint64_t old_size, uint64_t new_size)
-{
-    int i, old_bits, new_bits;
-    char *page_start, *page;
+        pthread_mutex_lock(&alloc->mutex);
+        for (; page_idx < last_page; page_idx += 1ULL << bin_idx)
+        {
+            bin_idx = buddy_range_piece(alloc, page_idx, last_page);
+            buddy_free_internal(alloc, alloc->page_start + page_idx * _PAGESIZE,
+                                _CHUNKSIZE(bin_idx), false);
+        }
+        buddy_punch_check(alloc);
+        pthread_mutex_unlock(&alloc->mutex);
 
-    assert(old_size < new_size);
+        return;
+    }
 
-    /* 새로운 size만큼 뒷 부분 free 해주면 이후에 buddy malloc 가능 */
-    old_bits = (old_size - alloc->reserved) / BUDDY_PAGESIZE;
-    new_bits = (new_size - alloc->reserved) / BUDDY_PAGESIZE;
+    bin_idx = _SIZE2BIN(size);
 
-    alloc->available_size = new_bits * BUDDY_PAGESIZE;
-    alloc->total_used += (new_bits - old_bits) * BUDDY_PAGESIZE;
-    alloc->periodic_total_used_max = MAX(alloc->total_used,
-                                         alloc->periodic_total_used_max);
+    if (alloc->mag_depth[bin_idx] > 0)
+        mag = buddy_magazine_get(alloc);
 
-    page_start = alloc->page_start + old_bits * BUDDY_PAGESIZE;
+    if (mag == NULL)
+    {
+        pthread_mutex_lock(&alloc->mutex);
+        buddy_free_internal(alloc, page, size, false);
+        buddy_punch_check(alloc);
+        pthread_mutex_unlock(&alloc->mutex);
+        return;
+    }
 
-    for (i = old_bits, page = page_start; i < new_bits; i++, page += BUDDY_PAGESIZE)
-        buddy_free_internal(alloc, page, BUDDY_PAGESIZE, false);
-}
+    /* 사용자가 쓰던 chunk이므로 header 값은 믿을 수 없다. */
+    ((buddy_chunk_t *)page)->punched = false;
+    buddy_magazine_lock(mag);
+    buddy_magazine_push(mag, bin_idx, (buddy_chunk_t *)page);
+    cnt = mag->cnt[bin_idx];
+    buddy_magazine_unlock(mag);
+    if (cnt <= alloc->mag_depth[bin_idx])
+        return;
+
+    /* depth를 넘으면 절반을 공용 bin으로 돌려준다. 그 사이 다른 thread가
+     * reclaim 해 갔을 수 있으므로 남은 개수를 다시 본다. */
+    pthread_mutex_lock(&alloc->mutex);
+    buddy_magazine_lock(mag);
+    for (i = _MAG_BATCH(alloc->mag_depth[bin_idx]); i > 0 && mag->cnt[bin_idx] > 0; i--)
+        buddy_free_internal(alloc, buddy_magazine_pop(mag, bin_idx), size,
+                            false);
+    buddy_magazine_unlock(mag);
+    buddy_punch_check(alloc);
+    pthread_mutex_unlock(&alloc->mutex);
+} /* buddy_release */
 
 /**
- * @brief        buddy memory allocator
+ * @brief       page 단위 크기로 메모리를 할당한다.
  *
  * @param[in]   alloc
- * @param[in]   size
+ * @param[in]   size     allocator의 page 크기 단위로 올림한다.
  *
- * buddy allocator에서 메모리를 받아가는 함수.
- * 반드시 2^n 크기로 요청해야만 한다.
+ * size를 2^n으로 올린 chunk를 떼어온 뒤, 쓰지 않는 뒤쪽 page들은 바로
+ * 정렬이 맞는 가장 큰 chunk들로 잘라 bin에 돌려준다. 예를 들어 1.1M를
+ * 요청하면 2M chunk 중 뒤쪽 0.9M는 다른 요청이 쓸 수 있다. 떼어온 chunk가
+ * punch 되어 있었으면 뒤쪽 조각들도 punch 된 채로 돌려준다.
+ * 반납은 buddy_free로 한다.
  */
 void *
-buddy_malloc(pbuddy_alloc_t *alloc, uint64_t size)
+buddy_malloc_exact(pbuddy_alloc_t *alloc, uint64_t size)
 {
-    buddy_chunk_t *chunk, *buddy;
-    uint64_t tmp_size;
-    int i;
-    int bin_idx;             /* bitmap 몇 번째 레벨 (ex. 8192 -> 0) */
-    int bitmap_idx, bitmask; /* 그 레벨 bitmap 중 몇 번째 chunk */
-    char *bitmap_byte;
+    buddy_chunk_t *chunk;
+    uint64_t npages, first_page, last_page;
+    int bin_idx;
 
-    /*
-     * bin_idx는 요구하는 size가 몇 레벨 chunk에 해당되는지 나타냄
-     * bitmap_idx는 해당 레벨 chunk 중 앞에서부터 몇 번째 chunk인지 나타냄
-     * 예) size = 8192, 앞에서부터 3번째까지 8192 chunk 모두 사용 중이면
-     * bin_idx = 1 (2번째로 작은 chunk, bitmap_idx = 3 (앞에서부터 4번째)
-     */
+    size = (get_buddy_alloc_exact_size(size) + _PAGESIZE - 1) & ~(_PAGESIZE - 1);
+    if ((size & (size - 1)) == 0)
+        return buddy_malloc(alloc, size);
 
-    /* 2의 제곱수 확인 */
-    size = get_buddy_alloc_size(size);
-    assert(size <= BUDDY_MAX_CHUNKSIZE && (size & (size - 1)) == 0);
+    npages = size / _PAGESIZE;
+    bin_idx = _SIZE2BIN(get_buddy_alloc_size(size));
+    if (bin_idx >= alloc->bins_cnt)
+        return NULL;
 
     pthread_mutex_lock(&alloc->mutex);
 
-    tmp_size = size >> BUDDY_PAGE_SHIFT;
-    bin_idx = 0;
-    while (tmp_size > 1)
+    chunk = buddy_malloc_reclaim(alloc, bin_idx);
+    if (chunk != NULL)
     {
-        bin_idx++;
-        tmp_size = tmp_size >> 1;
+        first_page = _CHUNK2BITMAP(chunk, 0);
+        last_page = first_page + npages;
+        buddy_free_range(alloc, last_page, first_page + (1ULL << bin_idx),
+                         chunk->punched);
+
+        /* 남긴 부분을 free_range와 같은 방식으로 잘라서 order map에 기록 */
+        (void)buddy_omap_set(alloc, chunk, size, false);
     }
 
-    for (i = 0;; i++)
-    {
-        if (bin_idx >= BUDDY_BINS_CNT)
-        {
-            pthread_mutex_unlock(&alloc->mutex);
-            return NULL;
-        }
+    pthread_mutex_unlock(&alloc->mutex);
 
-        if (!list_empty(&(alloc->bins[bin_idx])))
-            break;
+    if (chunk != NULL)
+        buddy_punch_refault(alloc, chunk, size);
 
-        bin_idx++;
-    }
+    return chunk;
+} /* buddy_malloc_exact */
 
-    chunk = list_entry(alloc->bins[bin_idx].next, buddy_chunk_t, link);
-    list_del(&chunk->link);
+/* page가 이 allocator에서 할당되어 아직 free 되지 않은 주소인지 확인 */
+bool buddy_owns(pbuddy_alloc_t *alloc, void *page)
+{
+    uint64_t page_idx;
 
-    bitmap_idx = _CHUNK2BITMAP(chunk, bin_idx);
-    bitmap_byte = _BITMAP_BYTE(bin_idx, bitmap_idx);
-    bitmask = _BITMASK(bitmap_idx);
+    return buddy_omap_lookup(alloc, page, &page_idx) != 0;
+}
 
-    *bitmap_byte |= bitmask;
+/* page_idx의 조각(order map 값 omap)부터 이어지는 조각들의 크기 */
+static uint64_t
+buddy_omap_size(pbuddy_alloc_t *alloc, uint64_t page_idx, uint8_t omap)
+{
+    uint64_t size = 0;
 
-    for (; i > 0; i--)
+    while (omap != 0)
     {
-        bin_idx--;
+        size += _CHUNKSIZE((omap & BUDDY_OMAP_ORDER) - 1);
+        page_idx = buddy_omap_next(alloc, page_idx, omap);
+        omap = (page_idx == 0) ? 0 : alloc->omap[page_idx];
+    }
 
-        buddy = _CHUNK_AT_OFFSET(chunk, (ptrdiff_t)_CHUNKSIZE(bin_idx));
+    return size;
+}
 
-        list_add_tail(&buddy->link, &(alloc->bins[bin_idx]));
+/* page에 할당된 크기. 할당된 주소가 아니면 0 */
+uint64_t get_buddy_chunk_size(pbuddy_alloc_t *alloc, void *page)
+{
+    uint64_t page_idx = 0;
+    uint8_t omap;
 
-        bitmap_idx = _CHUNK2BITMAP(buddy, bin_idx);
-        bitmap_byte = _BITMAP_BYTE(bin_idx, bitmap_idx);
-        bitmask = _BITMASK(bitmap_idx);
+    omap = buddy_omap_lookup(alloc, page, &page_idx);
 
-        *bitmap_byte &= ~bitmask;
-    }
+    return buddy_omap_size(alloc, page_idx, omap);
+}
 
-    alloc->total_used += size;
-    alloc->periodic_total_used_max = MAX(alloc->total_used,
-                                         alloc->periodic_total_used_max);
+/* 첫 page부터 앞 allocator의 할당에 이어진 조각들의 크기. 없으면 0 */
+uint64_t get_buddy_cont_size(pbuddy_alloc_t *alloc)
+{
+    uint64_t page_idx = 0;
+    uint8_t omap;
 
-    pthread_mutex_unlock(&alloc->mutex);
+    omap = buddy_omap_lookup_cont(alloc, alloc->page_start, &page_idx);
 
-    return chunk;
-} /* buddy_malloc */
+    return buddy_omap_size(alloc, page_idx, omap);
+}
 
 /**
- * @brief   buddy memory deallocator
+ * @brief       page부터 size 크기의 할당을 order map에 기록하고 flush 한다.
  *
- * @param[in]      alloc
- * @param[in,out]  page
- * @param[in]      size
+ * @param[in]   size     chunk 크기. page 단위로 올림한다.
+ * @param[in]   cont     앞 allocator의 할당에 이어지는 부분이면 true
  *
- * buddy malloc으로 받은 메모리를 반납하는 함수
+ * 구간을 buddy_malloc_exact처럼 정렬이 맞는 가장 큰 조각들로 나누어
+ * 기록하며, buddy_reserve로 받은 chunk이면 조각은 하나이다. cont이면 첫
+ * 조각부터 BUDDY_OMAP_CONT를 켠다 (pool이 arena 여러 개에 걸쳐 할당할 때).
+ * 기록하는 page들은 호출한 쪽만 만지므로 lock은 필요 없다. 완료는 기다리지
+ * 않으므로, 할당을 다른 곳에 기록하기 전에 같은 persist 방식으로
+ * tb_drain_as 한다.
  *
- * @warning 일반 free와는 달리, 반드시 할당받았던 size도 적어줘야 한다!
+ * @return      page가 이 allocator의 page 영역 안의 page 경계가 아니거나
+ *              구간이 page 영역을 벗어나면 false.
  */
-void buddy_free(pbuddy_alloc_t *alloc, void *page, uint64_t size)
+bool buddy_omap_set(pbuddy_alloc_t *alloc, void *page, uint64_t size, bool cont)
 {
-    buddy_free_internal(alloc, page, size, true);
-} /* buddy_free */
+    uint64_t offset, first_page, last_page, page_idx, last_piece;
+    int bin_idx;
+
+    size = (size + _PAGESIZE - 1) & ~(_PAGESIZE - 1);
+    offset = (uint64_t)((char *)page - alloc->page_start);
+    if ((char *)page < alloc->page_start || size == 0 ||
+        (offset & (_PAGESIZE - 1)) != 0 || offset + size > alloc->available_size)
+        return false;
+
+    first_page = offset / _PAGESIZE;
+    last_page = first_page + size / _PAGESIZE;
+    last_piece = first_page;
+    for (page_idx = first_page; page_idx < last_page; page_idx += 1ULL << bin_idx)
+    {
+        bin_idx = buddy_range_piece(alloc, page_idx, last_page);
+        alloc->omap[page_idx] = (bin_idx + 1) |
+            ((cont || page_idx > first_page) ? BUDDY_OMAP_CONT : 0);
+        last_piece = page_idx;
+    }
+    tb_flush_as(alloc->persist, &alloc->omap[first_page], last_piece - first_page + 1);
+
+    return true;
+}
+
+/**
+ * @brief       page에 기록된 할당을 order map에서 지우고 flush 한다.
+ *
+ * @param[in]   cont     page가 앞 allocator의 할당에 이어지는 이 allocator의
+ *                       첫 page이면 true (buddy_omap_set 참고)
+ *
+ * chunk는 allocator에 돌려주지 않으므로, 지운 것이 durable 해진 뒤에
+ * buddy_release로 돌려준다. 그 사이에는 다른 thread가 이 chunk를 받아갈 수
+ * 없다. 완료는 기다리지 않는다 (buddy_omap_set 참고).
+ *
+ * @return      지운 할당의 크기. 할당된 주소가 아니면 0.
+ */
+uint64_t buddy_omap_clear(pbuddy_alloc_t *alloc, void *page, bool cont)
+{
+    uint64_t page_idx, first_page, last_piece, size = 0;
+    uint8_t omap;
+
+    if (cont)
+        omap = buddy_omap_lookup_cont(alloc, page, &page_idx);
+    else
+        omap = buddy_omap_lookup(alloc, page, &page_idx);
+    if (omap == 0)
+        return 0;
+
+    first_page = page_idx;
+    do
+    {
+        omap = alloc->omap[page_idx];
+        alloc->omap[page_idx] = 0;
+        last_piece = page_idx;
+        size += _CHUNKSIZE((omap & BUDDY_OMAP_ORDER) - 1);
+        page_idx = buddy_omap_next(alloc, page_idx, omap);
+    } while (page_idx != 0);
+    tb_flush_as(alloc->persist, &alloc->omap[first_page], last_piece - first_page + 1);
+
+    return size;
+}
+
+/**
+ * @brief       allocator 전체가 free이면 모든 page를 order map에 기록하지 않고
+ *              떼어온다.
+ *
+ * pool이 arena 하나의 최대 chunk보다 큰 요청을 이웃한 arena들에 걸쳐 할당할
+ * 때 쓴다. thread magazine의 chunk들을 먼저 돌려받는다. punch 중인 chunk가
+ * 있으면 전체가 free가 아닌 것으로 본다. 돌려줄 때는 buddy_release로 쓰지
+ * 않은 구간을 반납한다.
+ *
+ * @return      free가 아닌 page가 있으면 false
+ */
+bool buddy_reserve_all(pbuddy_alloc_t *alloc)
+{
+    buddy_chunk_t *chunk;
+    uint64_t free_size = 0, bitmap_idx;
+    int i;
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    buddy_magazine_reclaim(alloc);
+    for (i = 0; i < alloc->bins_cnt; i++)
+        free_size += alloc->free_cnt[i] * _CHUNKSIZE(i);
+
+    if (alloc->available_size == 0 || free_size != alloc->available_size)
+    {
+        pthread_mutex_unlock(&alloc->mutex);
+        return false;
+    }
+
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        while (!list_empty(&alloc->bins[i]))
+        {
+            chunk = list_entry(alloc->bins[i].next, buddy_chunk_t, link);
+            buddy_bin_del(alloc, chunk, i);
+            bitmap_idx = _CHUNK2BITMAP(chunk, i);
+            *_BITMAP_BYTE(i, bitmap_idx) |= _BITMASK(bitmap_idx);
+            buddy_punch_refault(alloc, chunk, _CHUNKSIZE(i));
+        }
+    }
+
+    alloc->total_used = alloc->available_size;
+    alloc->periodic_total_used_max = alloc->total_used;
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    return true;
+}
 
 static void
 buddy_free_internal(pbuddy_alloc_t *alloc, void *page, uint64_t size,
                     bool use_mutex)
 {
-    buddy_chunk_t *chunk, *buddy;
-    uint64_t tmp_size;
-    int bin_idx;
-    int bitmap_idx, bitmask, buddy_bitmask;
-    char *bitmap_byte;
-
     /* 2의 제곱수 확인 */
-    assert(size <= BUDDY_MAX_CHUNKSIZE && (size & (size - 1)) == 0);
+    assert(size <= _CHUNKSIZE(alloc->bins_cnt - 1) && (size & (size - 1)) == 0);
 
     if (use_mutex)
         pthread_mutex_lock(&alloc->mutex);
 
     alloc->total_used -= size;
 
-    tmp_size = size >> BUDDY_PAGE_SHIFT;
-    bin_idx = 0;
-    while (tmp_size > 1)
-    {
-        bin_idx++;
-        tmp_size = tmp_size >> 1;
-    }
+    buddy_coalesce(alloc, page, _SIZE2BIN(size), false,
+                   (alloc->punch_size > 0) ? buddy_now() : 0);
+
+    if (use_mutex)
+        pthread_mutex_unlock(&alloc->mutex);
+} /* buddy_free_internal */
 
-    bitmap_idx = _CHUNK2BITMAP(page, bin_idx);
+/*
+ * bitmap에 allocated로 표시된 chunk를 free buddy와 합치면서 bins에 넣는다.
+ * mutex를 잡고 부른다. 합쳐진 buddy 중 일부만 punch 되어 있을 수 있으므로,
+ * 한 번이라도 합쳐지면 punched를 지우고 다시 punch 대상이 되게 한다.
+ */
+static void
+buddy_coalesce(pbuddy_alloc_t *alloc, buddy_chunk_t *chunk, int bin_idx,
+               bool punched, uint64_t free_time)
+{
+    buddy_chunk_t *buddy;
+    uint64_t size = _CHUNKSIZE(bin_idx);
+    uint64_t bitmap_idx;
+    int bitmask, buddy_bitmask;
+    char *bitmap_byte;
 
-    chunk = page;
+    bitmap_idx = _CHUNK2BITMAP(chunk, bin_idx);
 
     while (1)
     {
@@ -287,7 +1625,7 @@ buddy_free_internal(pbuddy_alloc_t *alloc, void *page, uint64_t size,
         bitmask = _BITMASK(bitmap_idx);
         buddy_bitmask = _BITMASK(bitmap_idx ^ 1);
 
-        if ((*bitmap_byte & buddy_bitmask) || bin_idx == BUDDY_BINS_CNT - 1)
+        if ((*bitmap_byte & buddy_bitmask) || bin_idx == alloc->bins_cnt - 1)
             break; /* Buddy is allocated or has maximum size. */
 
         /* Buddy is free: coalesce. */
@@ -298,7 +1636,7 @@ buddy_free_internal(pbuddy_alloc_t *alloc, void *page, uint64_t size,
         else
             buddy = _CHUNK_AT_OFFSET(chunk, size);
 
-        list_del(&buddy->link);
+        buddy_bin_del(alloc, buddy, bin_idx);
 
         if ((bitmap_idx & 1) == 1)
             chunk = buddy;
@@ -306,16 +1644,19 @@ buddy_free_internal(pbuddy_alloc_t *alloc, void *page, uint64_t size,
         size *= 2;
         bin_idx++;
         bitmap_idx /= 2;
+
+        punched = false;
+        free_time = (alloc->punch_size > 0) ? buddy_now() : 0;
     }
 
     *bitmap_byte &= ~bitmask;
 
-    /* free list에 추가 */
-    list_add_tail(&chunk->link, &(alloc->bins[bin_idx]));
+    chunk->punched = punched;
+    chunk->free_time = free_time;
 
-    if (use_mutex)
-        pthread_mutex_unlock(&alloc->mutex);
-} /* buddy_free_internal */
+    /* free list에 추가 */
+    buddy_bin_add(alloc, chunk, bin_idx);
+} /* buddy_coalesce */
 
 /**
  * @brief       buddy allocator 확인을 위한 함수
@@ -332,9 +1673,9 @@ void buddy_dbg_print(pbuddy_alloc_t *alloc)
     printf("alloc = %p, total size = %zd, max_available = %zd, available = %zd, used = %zd, page_start = %p\n",
            alloc, alloc->alloc_size, alloc->max_available_size,
            alloc->available_size, alloc->total_used, alloc->page_start);
-    for (i = 0; i < BUDDY_BINS_CNT; i++)
+    for (i = 0; i < alloc->bins_cnt; i++)
     {
-        printf("#%d chunk :\n", i);
+        printf("#%d chunk (%zd free) :\n", i, alloc->free_cnt[i]);
         // dump_data(dstream, alloc->bitmap[i], alloc->bitmap_size[i]);
 
         if (list_empty(&(alloc->bins[i])))
@@ -346,12 +1687,110 @@ void buddy_dbg_print(pbuddy_alloc_t *alloc)
     }
 }
 
+/* used_size에는 thread magazine이 들고 있는 chunk도 포함된다. */
 void get_buddy_alloc_state(pbuddy_alloc_t *alloc, uint64_t *total_size, uint64_t *used_size)
 {
     *total_size = alloc->available_size;
     *used_size = alloc->total_used;
 }
 
+/**
+ * @brief       thread magazine의 hit/miss 통계
+ *
+ * @param[out]  hit_cnt      mutex 없이 magazine에서 처리된 malloc 횟수
+ * @param[out]  miss_cnt     공용 bin에서 채워와야 했던 malloc 횟수
+ * @param[out]  cached_size  현재 magazine들이 들고 있는 chunk 크기의 합
+ *
+ * 살아있는 thread의 카운터는 lock 없이 읽으므로 근사값이다.
+ */
+void get_buddy_alloc_cache_state(pbuddy_alloc_t *alloc, uint64_t *hit_cnt,
+                                 uint64_t *miss_cnt, uint64_t *cached_size)
+{
+    buddy_magazine_t *mag;
+    int i;
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    *hit_cnt = alloc->mag_hit_cnt;
+    *miss_cnt = alloc->mag_miss_cnt;
+    *cached_size = 0;
+
+    list_for_each_entry(mag, &alloc->magazines, link, buddy_magazine_t)
+    {
+        *hit_cnt += mag->hit_cnt;
+        *miss_cnt += mag->miss_cnt;
+        for (i = 0; i < alloc->bins_cnt; i++)
+            *cached_size += mag->cnt[i] * _CHUNKSIZE(i);
+    }
+
+    pthread_mutex_unlock(&alloc->mutex);
+}
+
+/* 이 allocator에서 한 번에 받을 수 있는 가장 큰 chunk 크기 */
+uint64_t
+get_buddy_max_chunksize(pbuddy_alloc_t *alloc)
+{
+    return _CHUNKSIZE(alloc->bins_cnt - 1);
+}
+
+/**
+ * @brief       free 공간의 분포와 조각화 정도
+ *
+ * order별 free chunk 개수를 bin에 넣고 뺄 때 같이 세어두므로 free list를
+ * 따라가지 않는다. largest_free가 요청 크기보다 작은데 free_size는 충분하면
+ * 공간이 모자란 것이 아니라 조각나 있는 것이다.
+ */
+void get_buddy_alloc_stat(pbuddy_alloc_t *alloc, buddy_stat_t *stat)
+{
+    int i;
+
+    memset(stat, 0, sizeof(buddy_stat_t));
+
+    pthread_mutex_lock(&alloc->mutex);
+
+    stat->total_size = alloc->available_size;
+    stat->used_size = alloc->total_used;
+    stat->peak_used = alloc->periodic_total_used_max;
+    stat->bins_cnt = alloc->bins_cnt;
+    for (i = 0; i < alloc->bins_cnt; i++)
+    {
+        stat->free_bytes[i] = alloc->free_cnt[i] * _CHUNKSIZE(i);
+        stat->free_size += stat->free_bytes[i];
+    }
+    if (alloc->binmap != 0)
+        stat->largest_free = _CHUNKSIZE(63 - __builtin_clzll(alloc->binmap));
+
+    pthread_mutex_unlock(&alloc->mutex);
+
+    if (stat->free_size > 0)
+        stat->frag_index = 1.0 - (double)stat->largest_free / stat->free_size;
+}
+
+/* peak_used를 현재 사용량으로 되돌린다. */
+void buddy_reset_peak_used(pbuddy_alloc_t *alloc)
+{
+    pthread_mutex_lock(&alloc->mutex);
+    alloc->periodic_total_used_max = alloc->total_used;
+    pthread_mutex_unlock(&alloc->mutex);
+}
+
+/* hole punching 누적 통계 */
+void get_buddy_punch_state(pbuddy_alloc_t *alloc, uint64_t *punch_cnt,
+                           uint64_t *punched_bytes)
+{
+    pthread_mutex_lock(&alloc->mutex);
+    *punch_cnt = alloc->punch_cnt;
+    *punched_bytes = alloc->punched_bytes;
+    pthread_mutex_unlock(&alloc->mutex);
+}
+
+/* allocator가 할당하는 최소 단위 */
+uint64_t
+get_buddy_page_size(pbuddy_alloc_t *alloc)
+{
+    return _PAGESIZE;
+}
+
 uint64_t
 get_buddy_alloc_total_size(pbuddy_alloc_t *alloc)
 {
@@ -361,26 +1800,31 @@ get_buddy_alloc_total_size(pbuddy_alloc_t *alloc)
 uint64_t
 get_buddy_alloc_size(uint64_t size)
 {
-    uint64_t uint64_to_alloc = BUDDY_PAGESIZE;
-    while (uint64_to_alloc < size)
-    {
-        uint64_to_alloc = 2 * uint64_to_alloc;
-    }
-    return uint64_to_alloc;
+    if (size <= BUDDY_PAGESIZE)
+        return BUDDY_PAGESIZE;
+
+    /* size 이상인 가장 작은 2^n */
+    return 1ULL << (64 - __builtin_clzll(size - 1));
+}
+
+/* buddy_malloc_exact가 실제로 쓰는 크기 (BUDDY_PAGESIZE 단위로 올림) */
+uint64_t
+get_buddy_alloc_exact_size(uint64_t size)
+{
+    if (size <= BUDDY_PAGESIZE)
+        return BUDDY_PAGESIZE;
+
+    return (size + BUDDY_PAGESIZE - 1) & ~(BUDDY_PAGESIZE - 1);
 }
 
 uint64_t
 get_buddy_alloc_size_rounddown(uint64_t size)
 {
-    uint64_t uint64_to_alloc = BUDDY_PAGESIZE;
-    uint64_t temp_size = BUDDY_PAGESIZE;
+    if (size < BUDDY_PAGESIZE)
+        return BUDDY_PAGESIZE;
 
-    while (temp_size <= size)
-    {
-        uint64_to_alloc = temp_size;
-        temp_size = 2 * temp_size;
-    }
-    return uint64_to_alloc;
+    /* size 이하인 가장 큰 2^n */
+    return 1ULL << (63 - __builtin_clzll(size));
 }
 
 /* end of buddy_alloc.c */
@@ -10,29 +10,97 @@
 #include <sys/types.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "list.h"
 
 #define BUDDY_PAGE_SHIFT 12
-#define BUDDY_MAX_SHIFT 30
+/* 최대 order의 상한. 실제 최대 order는 allocator마다 생성할 때 정해진다
+ * (pbuddy_alloc_t.max_shift). binmap이 64bit이므로 bin은 64개를 넘을 수 없다.
+ * 64T이면 bin #0의 page 번호가 int 범위를 넘으므로 bitmap 위치는 64bit로 다룬다. */
+#define BUDDY_MAX_SHIFT 46
 
-#define BUDDY_PAGESIZE ((uint64_t)(1U << BUDDY_PAGE_SHIFT))     /* 4096 */
-#define BUDDY_MAX_CHUNKSIZE ((uint64_t)(1U << BUDDY_MAX_SHIFT)) /* 1G */
+#define BUDDY_PAGESIZE ((uint64_t)(1U << BUDDY_PAGE_SHIFT))       /* 4096 */
+#define BUDDY_MAX_CHUNKSIZE ((uint64_t)(1ULL << BUDDY_MAX_SHIFT)) /* 64T */
 
 #define BUDDY_BINS_CNT (BUDDY_MAX_SHIFT - BUDDY_PAGE_SHIFT + 1)
 
 #define MAX(a, b) (((a) >= (b)) ? (a) : (b))
 #define MIN(a, b) (((a) <= (b)) ? (a) : (b))
 
+/* free chunk의 첫 부분에 들어가는 header. hole punching은 chunk의 두 번째
+ * page부터 하므로 header는 punch 된 뒤에도 남아있다. */
 typedef struct buddy_chunk_s buddy_chunk_t;
 struct buddy_chunk_s
 {
     list_link_t link;
+    bool punched;                // 두 번째 page부터 파일에서 punch 됨
+    uint64_t free_time;          // free 된 시각 (초, hole punching 사용 시)
 };
 
-/* bin #0: 4K-size chunk (BUDDY_PAGESIZE)
- * bin #1: 8K-size chunk
+/* thread별 magazine
+ *
+ * 최근에 free된 chunk를 bin(order)별로 thread 마다 따로 보관해 두었다가,
+ * 같은 order의 요청이 오면 mutex 없이 바로 돌려준다. magazine이 비면 공용
+ * bin에서 depth의 절반만큼 한 번에 채워오고, depth를 넘으면 절반만큼 한 번에
+ * 공용 bin으로 반납한다.
+ *
+ * magazine에 들어있는 chunk는 bitmap 상으로는 allocated 상태이므로 buddy와
+ * coalescing 되지 않는다. 그래서 공용 bin에서 할당이 실패하면 모든 thread의
+ * magazine을 비운 뒤 다시 시도한다. 다른 thread가 stack을 비울 수 있으므로
+ * stack은 lock으로 보호하는데, 그 외에는 주인 thread만 잡으므로 경합하지 않는다.
+ * stack은 chunk의 link.next를 재사용한다.
+ * top[], cnt[]는 allocator의 bins_cnt 크기로 구조체 바로 뒤에 붙어있다.
+ *
+ * pthread key는 process 전체에서 하나만 만들고, thread마다 allocator의
+ * mag_id로 index 하는 magazine 표를 둔다. allocator가 많아도 key가 모자라지
+ * 않으며, id를 받지 못한 allocator는 magazine 없이 동작한다.
+ */
+typedef struct buddy_magazine_s buddy_magazine_t;
+struct buddy_magazine_s
+{
+    list_link_t link;            // alloc->magazines에 연결
+    struct pbuddy_alloc_s *alloc;
+
+    int lock;                    // top[], cnt[]를 보호하는 spin lock
+    buddy_chunk_t **top;
+    int *cnt;
+
+    uint64_t hit_cnt;
+    uint64_t miss_cnt;
+};
+
+/* get_buddy_alloc_stat 결과. 크기는 모두 byte 단위이고, thread magazine에
+ * 들어있는 chunk는 사용 중으로 센다. */
+typedef struct buddy_stat_s
+{
+    uint64_t total_size;           // 현재 buddy_malloc으로 쓸 수 있는 공간의 크기
+    uint64_t used_size;
+    uint64_t free_size;
+    uint64_t largest_free;         // 한 번에 받을 수 있는 가장 큰 chunk 크기
+    uint64_t peak_used;            // 마지막 reset 이후 used_size의 최대값
+    double frag_index;             // 1 - largest_free / free_size (0이면 조각화 없음)
+    int bins_cnt;
+    uint64_t free_bytes[BUDDY_BINS_CNT]; // order별 free 크기 (#0: page 크기)
+} buddy_stat_t;
+
+/* bin #0: 2^page_shift-size chunk (기본값 4K, BUDDY_PAGESIZE)
+ * bin #1: 2^(page_shift + 1)-size chunk
  * ...
- * bin #(max): 1G-size chunk (BUDDY_MAX_CHUNKSIZE)
+ * bin #(bins_cnt - 1): 2^max_shift-size chunk
+ *
+ * order별 배열(bins, bitmap 등)은 bins_cnt 크기로 header 바로 뒤에 붙고,
+ * 그 뒤에 bitmap, order map이 온다.
+ *
+ * order map: page 하나당 1 byte. 할당된 chunk의 첫 page에만 (order + 1)을
+ * 기록하고 나머지는 0이다. buddy_malloc_exact로 받은 메모리는 여러 조각으로
+ * 기록되며, 첫 조각 뒤의 조각들에는 앞 조각에 이어진다는 BUDDY_OMAP_CONT
+ * bit가 켜진다. 따라서 buddy_free는 size 없이 주소만으로 반납할 수 있고,
+ * 0이거나 BUDDY_OMAP_CONT인 곳(할당의 중간)을 free 하려고 하면 double
+ * free이거나 이 allocator가 준 주소가 아니다.
+ * 할당과 반납 때 바뀐 항목은 바로 flush 하고 (buddy_set_persist), fence는
+ * 할당을 다른 곳에 기록하는 쪽이 자기 persist와 함께 한다. order map에
+ * 기록하는 시점을 직접 정해야 하면 buddy_malloc/buddy_free 대신
+ * buddy_reserve + buddy_omap_set, buddy_omap_clear + buddy_release를 쓴다.
  *
  * bitmap: 0이면 free, 1이면 allocated를 나타낸다. 어떤 chunk가 free이면,
  * 그 chunk를 자른 subchunk에 해당하는 bit는 모두 1이 된다.
@@ -48,11 +116,15 @@ struct buddy_chunk_s
  * bitmap #3: 1         1
  * bitmap #4: 1
  */
+#define BUDDY_OMAP_ORDER 0x3f
+#define BUDDY_OMAP_CONT  0x80
+
 typedef struct pbuddy_alloc_s
 {
     pthread_mutex_t mutex;
 
     char *file_fullpath;         // 파일의 전체 경로
+    bool meta_inplace;           // header와 bitmap이 page 영역 밖의 주어진 공간(file)에 있음
     char *page_start;            // 실제 buddy chunk가 시작되는 주소
     uint64_t reserved;           // 메타데이터 공간의 크기
     uint64_t alloc_size;         
@@ -61,23 +133,84 @@ typedef struct pbuddy_alloc_s
     uint64_t total_used;
     uint64_t periodic_total_used_max;
 
-    list_t bins[BUDDY_BINS_CNT];
+    int max_shift;               // 최대 chunk 크기 = 2^max_shift
+    int page_shift;              // 최소 order, bin #0 chunk 크기 = 2^page_shift
+    int bins_cnt;                // max_shift - page_shift + 1
+
+    list_t *bins;                // [bins_cnt]
+    uint64_t *free_cnt;          // [bins_cnt], bins[i]에 들어있는 chunk 개수
+    uint64_t binmap;             // bit #i: bins[i]가 비어있지 않음
+
+    char **bitmap;               // [bins_cnt]
+    uint64_t *bitmap_size;       // [bins_cnt]
+    uint8_t *omap;               // [max_size >> page_shift], order map
+
+    /* thread별 magazine */
+    int mag_id;                  // thread magazine 표의 index, -1이면 magazine 사용 안 함
+    uint64_t mag_gen;            // mag_id를 받을 때의 세대. id가 재사용되면 달라진다
+    int *mag_depth;              // [bins_cnt], 0이면 해당 order는 magazine 사용 안 함
+    list_t magazines;              // 살아있는 thread의 magazine 목록
+    uint64_t mag_hit_cnt;          // 종료된 thread들의 통계 누적값
+    uint64_t mag_miss_cnt;
+
+    /* hole punching (buddy_set_punch) */
+    int punch_fd;                  // page 영역이 mapping 된 파일
+    uint64_t punch_offset;         // page_start의 파일 내 offset
+    uint64_t punch_size;           // 이 크기 이상의 free chunk만 punch (0이면 사용 안 함)
+    uint64_t punch_age;            // free 된 뒤 이 시간(초)이 지난 chunk만 punch
+    uint64_t punch_next;           // 다음에 자동으로 trim 할 시각
+    bool punch_eager;              // punch 된 chunk를 줄 때 미리 fallocate 해 둔다
+    uint64_t punch_cnt;            // 누적 punch 횟수
+    uint64_t punched_bytes;        // bins에 있는 free chunk 중 punch 된 크기
 
-    char *bitmap[BUDDY_BINS_CNT];
-    int bitmap_size[BUDDY_BINS_CNT];
+    int persist;                   // order map을 내보낼 방식 (TB_PERSIST_*)
 } pbuddy_alloc_t;
 
-pbuddy_alloc_t *buddy_allocator_new(void *base_ptr, uint64_t max_size, uint64_t size, char *file_fullpath);
+int buddy_page_shift(int page_shift);
+int buddy_max_shift(uint64_t max_size, int page_shift, int max_shift);
+uint64_t buddy_allocator_metasize(uint64_t max_size, int page_shift, int max_shift);
+pbuddy_alloc_t *buddy_allocator_new(void *base_ptr, uint64_t max_size, uint64_t size,
+                                    int page_shift, int max_shift, char *file_fullpath);
+pbuddy_alloc_t *buddy_allocator_init(void *meta, void *page_start, uint64_t max_size,
+                                     uint64_t size, int page_shift, int max_shift,
+                                     char *file_fullpath);
+uint64_t buddy_allocator_recover(pbuddy_alloc_t *alloc);
+pbuddy_alloc_t *buddy_allocator_attach(void *meta, void *page_start,
+                                       char *file_fullpath);
 void buddy_allocator_expand(pbuddy_alloc_t *alloc,
                             uint64_t old_size, uint64_t new_size);
+void buddy_allocator_delete(pbuddy_alloc_t *alloc);
+void buddy_set_magazine_depth(pbuddy_alloc_t *alloc, uint64_t size, int depth);
+void buddy_set_punch(pbuddy_alloc_t *alloc, int fd, uint64_t file_offset,
+                     uint64_t min_size, uint64_t age, bool eager);
+void buddy_set_persist(pbuddy_alloc_t *alloc, int persist);
+uint64_t buddy_trim(pbuddy_alloc_t *alloc, uint64_t min_size, uint64_t age);
 void *buddy_malloc(pbuddy_alloc_t *alloc, uint64_t size);
-void buddy_free(pbuddy_alloc_t *alloc, void *page, uint64_t size);
+uint64_t get_buddy_max_chunksize(pbuddy_alloc_t *alloc);
+bool buddy_free(pbuddy_alloc_t *alloc, void *page);
+void *buddy_malloc_exact(pbuddy_alloc_t *alloc, uint64_t size);
+bool buddy_owns(pbuddy_alloc_t *alloc, void *page);
+uint64_t get_buddy_chunk_size(pbuddy_alloc_t *alloc, void *page);
+uint64_t get_buddy_cont_size(pbuddy_alloc_t *alloc);
+void *buddy_reserve(pbuddy_alloc_t *alloc, uint64_t size);
+bool buddy_reserve_all(pbuddy_alloc_t *alloc);
+bool buddy_omap_set(pbuddy_alloc_t *alloc, void *page, uint64_t size, bool cont);
+uint64_t buddy_omap_clear(pbuddy_alloc_t *alloc, void *page, bool cont);
+void buddy_release(pbuddy_alloc_t *alloc, void *page, uint64_t size);
 
 void buddy_dbg_print(pbuddy_alloc_t *alloc);
 void get_buddy_alloc_state(pbuddy_alloc_t *alloc,
                            uint64_t *total_size, uint64_t *used_size);
+void get_buddy_alloc_cache_state(pbuddy_alloc_t *alloc, uint64_t *hit_cnt,
+                                 uint64_t *miss_cnt, uint64_t *cached_size);
+void get_buddy_alloc_stat(pbuddy_alloc_t *alloc, buddy_stat_t *stat);
+void buddy_reset_peak_used(pbuddy_alloc_t *alloc);
+void get_buddy_punch_state(pbuddy_alloc_t *alloc, uint64_t *punch_cnt,
+                           uint64_t *punched_bytes);
+uint64_t get_buddy_page_size(pbuddy_alloc_t *alloc);
 uint64_t get_buddy_alloc_total_size(pbuddy_alloc_t *alloc);
 uint64_t get_buddy_alloc_size(uint64_t size);
+uint64_t get_buddy_alloc_exact_size(uint64_t size);
 uint64_t get_buddy_alloc_size_rounddown(uint64_t size);
 
 #endif /* not _BUDDY_ALLOC_H */
\ No newline at end of file
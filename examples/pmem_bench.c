@@ -0,0 +1,165 @@
+/*
+ * pmem region allocator contention benchmark
+ *
+ * thread마다 region_pallocator_new로 allocator를 만들고, region이 계속
+ * 늘었다 줄도록 malloc/free 후 allocator를 지우는 일을 반복한다. region은
+ * 모두 pmem buddy에서 받아오므로, arena 개수에 따라 buddy lock 경합이 어떻게
+ * 달라지는지 볼 수 있다.
+ *
+ * 끝으로 named pool에서 pbuddy_pool_tx_malloc/tx_free 한 쌍의 비용을 일반
+ * malloc/free와 비교한다.
+ *
+ * usage: pmem_bench [threads(32)] [rounds(200)] [pmem dir]
+ */
+#include "allocator.h"
+#include "pmem_buddy.h"
+#include "pmem_persist.h"
+#include "assert.h"
+#include "string.h"
+#include "unistd.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "pthread.h"
+#include "time.h"
+
+#define ALLOC_CNT 256
+
+static int ROUNDS = 200;
+
+static void *bench_thread(void *args)
+{
+    int i, r;
+    unsigned int seed = (unsigned int)(uintptr_t)args;
+    allocator_t *alloc;
+    void *ptr[ALLOC_CNT];
+
+    for (r = 0; r < ROUNDS; r++) {
+        alloc = region_pallocator_new(PMEM_SYSTEM_ALLOC, false);
+        assert(alloc != NULL);
+
+        /* 1K ~ 64K 크기로 받아서 region이 1M까지 여러 번 늘어나게 한다. */
+        for (i = 0; i < ALLOC_CNT; i++) {
+            ptr[i] = tb_malloc(alloc, 1024 << (rand_r(&seed) % 7));
+            assert(ptr[i] != NULL);
+        }
+        for (i = 0; i < ALLOC_CNT; i++)
+            tb_free(alloc, ptr[i]);
+
+        allocator_delete(alloc);
+    }
+
+    return NULL;
+}
+
+static void run_bench(int thr_cnt, int arena_cnt)
+{
+    int i, rc;
+    pthread_t *ptid;
+    struct timespec start, end;
+    double elapsed;
+
+    IPARAM(_PMEM_ARENA_CNT) = arena_cnt;
+    if (!tballoc_init()) {
+        printf("tballoc_init failed\n");
+        exit(1);
+    }
+    arena_cnt = PBUDDY_POOL->arena_cnt;
+
+    ptid = malloc(sizeof(pthread_t) * thr_cnt);
+    assert(ptid != NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < thr_cnt; i++) {
+        rc = pthread_create(&ptid[i], NULL, bench_thread, (void *)(uintptr_t)(i + 1));
+        assert(rc == 0);
+    }
+    for (i = 0; i < thr_cnt; i++) {
+        rc = pthread_join(ptid[i], NULL);
+        assert(rc == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    free(ptid);
+    tballoc_clear();
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("threads %3d  arenas %3d  %10.3f sec  %12.0f allocators/sec\n",
+           thr_cnt, arena_cnt, elapsed, thr_cnt * ROUNDS / elapsed);
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* tx는 op마다 fence가 세 번이므로 pool의 persist 방식(DAX면 cache flush,
+ * 아니면 msync)에 따라 비용이 크게 달라진다. */
+static void run_tx_bench(int ops)
+{
+    pbuddy_pool_t *pool;
+    uint64_t *root;
+    void *ptr;
+    char path[1024];
+    struct timespec start, end;
+    double plain, tx;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s", IPARAM(PMEM_DIR), "bench_tx_pool");
+    unlink(path);
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "bench_tx_pool", NULL,
+                                  64L * 1024L * 1024L, 64L * 1024L * 1024L);
+    assert(pool != NULL);
+    root = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    memset(root, 0, BUDDY_PAGESIZE);
+    pbuddy_pool_set_root(pool, root);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ops; i++) {
+        ptr = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+        pbuddy_pool_free(pool, ptr);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    plain = elapsed_ns(&start, &end) / ops;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ops; i++) {
+        ptr = pbuddy_pool_tx_malloc(pool, BUDDY_PAGESIZE, &root[0]);
+        assert(ptr != NULL);
+        pbuddy_pool_tx_free(pool, &root[0]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tx = elapsed_ns(&start, &end) / ops;
+
+    printf("persist %-10s  malloc+free %8.0f ns  tx_malloc+tx_free %10.0f ns\n",
+           pool->persist == TB_PERSIST_CPU ? tb_persist_method() :
+           pool->persist == TB_PERSIST_MSYNC ? "msync" : "none", plain, tx);
+
+    pbuddy_pool_free(pool, root);
+    pbuddy_pool_close(pool);
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    int thr_cnt = 32;
+    int arena_cnt;
+
+    if (argc > 1)
+        thr_cnt = atoi(argv[1]);
+    if (argc > 2)
+        ROUNDS = atoi(argv[2]);
+
+    IPARAM(PMEM_DIR) = (argc > 3) ? argv[3] : "/workspace/develop/code_test/pmem_tmp";
+    IPARAM(PMEM_MAX_SIZE) = 4L * 1024L * 1024L * 1024L;
+    IPARAM(PMEM_ALLOC_SIZE) = 4L * 1024L * 1024L * 1024L;
+
+    for (arena_cnt = 1; arena_cnt <= PBUDDY_MAX_ARENAS; arena_cnt *= 2) {
+        run_bench(thr_cnt, arena_cnt);
+        if (arena_cnt >= thr_cnt)
+            break;
+    }
+
+    run_tx_bench(ROUNDS * 100);
+
+    return 0;
+}
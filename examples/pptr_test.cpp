@@ -0,0 +1,88 @@
+/*
+ * tb::pptr<T> example
+ *
+ * named pool에 pptr로 연결한 list를 만들고, 다른 주소에 다시 열어서
+ * 그대로 따라갈 수 있는지 확인한다.
+ */
+#include "pmem_pptr.h"
+#include "assert.h"
+#include "stdio.h"
+#include "string.h"
+#include "unistd.h"
+
+extern "C" {
+#include "iparam.h"
+}
+
+struct node
+{
+    tb::pptr<node> next;
+    int value;
+};
+
+struct root
+{
+    tb::pptr<node> head;
+    tb::pptr<char> name;
+};
+
+int main()
+{
+    const char *dir = "/workspace/develop/code_test/pmem_tmp";
+    pbuddy_pool_t *pool;
+    root *r;
+    node *n;
+    char path[1024];
+    int i;
+
+    sprintf(path, "%s/%s", dir, "pptr_pool");
+    unlink(path);
+
+    pool = pbuddy_pool_open_named(dir, "pptr_pool", NULL,
+                                  64L * 1024L * 1024L, 64L * 1024L * 1024L);
+    assert(pool != NULL);
+    tb::pptr_set_pool(pool);
+
+    r = (root *)pbuddy_pool_malloc(pool, sizeof(root));
+    memset((void *)r, 0, sizeof(root));
+    pbuddy_pool_set_root(pool, r);
+
+    /* tx_malloc으로 할당과 연결을 한 번에 한다. */
+    assert(pbuddy_pool_tx_malloc(pool, 16, r->name.offset_ptr()) != NULL);
+    strcpy(r->name.get(), "list");
+
+    for (i = 0; i < 10; i++)
+    {
+        n = (node *)pbuddy_pool_malloc(pool, sizeof(node));
+        n->value = i;
+        n->next = r->head;
+        r->head = tb::pptr<node>(n);
+    }
+    assert(r->head->value == 9);
+    assert(tb::pptr<node>(r->head.get()) == r->head);
+    assert(pbuddy_pool_off2ptr(pool, r->head.offset()) == r->head.get());
+    assert(pbuddy_pool_close(pool) == 0);
+
+    pool = pbuddy_pool_open_named(dir, "pptr_pool", NULL, 0, 0);
+    assert(pool != NULL);
+    tb::pptr_set_pool(pool);
+
+    r = (root *)pbuddy_pool_get_root(pool);
+    assert(strcmp(r->name.get(), "list") == 0);
+    for (i = 9; r->head; i--)
+    {
+        tb::pptr<node> next = r->head->next;
+
+        assert(r->head->value == i);
+        pbuddy_pool_free(pool, r->head.get());
+        r->head = next;
+    }
+    assert(i == -1 && !r->head && r->head == nullptr);
+
+    assert(pbuddy_pool_tx_free(pool, r->name.offset_ptr()));
+    pbuddy_pool_free(pool, r);
+    assert(pbuddy_pool_close(pool) == 0);
+    unlink(path);
+
+    return 0;
+}
@@ -1,7 +1,14 @@
 #include "allocator.h"
+#include "pmem_buddy.h"
+#include "pmem_persist.h"
+#include "handle_alloc.h"
 #include "assert.h"
 #include "string.h"
 #include "pthread.h"
+#include "unistd.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#include "limits.h"
 
 void pmem_system_allocator()
 {
@@ -159,6 +166,772 @@ void multi_thread_alloc()
     allocator_delete(alloc);
 }
 
+void pmem_buddy_magazine()
+{
+    void *ptr;
+    uint64_t hit_cnt, miss_cnt, cached_size;
+    uint64_t old_hit_cnt;
+
+    get_pbuddy_alloc_cache_state(PBUDDY_POOL, &old_hit_cnt, &miss_cnt,
+                                 &cached_size);
+
+    ptr = pbuddy_malloc(BUDDY_PAGESIZE);
+    pbuddy_free(ptr);
+
+    /* 방금 반납한 chunk는 thread magazine에서 바로 나와야 한다. */
+    ptr = pbuddy_malloc(BUDDY_PAGESIZE);
+    pbuddy_free(ptr);
+
+    get_pbuddy_alloc_cache_state(PBUDDY_POOL, &hit_cnt, &miss_cnt,
+                                 &cached_size);
+    assert(hit_cnt > old_hit_cnt);
+    assert(cached_size >= BUDDY_PAGESIZE);
+}
+
+static pthread_barrier_t magazine_barrier;
+
+/* chunk를 magazine에 넣어둔 채로 살아있는 thread */
+void *magazine_holder(void *arg)
+{
+    pbuddy_pool_t *pool = (pbuddy_pool_t *)arg;
+    void *ptr[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        ptr[i] = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    for (i = 0; i < 4; i++)
+        pbuddy_pool_free(pool, ptr[i]);
+
+    pthread_barrier_wait(&magazine_barrier);
+    pthread_barrier_wait(&magazine_barrier);
+
+    return NULL;
+}
+
+void pmem_buddy_magazine_reclaim()
+{
+    pbuddy_pool_t *pool;
+    pthread_t tid;
+    void *ptr;
+    uint64_t hit_cnt, miss_cnt, cached_size;
+
+    IPARAM(_PMEM_ARENA_CNT) = 1;
+    pool = pbuddy_pool_open(IPARAM(PMEM_DIR), 16L * 1024L * 1024L);
+    IPARAM(_PMEM_ARENA_CNT) = 4;
+    assert(pool != NULL && pool->arena_cnt == 1);
+
+    pthread_barrier_init(&magazine_barrier, NULL, 2);
+    assert(pthread_create(&tid, NULL, magazine_holder, pool) == 0);
+    pthread_barrier_wait(&magazine_barrier);
+
+    get_pbuddy_alloc_cache_state(pool, &hit_cnt, &miss_cnt, &cached_size);
+    assert(cached_size > 0);
+
+    /* 다른 thread의 magazine에 있는 page 때문에 쪼개져 있어도, 그 page들을
+     * 돌려받아서 arena 전체 크기의 chunk를 줄 수 있어야 한다. */
+    ptr = pbuddy_pool_malloc(pool, get_buddy_max_chunksize(pool->arenas[0]));
+    assert(ptr != NULL);
+    get_pbuddy_alloc_cache_state(pool, &hit_cnt, &miss_cnt, &cached_size);
+    assert(cached_size == 0);
+    pbuddy_pool_free(pool, ptr);
+
+    pthread_barrier_wait(&magazine_barrier);
+    pthread_join(tid, NULL);
+    pthread_barrier_destroy(&magazine_barrier);
+
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+/* allocator가 PTHREAD_KEYS_MAX보다 많아도 magazine을 쓸 수 있고, 삭제된
+ * allocator의 id를 다시 받은 allocator에는 예전 magazine이 보이지 않는다. */
+void pmem_buddy_magazine_many()
+{
+    enum { ALLOC_CNT = PTHREAD_KEYS_MAX + 64, ALLOC_SIZE = 4 * BUDDY_PAGESIZE };
+    pbuddy_alloc_t **allocs;
+    char *pages;
+    void *ptr;
+    uint64_t hit_cnt, miss_cnt, cached_size;
+    int i;
+
+    allocs = malloc(ALLOC_CNT * sizeof(pbuddy_alloc_t *));
+    pages = aligned_alloc(BUDDY_PAGESIZE, (uint64_t)ALLOC_CNT * ALLOC_SIZE);
+    assert(allocs != NULL && pages != NULL);
+
+    for (i = 0; i < ALLOC_CNT; i++)
+    {
+        allocs[i] = buddy_allocator_new(pages + (uint64_t)i * ALLOC_SIZE, ALLOC_SIZE,
+                                        ALLOC_SIZE, 0, 0, NULL);
+        assert(allocs[i] != NULL);
+        buddy_set_magazine_depth(allocs[i], BUDDY_PAGESIZE, 4);
+    }
+
+    i = ALLOC_CNT - 1;
+    ptr = buddy_malloc(allocs[i], BUDDY_PAGESIZE);
+    buddy_free(allocs[i], ptr);
+    assert(buddy_malloc(allocs[i], BUDDY_PAGESIZE) == ptr);
+    get_buddy_alloc_cache_state(allocs[i], &hit_cnt, &miss_cnt, &cached_size);
+    assert(hit_cnt == 1);
+    buddy_free(allocs[i], ptr);
+
+    buddy_allocator_delete(allocs[i]);
+    allocs[i] = buddy_allocator_new(pages + (uint64_t)i * ALLOC_SIZE, ALLOC_SIZE,
+                                    ALLOC_SIZE, 0, 0, NULL);
+    buddy_set_magazine_depth(allocs[i], BUDDY_PAGESIZE, 4);
+    ptr = buddy_malloc(allocs[i], BUDDY_PAGESIZE);
+    get_buddy_alloc_cache_state(allocs[i], &hit_cnt, &miss_cnt, &cached_size);
+    assert(ptr != NULL && hit_cnt == 0 && miss_cnt == 1);
+    buddy_free(allocs[i], ptr);
+
+    for (i = 0; i < ALLOC_CNT; i++)
+        buddy_allocator_delete(allocs[i]);
+    free(pages);
+    free(allocs);
+}
+
+void pmem_buddy_arena()
+{
+    void *ptr[8];
+    char *big;
+    uint64_t chunk_size, size, total, used, old_used;
+    int i, cnt;
+
+    chunk_size = get_buddy_alloc_size_rounddown(PBUDDY_POOL->arena_size / 2);
+
+    /* home arena가 가득 차면 다른 arena에서 가져와야 한다. */
+    cnt = (int)(PBUDDY_POOL->arena_size / chunk_size) + 1;
+    for (i = 0; i < cnt; i++) {
+        ptr[i] = pbuddy_malloc(chunk_size);
+        assert(ptr[i] != NULL);
+    }
+    assert(PBUDDY_POOL->arena_cnt == 1 ||
+           pbuddy_arena_of(PBUDDY_POOL, ptr[0]) !=
+           pbuddy_arena_of(PBUDDY_POOL, ptr[cnt - 1]));
+
+    for (i = 0; i < cnt; i++)
+        pbuddy_free(ptr[i]);
+
+    /* arena의 최대 chunk보다 큰 요청은 free인 이웃 arena들에 걸쳐 받는다.
+     * 두 번째 arena부터는 할당의 중간이다. */
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &old_used);
+    size = PBUDDY_POOL->arena_size + PBUDDY_POOL->arena_size / 2;
+    big = pbuddy_malloc_exact(size);
+    assert(PBUDDY_POOL->arena_cnt == 1 || big != NULL);
+    if (big != NULL)
+    {
+        assert(get_pbuddy_chunk_size(PBUDDY_POOL, big) == size);
+        assert(!pbuddy_pool_owns(PBUDDY_POOL, big + PBUDDY_POOL->arena_size));
+        assert(!pbuddy_free(big + PBUDDY_POOL->arena_size));
+        big[0] = 1;
+        big[size - 1] = 1;
+        get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+        assert(used - old_used >= size);
+        assert(pbuddy_free(big));
+        get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+        assert(used == old_used);
+    }
+
+    /* pool보다 큰 요청은 실패한다. */
+    assert(pbuddy_malloc(PBUDDY_POOL->arena_cnt * PBUDDY_POOL->arena_size * 2) == NULL);
+}
+
+void pmem_buddy_exact()
+{
+    void *ptr;
+    allocator_t *alloc;
+    uint64_t total, used, old_used;
+
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &old_used);
+
+    /* 8 page chunk 중 뒤쪽 3 page는 바로 돌려준다. */
+    ptr = pbuddy_malloc_exact(5 * BUDDY_PAGESIZE);
+    assert(ptr != NULL);
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+    assert(used - old_used == 5 * BUDDY_PAGESIZE);
+
+    pbuddy_free(ptr);
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+    assert(used == old_used);
+
+    /* 1.1M 요청이 pmem을 2M 쓰지 않아야 한다. */
+    alloc = region_pallocator_new(PMEM_SYSTEM_ALLOC, false);
+    ptr = tb_malloc(alloc, 1100 * 1024);
+    assert(ptr != NULL);
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+    assert(used - old_used < 2 * 1024 * 1024);
+    allocator_delete(alloc);
+
+    get_pbuddy_alloc_state(PBUDDY_POOL, &total, &used);
+    assert(used == old_used);
+}
+
+void pmem_buddy_free_check()
+{
+    char *ptr;
+    int local;
+
+    ptr = pbuddy_malloc_exact(5 * BUDDY_PAGESIZE);
+    assert(pbuddy_pool_owns(PBUDDY_POOL, ptr));
+    assert(get_pbuddy_chunk_size(PBUDDY_POOL, ptr) == 5 * BUDDY_PAGESIZE);
+    assert(!pbuddy_pool_owns(PBUDDY_POOL, ptr + BUDDY_PAGESIZE));
+
+    /* 4 + 1 page 조각 중 뒤쪽 조각의 주소는 할당의 중간이다. */
+    assert(!pbuddy_pool_owns(PBUDDY_POOL, ptr + 4 * BUDDY_PAGESIZE));
+    assert(get_pbuddy_chunk_size(PBUDDY_POOL, ptr + 4 * BUDDY_PAGESIZE) == 0);
+    assert(!pbuddy_free(ptr + 4 * BUDDY_PAGESIZE));
+    assert(get_pbuddy_chunk_size(PBUDDY_POOL, ptr) == 5 * BUDDY_PAGESIZE);
+
+    /* size 없이 반납하고, 두 번 반납하거나 엉뚱한 주소는 거절한다. */
+    assert(pbuddy_free(ptr));
+    assert(!pbuddy_pool_owns(PBUDDY_POOL, ptr));
+    assert(!pbuddy_free(ptr));
+    assert(!pbuddy_free(&local));
+}
+
+void pmem_buddy_stat()
+{
+    void *ptr;
+    buddy_stat_t stat;
+    uint64_t free_bytes, old_used;
+    int i;
+
+    get_pbuddy_alloc_stat(PBUDDY_POOL, &stat);
+    free_bytes = 0;
+    for (i = 0; i < stat.bins_cnt; i++)
+        free_bytes += stat.free_bytes[i];
+    assert(free_bytes == stat.free_size);
+    assert(stat.used_size + stat.free_size == stat.total_size);
+    assert(stat.largest_free <= stat.free_size);
+    assert(stat.frag_index >= 0.0 && stat.frag_index < 1.0);
+    old_used = stat.used_size;
+
+    /* peak는 reset 전까지 내려가지 않는다. */
+    pbuddy_reset_peak_used(PBUDDY_POOL);
+    ptr = pbuddy_malloc(4 * 1024 * 1024);
+    assert(ptr != NULL);
+    pbuddy_free(ptr);
+
+    get_pbuddy_alloc_stat(PBUDDY_POOL, &stat);
+    assert(stat.used_size == old_used);
+    assert(stat.peak_used >= old_used + 4 * 1024 * 1024);
+
+    pbuddy_reset_peak_used(PBUDDY_POOL);
+    get_pbuddy_alloc_stat(PBUDDY_POOL, &stat);
+    assert(stat.peak_used == stat.used_size);
+}
+
+void pmem_multi_pool()
+{
+    pbuddy_pool_t *pool;
+    allocator_t *alloc, *child;
+    void *ptr, *child_ptr;
+    uint64_t total, used;
+
+    pool = pbuddy_pool_open(IPARAM(PMEM_DIR), 64L * 1024L * 1024L);
+    assert(pool != NULL && pool != PBUDDY_POOL);
+
+    /* pool에 묶인 allocator와 그 child는 기본 pool을 쓰지 않는다. */
+    alloc = region_pallocator_new_pool(PMEM_SYSTEM_ALLOC, false, pool);
+    child = region_pallocator_new(alloc, false);
+    ptr = tb_malloc(alloc, 100 * 1024);
+    child_ptr = tb_malloc(child, 100 * 1024);
+    assert(ptr != NULL && child_ptr != NULL);
+    assert(pbuddy_in_pool(pool, ptr) && !pbuddy_in_pool(PBUDDY_POOL, ptr));
+    assert(pbuddy_in_pool(pool, child_ptr));
+
+    get_pbuddy_alloc_state(pool, &total, &used);
+    assert(used > 0);
+
+    allocator_delete(child);
+    allocator_delete(alloc);
+    get_pbuddy_alloc_state(pool, &total, &used);
+    assert(used == 0);
+
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+void pmem_striped_pool()
+{
+    const char *dirs[2] = { IPARAM(PMEM_DIR), IPARAM(PMEM_DIR) };
+    pbuddy_pool_t *pool;
+    pbuddy_pool_t *member;
+    allocator_t *alloc;
+    void *ptr[4];
+    int i, cnt[2] = { 0, 0 };
+
+    pool = pbuddy_pool_open_striped(dirs, 2, 64L * 1024L * 1024L);
+    assert(pool != NULL && pool->stripe_cnt == 2);
+
+    /* 큰 요청마다 새 region이 생기고, region은 member pool에 번갈아 놓인다. */
+    alloc = region_pallocator_new_pool(PMEM_SYSTEM_ALLOC, false, pool);
+    for (i = 0; i < 4; i++) {
+        ptr[i] = tb_malloc(alloc, 2 * 1024 * 1024);
+        assert(ptr[i] != NULL && pbuddy_in_pool(pool, ptr[i]));
+        cnt[pbuddy_pool_of(pool, ptr[i]) == pool->stripes[0] ? 0 : 1]++;
+    }
+    assert(cnt[0] == 2 && cnt[1] == 2);
+
+    /* offset은 root가 아니라 주소가 속한 member pool로 바꾼다. */
+    member = pbuddy_pool_of(pool, ptr[0]);
+    assert(member != pool);
+    assert(pbuddy_pool_off2ptr(member, pbuddy_pool_ptr2off(member, ptr[0])) == ptr[0]);
+
+    allocator_delete(alloc);
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+void pmem_prefault()
+{
+    pbuddy_pool_t *pool;
+    unsigned char *vec;
+    uint64_t i, pages;
+
+    IPARAM(_PMEM_PREFAULT_THREADS) = 3;
+    pool = pbuddy_pool_open(IPARAM(PMEM_DIR), 32L * 1024L * 1024L);
+    IPARAM(_PMEM_PREFAULT_THREADS) = 0;
+    assert(pool != NULL);
+
+    /* 할당하기 전부터 mapping 전체가 올라와 있어야 한다. */
+    pages = pool->map_size / BUDDY_PAGESIZE;
+    vec = malloc(pages);
+    assert(mincore(pool->map_addr, pool->map_size, vec) == 0);
+    for (i = 0; i < pages; i++)
+        assert(vec[i] & 1);
+    free(vec);
+
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+void pmem_map_align()
+{
+    pbuddy_pool_t *pool;
+    void *ptr;
+    uint64_t align = 2 * 1024 * 1024;
+
+    pool = pbuddy_pool_open(IPARAM(PMEM_DIR), 64L * 1024L * 1024L);
+    assert(pool != NULL);
+
+    /* mapping과 arena 경계가 2M에 맞아야 2M chunk도 2M에 정렬된다. */
+    assert(((uintptr_t)pool->map_addr & (align - 1)) == 0);
+    assert(((uintptr_t)pool->page_start & (align - 1)) == 0);
+    assert((pool->arena_size & (align - 1)) == 0);
+
+    ptr = pbuddy_pool_malloc(pool, align);
+    assert(ptr != NULL && ((uintptr_t)ptr & (align - 1)) == 0);
+    pbuddy_pool_free(pool, ptr);
+
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+void pmem_page_geometry()
+{
+    pbuddy_pool_t *pool;
+    allocator_t *alloc;
+    void *ptr;
+    uint64_t page_size = 64 * 1024;
+
+    assert(buddy_allocator_metasize(64L * 1024L * 1024L, 16, 0) <
+           buddy_allocator_metasize(64L * 1024L * 1024L, 0, 0));
+
+    IPARAM(_PMEM_BUDDY_MIN_SHIFT) = 16;
+    pool = pbuddy_pool_open(IPARAM(PMEM_DIR), 64L * 1024L * 1024L);
+    IPARAM(_PMEM_BUDDY_MIN_SHIFT) = 0;
+    assert(pool != NULL);
+    assert(get_buddy_page_size(pool->arenas[0]) == page_size);
+
+    /* page보다 작은 요청도 page 하나를 받는다. */
+    ptr = pbuddy_pool_malloc(pool, 4096);
+    assert(ptr != NULL && get_pbuddy_chunk_size(pool, ptr) == page_size);
+    assert(pbuddy_pool_free(pool, ptr));
+
+    ptr = pbuddy_pool_malloc_exact(pool, 3 * page_size + 1);
+    assert(ptr != NULL && get_pbuddy_chunk_size(pool, ptr) == 4 * page_size);
+    assert(pbuddy_pool_free(pool, ptr));
+
+    alloc = region_pallocator_new_pool(PMEM_SYSTEM_ALLOC, false, pool);
+    ptr = tb_malloc(alloc, 100);
+    assert(ptr != NULL && pbuddy_in_pool(pool, ptr));
+    allocator_delete(alloc);
+
+    assert(pbuddy_pool_close(pool) == 0);
+}
+
+void pmem_persist()
+{
+    char *ptr, buf[1000];
+    tb_persist_range_t ranges[2];
+
+    ptr = pbuddy_malloc(8192);
+    assert(ptr != NULL);
+    memset(ptr, 'a', 8192);
+
+    /* 기본 pool은 volatile이라 flush가 필요 없지만, msync로도 동작해야 한다. */
+    assert(PBUDDY_POOL->mode == PBUDDY_POOL_VOLATILE);
+    assert(PBUDDY_POOL->persist == TB_PERSIST_NONE);
+    pbuddy_pool_persist(PBUDDY_POOL, ptr, 8192);
+    tb_persist_as(TB_PERSIST_MSYNC, ptr + 100, 5000);
+
+    ranges[0].addr = ptr;
+    ranges[0].len = 10;
+    ranges[1].addr = ptr + 4096;
+    ranges[1].len = 4096;
+    tb_persist_ranges(ranges, 2);
+    pbuddy_free(ptr);
+
+    /* CPU flush 명령은 일반 memory에도 쓸 수 있다. */
+    assert(tb_persist_method() != NULL);
+    memset(buf, 'b', sizeof(buf));
+    tb_flush(buf + 1, sizeof(buf) - 1);
+    tb_drain();
+    assert(buf[999] == 'b');
+}
+
+void pmem_nt_store()
+{
+    allocator_t *alloc;
+    char *src, *dst, *ptr;
+    int i, len = 100000;
+
+    /* 정렬이 안 맞는 앞뒤 부분도 제대로 쓰는지 */
+    src = malloc(len);
+    dst = malloc(len + 64);
+    for (i = 0; i < len; i++)
+        src[i] = (char)(i * 7);
+    tb_pmem_memcpy(dst + 3, src, len - 5);
+    assert(memcmp(dst + 3, src, len - 5) == 0);
+    tb_pmem_memset(dst + 5, 0x5a, len - 9);
+    for (i = 0; i < len - 9; i++)
+        assert(dst[5 + i] == 0x5a);
+
+    /* volatile mapping용은 flush 하지 않아도 내용은 같다. */
+    tb_pmem_memset_as(TB_PERSIST_NONE, dst, 0, len + 64);
+    tb_pmem_memcpy_as(TB_PERSIST_NONE, dst + 7, src, len - 11);
+    assert(memcmp(dst + 7, src, len - 11) == 0 && dst[6] == 0 && dst[len - 4] == 0);
+    free(src);
+    free(dst);
+
+    /* pmem allocator의 calloc/realloc은 non-temporal store를 쓴다. */
+    alloc = region_pallocator_new(PMEM_SYSTEM_ALLOC, false);
+    ptr = tb_malloc(alloc, len);
+    memset(ptr, 0xff, len);
+    tb_free(alloc, ptr);
+
+    ptr = tb_calloc(alloc, len);
+    for (i = 0; i < len; i++)
+        assert(ptr[i] == 0);
+    for (i = 0; i < len; i++)
+        ptr[i] = (char)i;
+    ptr = tb_realloc(alloc, ptr, 4 * len);
+    for (i = 0; i < len; i++)
+        assert(ptr[i] == (char)i);
+    allocator_delete(alloc);
+}
+
+void hybrid_alloc()
+{
+    allocator_t *alloc, *child;
+    char *ptr[64];
+    int i, dram_cnt = 0, pmem_cnt = 0;
+
+    /* 256K까지는 DRAM에서 region을 받고, 그 뒤로는 pmem에서 받는다. */
+    alloc = region_hallocator_new(SYSTEM_ALLOC, false, 256 * 1024);
+    assert(alloc != NULL && alloc->alloc_type == ALLOC_TYPE_REGION_HYBRID);
+
+    for (i = 0; i < 64; i++) {
+        ptr[i] = tb_malloc(alloc, 32 * 1024);
+        assert(ptr[i] != NULL);
+        memset(ptr[i], i, 32 * 1024);
+        if (pbuddy_in_pool(PBUDDY_POOL, ptr[i]))
+            pmem_cnt++;
+        else
+            dram_cnt++;
+    }
+    assert(dram_cnt > 0 && pmem_cnt > 0);
+    assert(dram_cnt * 32 * 1024 <= 256 * 1024);
+
+    /* DRAM에 있던 것을 키우면 pmem으로 옮겨가도 내용은 그대로이다. */
+    assert(!pbuddy_in_pool(PBUDDY_POOL, ptr[0]));
+    ptr[0] = tb_realloc(alloc, ptr[0], 512 * 1024);
+    assert(ptr[0] != NULL && ptr[0][32 * 1024 - 1] == 0);
+
+    /* child PMEM allocator는 parent와 같은 pool을 쓴다. */
+    child = region_pallocator_new(alloc, false);
+    assert(child != NULL && child->alloc_type == ALLOC_TYPE_REGION_PMEM);
+    assert(pbuddy_in_pool(PBUDDY_POOL, tb_malloc(child, 100)));
+
+    /* tb_free는 어느 쪽 region이든 같다. */
+    for (i = 0; i < 64; i++) {
+        assert(ptr[i][100] == (char)i);
+        tb_free(alloc, ptr[i]);
+    }
+    assert(get_total_used(alloc) == 0);
+    assert(get_total_size(alloc) == 0);
+
+    /* DRAM region이 모두 반납되었으므로 다시 DRAM에서 받는다. */
+    ptr[0] = tb_malloc(alloc, 100);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, ptr[0]));
+    tb_free(alloc, ptr[0]);
+
+    allocator_delete(alloc);
+}
+
+void placement_policy()
+{
+    allocator_t *alloc;
+    char *small, *large, *big;
+    alloc_place_rule_t rules[] = {
+        { 16 * 1024, ALLOC_TIER_DRAM },
+        { UINT64_MAX, ALLOC_TIER_PMEM }
+    };
+    alloc_place_rule_t bad[] = {
+        { 16 * 1024, ALLOC_TIER_DRAM },
+        { 4 * 1024, ALLOC_TIER_PMEM }
+    };
+
+    alloc = region_allocator_new(SYSTEM_ALLOC, false);
+    assert(!allocator_set_placement(alloc, bad, 2));
+    assert(allocator_set_placement(alloc, rules, 2));
+
+    /* 작은 것은 DRAM, 큰 것은 같은 allocator로 PMEM에서 받는다. */
+    small = tb_malloc(alloc, 100);
+    large = tb_calloc(alloc, 64 * 1024);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, small));
+    assert(pbuddy_in_pool(PBUDDY_POOL, large) && large[64 * 1024 - 1] == 0);
+    assert(get_tier_used(alloc, ALLOC_TIER_DRAM) >= 100);
+    assert(get_tier_used(alloc, ALLOC_TIER_PMEM) >= 64 * 1024);
+    assert(get_tier_used(alloc, ALLOC_TIER_DRAM) +
+           get_tier_used(alloc, ALLOC_TIER_PMEM) == get_total_used(alloc));
+
+    /* realloc은 원래 chunk가 있던 tier에 남는다. */
+    large[0] = 7;
+    large = tb_realloc(alloc, large, 256 * 1024);
+    assert(pbuddy_in_pool(PBUDDY_POOL, large) && large[0] == 7);
+
+    tb_free(alloc, large);
+    assert(get_tier_used(alloc, ALLOC_TIER_PMEM) == 0);
+    tb_free(alloc, small);
+    assert(get_total_used(alloc) == 0 && get_total_size(alloc) == 0);
+
+    /* cleanup은 sub heap의 region까지 반납한다. */
+    big = tb_malloc(alloc, 128 * 1024);
+    assert(pbuddy_in_pool(PBUDDY_POOL, big));
+    allocator_cleanup(alloc);
+    assert(get_total_size(alloc) == 0);
+    assert(get_tier_used(alloc, ALLOC_TIER_PMEM) == 0);
+
+    /* PMEM allocator에서 작은 것만 DRAM으로 보낼 수도 있다. */
+    allocator_delete(alloc);
+    alloc = region_pallocator_new(PMEM_SYSTEM_ALLOC, false);
+    assert(allocator_set_placement(alloc, rules, 2));
+    small = tb_malloc(alloc, 100);
+    large = tb_malloc(alloc, 64 * 1024);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, small));
+    assert(pbuddy_in_pool(PBUDDY_POOL, large));
+    allocator_delete(alloc);
+}
+
+void alloc_hint()
+{
+    allocator_t *alloc, *halloc;
+    char *hot, *cold, *tmp, *keep, *buf;
+    uint64_t size;
+    alloc_place_rule_t rules[] = {
+        { UINT64_MAX, ALLOC_TIER_PMEM }
+    };
+
+    /* HOT은 policy보다 우선하고, COLD는 DRAM allocator에서도 PMEM으로 간다. */
+    alloc = region_allocator_new(SYSTEM_ALLOC, false);
+    assert(allocator_set_placement(alloc, rules, 1));
+    hot = tb_malloc_hint(alloc, 100, TB_ALLOC_HINT_HOT);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, hot));
+    assert(pbuddy_in_pool(PBUDDY_POOL, tb_malloc(alloc, 100)));
+    allocator_set_placement(alloc, NULL, 0);
+    cold = tb_malloc_hint(alloc, 100, TB_ALLOC_HINT_COLD);
+    assert(pbuddy_in_pool(PBUDDY_POOL, cold));
+    hot = tb_malloc_hint(alloc, 100, TB_ALLOC_HINT_HOT | TB_ALLOC_HINT_COLD);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, hot));
+    assert(get_tier_used(alloc, ALLOC_TIER_DRAM) +
+           get_tier_used(alloc, ALLOC_TIER_PMEM) == get_total_used(alloc));
+
+    /* TRANSIENT는 오래 쓰는 객체와 다른 region에서 받는다. */
+    keep = tb_malloc(alloc, 100);
+    size = get_total_size(alloc);
+    tmp = tb_malloc_hint(alloc, 100, TB_ALLOC_HINT_TRANSIENT);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, tmp));
+    assert(get_total_size(alloc) > size);
+    tb_free(alloc, tmp);
+    tb_free(alloc, keep);
+
+    /* STREAMING calloc은 어느 tier든 0으로 채운다. */
+    buf = tb_calloc_hint(alloc, 256 * 1024, TB_ALLOC_HINT_STREAMING);
+    assert(buf[0] == 0 && buf[256 * 1024 - 1] == 0);
+    tb_free(alloc, buf);
+    buf = tb_calloc_hint(alloc, 256 * 1024,
+                         TB_ALLOC_HINT_STREAMING | TB_ALLOC_HINT_COLD);
+    assert(pbuddy_in_pool(PBUDDY_POOL, buf) && buf[256 * 1024 - 1] == 0);
+    tb_free(alloc, buf);
+    allocator_delete(alloc);
+
+    /* HYBRID는 budget을 넘어도 HOT이면 DRAM에서 받는다. */
+    halloc = region_hallocator_new(SYSTEM_ALLOC, false, 1024 * 1024);
+    buf = tb_malloc(halloc, 2 * 1024 * 1024);
+    assert(pbuddy_in_pool(PBUDDY_POOL, buf));
+    hot = tb_malloc_hint(halloc, 2 * 1024 * 1024, TB_ALLOC_HINT_HOT);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, hot));
+    tb_free(halloc, hot);
+    tb_free(halloc, buf);
+    allocator_delete(halloc);
+}
+
+void handle_migration()
+{
+    allocator_t *dram, *pmem;
+    tb_hheap_t *hheap;
+    tb_handle_t hot, cold, over, stale, *many;
+    char *ptr;
+    int i, interval = IPARAM(_HANDLE_MIGRATE_INTERVAL);
+    int sample_rate = IPARAM(_HANDLE_SAMPLE_RATE);
+
+    dram = region_allocator_new(SYSTEM_ALLOC, true);
+    pmem = region_pallocator_new(PMEM_SYSTEM_ALLOC, true);
+    assert(tb_hheap_new(pmem, dram, 0) == NULL);
+
+    /* thread 없이 tb_hheap_migrate로 한 scan씩 돌린다. */
+    IPARAM(_HANDLE_MIGRATE_INTERVAL) = 0;
+    IPARAM(_HANDLE_SAMPLE_RATE) = 1;
+    hheap = tb_hheap_new(dram, pmem, 64 * 1024);
+    assert(hheap != NULL);
+
+    hot = tb_halloc(hheap, 32 * 1024);
+    cold = tb_halloc(hheap, 16 * 1024);
+    over = tb_halloc(hheap, 32 * 1024);
+    assert(tb_htier(hheap, hot) == ALLOC_TIER_DRAM);
+    assert(tb_htier(hheap, cold) == ALLOC_TIER_DRAM);
+    assert(tb_htier(hheap, over) == ALLOC_TIER_PMEM);
+    ptr = tb_hpin(hheap, cold);
+    memset(ptr, 0x5a, 16 * 1024);
+    tb_hunpin(hheap, cold);
+    tb_hheap_migrate(hheap);
+
+    /* 접근이 없는 DRAM 객체는 _HANDLE_COLD_SCANS 뒤에 pmem으로 가고, 자주
+     * 쓰는 pmem 객체는 비워진 DRAM budget으로 올라온다. pin 된 객체는 그대로다. */
+    ptr = tb_hpin(hheap, hot);
+    for (i = 0; i < IPARAM(_HANDLE_COLD_SCANS); i++)
+    {
+        assert(tb_htier(hheap, cold) == ALLOC_TIER_DRAM);
+        tb_hheap_migrate(hheap);
+    }
+    assert(tb_htier(hheap, cold) == ALLOC_TIER_PMEM);
+    assert(tb_htier(hheap, hot) == ALLOC_TIER_DRAM && tb_hpin(hheap, hot) == ptr);
+    tb_hunpin(hheap, hot);
+    tb_hunpin(hheap, hot);
+    ptr = tb_hpin(hheap, cold);
+    assert(pbuddy_in_pool(PBUDDY_POOL, ptr));
+    assert(ptr[0] == 0x5a && ptr[16 * 1024 - 1] == 0x5a);
+    tb_hunpin(hheap, cold);
+
+    tb_hfree(hheap, hot);
+    for (i = 0; i < IPARAM(_HANDLE_HOT_THRESHOLD) * 2; i++)
+        tb_hunpin(hheap, over), tb_hpin(hheap, over);
+    tb_hunpin(hheap, over);
+    assert(tb_hheap_migrate(hheap) >= 1);
+    assert(tb_htier(hheap, over) == ALLOC_TIER_DRAM);
+    assert(hheap->promoted == 1 && hheap->demoted >= 1);
+
+    /* free 된 handle은 slot을 다시 써도 쓸 수 없다. */
+    stale = cold;
+    tb_hfree(hheap, cold);
+    cold = tb_halloc(hheap, 100);
+    assert(cold != stale && tb_hpin(hheap, stale) == NULL);
+
+    /* table이 segment 여러 개로 늘어나도 앞서 받은 handle은 그대로 쓴다. */
+    many = malloc(sizeof(tb_handle_t) * 5000);
+    for (i = 0; i < 5000; i++)
+    {
+        many[i] = tb_halloc(hheap, 8);
+        *(int *)tb_hpin(hheap, many[i]) = i;
+        tb_hunpin(hheap, many[i]);
+    }
+    for (i = 0; i < 5000; i++)
+    {
+        assert(*(int *)tb_hpin(hheap, many[i]) == i);
+        tb_hunpin(hheap, many[i]);
+        tb_hfree(hheap, many[i]);
+    }
+    free(many);
+    tb_hheap_delete(hheap);
+
+    /* migration thread */
+    IPARAM(_HANDLE_MIGRATE_INTERVAL) = 1;
+    hheap = tb_hheap_new(dram, pmem, 0);
+    cold = tb_halloc(hheap, 1024);
+    for (i = 0; i < 1000 && tb_htier(hheap, cold) != ALLOC_TIER_PMEM; i++)
+        usleep(1000);
+    assert(tb_htier(hheap, cold) == ALLOC_TIER_PMEM);
+    tb_hheap_delete(hheap);
+    assert(get_total_used(dram) == 0 && get_total_used(pmem) == 0);
+
+    IPARAM(_HANDLE_MIGRATE_INTERVAL) = interval;
+    IPARAM(_HANDLE_SAMPLE_RATE) = sample_rate;
+    allocator_delete(pmem);
+    allocator_delete(dram);
+}
+
+void move_alloc()
+{
+    allocator_t *dram, *dram2, *pmem, *halloc;
+    char *ptr, *moved;
+    int64_t size = 2 * 1024 * 1024;
+    int i;
+
+    dram = region_allocator_new(SYSTEM_ALLOC, false);
+    dram2 = region_allocator_new(SYSTEM_ALLOC, false);
+    pmem = region_pallocator_new(PMEM_SYSTEM_ALLOC, false);
+
+    /* 작은 객체는 복사해서 옮긴다. */
+    ptr = tb_malloc(dram, 1000);
+    for (i = 0; i < 1000; i++)
+        ptr[i] = (char)i;
+    moved = tb_move(ptr, dram, pmem);
+    assert(moved != ptr && pbuddy_in_pool(PBUDDY_POOL, moved));
+    for (i = 0; i < 1000; i++)
+        assert(moved[i] == (char)i);
+    assert(get_total_used(dram) == 0 && get_total_used(pmem) > 0);
+    ptr = tb_move(moved, pmem, dram);
+    assert(!pbuddy_in_pool(PBUDDY_POOL, ptr) && ptr[999] == (char)999);
+    assert(get_total_used(pmem) == 0);
+    tb_free(dram, ptr);
+
+    /* region 하나를 다 쓰는 객체는 같은 tier끼리면 region째로 넘긴다. */
+    ptr = tb_malloc(dram, size);
+    ptr[0] = 1;
+    moved = tb_move(ptr, dram, dram2);
+    assert(moved == ptr && moved[0] == 1);
+    assert(get_total_size(dram) == 0 && get_total_size(dram2) >= size);
+    assert(get_tier_used(dram2, ALLOC_TIER_DRAM) == get_total_used(dram2));
+
+    /* tier가 다르면 복사한다. */
+    moved = tb_move(ptr, dram2, pmem);
+    assert(moved != ptr && pbuddy_in_pool(PBUDDY_POOL, moved) && moved[0] == 1);
+    assert(get_total_size(dram2) == 0);
+
+    /* hybrid가 pmem에 받은 region은 pmem allocator로 그대로 넘긴다. */
+    halloc = region_hallocator_new(SYSTEM_ALLOC, false, 1024 * 1024);
+    ptr = tb_malloc(halloc, size);
+    assert(pbuddy_in_pool(PBUDDY_POOL, ptr));
+    ptr[size - 1] = 2;
+    assert(tb_move(ptr, halloc, pmem) == ptr);
+    assert(get_total_size(halloc) == 0 && get_total_used(halloc) == 0);
+    assert(ptr[size - 1] == 2);
+    tb_free(pmem, ptr);
+    tb_free(pmem, moved);
+    assert(get_total_used(pmem) == 0);
+
+    allocator_delete(halloc);
+    allocator_delete(pmem);
+    allocator_delete(dram2);
+    allocator_delete(dram);
+}
+
 void alloc_fail()
 {
     void *ptr;
@@ -174,11 +947,306 @@ void alloc_fail()
     assert(!PMEM_SYSTEM_ALLOC && !SYSTEM_ALLOC);
 }
 
+void pmem_huge_alloc()
+{
+    char *ptr;
+    uint64_t size = 3L * 1024L * 1024L * 1024L / 2;
+
+    /* 1G보다 큰 요청도 arena 여러 개에 걸쳐 pmem에서 받을 수 있다. */
+    IPARAM(PMEM_MAX_SIZE) = 3L * 1024L * 1024L * 1024L;
+    IPARAM(PMEM_ALLOC_SIZE) = 3L * 1024L * 1024L * 1024L;
+    tballoc_init();
+    assert(PBUDDY_POOL->arena_cnt > 1);
+
+    ptr = tb_malloc(PMEM_SYSTEM_ALLOC, size);
+    assert(ptr != NULL);
+    ptr[0] = 1;
+    ptr[size - 1] = 1;
+    tb_free(PMEM_SYSTEM_ALLOC, ptr);
+    assert(get_total_used(PMEM_SYSTEM_ALLOC) == 0);
+
+    tballoc_clear();
+}
+
+void pmem_buddy_punch()
+{
+    char *ptr;
+    struct stat st;
+    blkcnt_t blocks;
+    uint64_t punch_cnt, punched_bytes, bytes;
+    uint64_t size = 4 * 1024 * 1024;
+
+    IPARAM(PMEM_MAX_SIZE) = 64L * 1024L * 1024L;
+    IPARAM(PMEM_ALLOC_SIZE) = 64L * 1024L * 1024L;
+    IPARAM(_PMEM_PUNCH_MIN_SIZE) = 1024 * 1024;
+    IPARAM(_PMEM_PUNCH_AGE) = 0;
+    tballoc_init();
+
+    ptr = pbuddy_malloc(size);
+    memset(ptr, 1, size);
+    stat(PBUDDY_POOL->file_fullpath, &st);
+    blocks = st.st_blocks;
+
+    /* free 하면 바로 punch 되어 파일의 block이 줄어야 한다. */
+    pbuddy_free(ptr);
+    get_pbuddy_punch_state(PBUDDY_POOL, &punch_cnt, &punched_bytes);
+    assert(punch_cnt > 0 && punched_bytes >= size - BUDDY_PAGESIZE);
+    stat(PBUDDY_POOL->file_fullpath, &st);
+    assert(st.st_blocks < blocks);
+
+    /* punch 된 chunk도 다시 받아서 쓸 수 있고, 받아간 만큼 punched_bytes가
+     * 줄어든다. */
+    ptr = pbuddy_malloc(size);
+    assert(ptr != NULL);
+    bytes = punched_bytes;
+    get_pbuddy_punch_state(PBUDDY_POOL, &punch_cnt, &punched_bytes);
+    assert(punched_bytes < bytes);
+    memset(ptr, 2, size);
+    assert(ptr[size - 1] == 2);
+    pbuddy_free(ptr);
+
+    /* punch 된 chunk에서 page 단위로 받아가면, 쓰지 않고 돌려준 뒤쪽 조각들은
+     * punch 된 채로 남는다. punched_bytes는 받아간 크기와 조각들의 header
+     * page 만큼만 줄어야 한다. */
+    pbuddy_pool_trim(PBUDDY_POOL, 0);
+    get_pbuddy_punch_state(PBUDDY_POOL, &punch_cnt, &bytes);
+    ptr = pbuddy_malloc_exact(size / 4 + 5 * BUDDY_PAGESIZE);
+    assert(ptr != NULL);
+    get_pbuddy_punch_state(PBUDDY_POOL, &punch_cnt, &punched_bytes);
+    assert(bytes - punched_bytes < get_buddy_alloc_size(size / 4 + 5 * BUDDY_PAGESIZE));
+    pbuddy_free(ptr);
+
+    tballoc_clear();
+    IPARAM(_PMEM_PUNCH_MIN_SIZE) = 0;
+}
+
+void pmem_named_pool()
+{
+    char *str;
+    char path[1024];
+
+    IPARAM(PMEM_MAX_SIZE) = 64L * 1024L * 1024L;
+    IPARAM(PMEM_ALLOC_SIZE) = 64L * 1024L * 1024L;
+    IPARAM(PMEM_POOL_NAME) = "test_pool";
+    sprintf(path, "%s/%s", IPARAM(PMEM_DIR), IPARAM(PMEM_POOL_NAME));
+    unlink(path);
+
+    tballoc_init();
+    str = pbuddy_malloc(BUDDY_PAGESIZE);
+    strcpy(str, "Hello, World!");
+    pbuddy_set_root(str);
+    tballoc_clear();
+
+    /* 다시 열면 root와 그 내용이 그대로 남아 있어야 한다. */
+    tballoc_init();
+    str = pbuddy_get_root();
+    assert(str != NULL);
+    assert(strcmp(str, "Hello, World!") == 0);
+    pbuddy_free(str);
+    pbuddy_set_root(NULL);
+    tballoc_clear();
+
+    IPARAM(PMEM_POOL_NAME) = NULL;
+    unlink(path);
+}
+
+void pmem_pool_recover()
+{
+    pbuddy_pool_t *pool;
+    char *str, *cached, *span;
+    char path[1024];
+    uint64_t total, used, old_used, span_size, *link;
+
+    sprintf(path, "%s/%s", IPARAM(PMEM_DIR), "recover_pool");
+    unlink(path);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "recover_pool", NULL,
+                                  64L * 1024L * 1024L, 64L * 1024L * 1024L);
+    assert(pool != NULL && pool->mode == PBUDDY_POOL_PERSISTENT);
+    assert(pool->persist != TB_PERSIST_NONE);
+    get_pbuddy_alloc_state(pool, &total, &old_used);
+
+    str = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    strcpy(str, "survives a crash");
+    pbuddy_pool_set_root(pool, str);
+
+    /* free 했지만 thread magazine에 남아 bitmap에서는 allocated인 chunk */
+    cached = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    pbuddy_pool_free(pool, cached);
+
+    /* arena 여러 개에 걸친 chunk도 각 arena의 order map으로 복구된다. */
+    assert(pool->arena_cnt >= 3);
+    link = (uint64_t *)(str + BUDDY_PAGESIZE / 2);
+    *link = 0;
+    span = pbuddy_pool_tx_malloc(pool, pool->arena_size + BUDDY_PAGESIZE, link);
+    assert(span != NULL && *link == (uint64_t)(span - pool->map_addr));
+    span_size = get_pbuddy_chunk_size(pool, span);
+    assert(span_size > pool->arena_size);
+
+    /* pbuddy_pool_close 없이 mapping만 내려서 비정상 종료를 흉내낸다. */
+    munmap(pool->map_addr, pool->map_size);
+    close(pool->fd);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "recover_pool", NULL, 0, 0);
+    assert(pool != NULL);
+    str = pbuddy_pool_get_root(pool);
+    assert(str != NULL && strcmp(str, "survives a crash") == 0);
+    assert(pbuddy_pool_owns(pool, str));
+    link = (uint64_t *)(str + BUDDY_PAGESIZE / 2);
+    span = pool->map_addr + *link;
+    assert(get_pbuddy_chunk_size(pool, span) == span_size);
+    assert(!pbuddy_pool_owns(pool, span + pool->arena_size));
+
+    /* root와 span만 살아있고 magazine에 있던 chunk는 회수되어야 한다. */
+    get_pbuddy_alloc_state(pool, &total, &used);
+    assert(used == old_used + BUDDY_PAGESIZE + span_size);
+
+    assert(pbuddy_pool_tx_free(pool, link));
+    get_pbuddy_alloc_state(pool, &total, &used);
+    assert(used == old_used + BUDDY_PAGESIZE);
+    pbuddy_pool_free(pool, str);
+    assert(pbuddy_pool_close(pool) == 0);
+    unlink(path);
+}
+
+void pmem_tx()
+{
+    pbuddy_pool_t *pool;
+    pbuddy_redo_log_t *log;
+    uint64_t *root, local;
+    uint64_t ptr_offset, leaked_offset, free_offset, freed_offset;
+    char *ptr;
+    char path[1024];
+
+    sprintf(path, "%s/%s", IPARAM(PMEM_DIR), "tx_pool");
+    unlink(path);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "tx_pool", NULL,
+                                  64L * 1024L * 1024L, 64L * 1024L * 1024L);
+    assert(pool != NULL);
+
+    root = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    memset(root, 0, BUDDY_PAGESIZE);
+    pbuddy_pool_set_root(pool, root);
+
+    /* 할당하면서 root에 연결하고, free 하면서 연결을 끊는다. */
+    ptr = pbuddy_pool_tx_malloc(pool, 2 * BUDDY_PAGESIZE, &root[0]);
+    assert(ptr != NULL && root[0] == (uint64_t)(ptr - pool->map_addr));
+    assert(pbuddy_pool_owns(pool, ptr));
+    assert(pbuddy_pool_tx_free(pool, &root[0]));
+    assert(root[0] == 0 && !pbuddy_pool_owns(pool, ptr));
+    assert(!pbuddy_pool_tx_free(pool, &root[0]));
+
+    /* dest는 pool 안에 있어야 한다. */
+    assert(pbuddy_pool_tx_malloc(pool, BUDDY_PAGESIZE, &local) == NULL);
+
+    /* tx_free 뒤에 mapping만 내려도 chunk는 free로 남아야 한다. 아래 할당이
+     * 이 chunk를 다시 받지 않도록 크기를 다르게 한다. */
+    ptr = pbuddy_pool_tx_malloc(pool, 4 * BUDDY_PAGESIZE, &root[4]);
+    freed_offset = (uint64_t)(ptr - pool->map_addr);
+    assert(pbuddy_pool_tx_free(pool, &root[4]));
+
+    /* slot 0은 record만 durable 하고 order map과 dest는 쓰기 전에, slot 1은
+     * record를 쓰다 만 채로, slot 2는 tx_free의 record만 durable 한 채로
+     * 죽은 것처럼 남긴다. buddy_reserve와 같은 상태를 만들기 위해 order map을
+     * 지운다. */
+    ptr = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    ptr_offset = (uint64_t)(ptr - pool->map_addr);
+    assert(buddy_omap_clear(pbuddy_arena_of(pool, ptr), ptr, false) == BUDDY_PAGESIZE);
+    ptr = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    leaked_offset = (uint64_t)(ptr - pool->map_addr);
+    assert(buddy_omap_clear(pbuddy_arena_of(pool, ptr), ptr, false) == BUDDY_PAGESIZE);
+    ptr = pbuddy_pool_tx_malloc(pool, BUDDY_PAGESIZE, &root[3]);
+    free_offset = (uint64_t)(ptr - pool->map_addr);
+
+    log = pool->logs;
+    log[0].dest_offset = (uint64_t)((char *)&root[1] - pool->map_addr);
+    log[0].value = ptr_offset;
+    log[0].size = BUDDY_PAGESIZE;
+    log[0].state = ptr_offset | PBUDDY_REDO_COMMITTED;
+    log[0].checksum = pbuddy_redo_checksum(&log[0]);
+
+    log[1].dest_offset = (uint64_t)((char *)&root[2] - pool->map_addr);
+    log[1].value = leaked_offset;
+    log[1].size = BUDDY_PAGESIZE;
+    log[1].state = leaked_offset | PBUDDY_REDO_COMMITTED;
+    log[1].checksum = pbuddy_redo_checksum(&log[1]) + 1;
+
+    log[2].dest_offset = (uint64_t)((char *)&root[3] - pool->map_addr);
+    log[2].value = 0;
+    log[2].size = BUDDY_PAGESIZE;
+    log[2].state = free_offset | PBUDDY_REDO_COMMITTED | PBUDDY_REDO_FREE;
+    log[2].checksum = pbuddy_redo_checksum(&log[2]);
+
+    munmap(pool->map_addr, pool->map_size);
+    close(pool->fd);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "tx_pool", NULL, 0, 0);
+    assert(pool != NULL);
+    root = pbuddy_pool_get_root(pool);
+    assert(root != NULL && root[1] == ptr_offset);
+    assert(pbuddy_pool_owns(pool, pool->map_addr + ptr_offset));
+    assert(root[2] == 0 && !pbuddy_pool_owns(pool, pool->map_addr + leaked_offset));
+    assert(root[3] == 0 && !pbuddy_pool_owns(pool, pool->map_addr + free_offset));
+    assert(root[4] == 0 && !pbuddy_pool_owns(pool, pool->map_addr + freed_offset));
+    assert(pool->logs[0].state == 0 && pool->logs[1].state == 0 &&
+           pool->logs[2].state == 0);
+
+    assert(pbuddy_pool_tx_free(pool, &root[1]));
+    pbuddy_pool_free(pool, root);
+    assert(pbuddy_pool_close(pool) == 0);
+    unlink(path);
+}
+
+void pmem_offset_ptr()
+{
+    pbuddy_pool_t *pool;
+    uint64_t *root;
+    char *str, *old_base, *blocker;
+    char path[1024];
+
+    sprintf(path, "%s/%s", IPARAM(PMEM_DIR), "offset_pool");
+    unlink(path);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "offset_pool", NULL,
+                                  64L * 1024L * 1024L, 64L * 1024L * 1024L);
+    assert(pool != NULL);
+    assert(pbuddy_pool_ptr2off(pool, NULL) == 0 && pbuddy_pool_off2ptr(pool, 0) == NULL);
+
+    root = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    str = pbuddy_pool_malloc(pool, BUDDY_PAGESIZE);
+    strcpy(str, "relocatable");
+    root[0] = pbuddy_pool_ptr2off(pool, str);
+    assert(pbuddy_pool_off2ptr(pool, root[0]) == str);
+    pbuddy_pool_set_root(pool, root);
+    old_base = pool->map_addr;
+    assert(pbuddy_pool_close(pool) == 0);
+
+    /* 이전 주소를 막아서 다른 주소에 열리게 한다. */
+    blocker = mmap(old_base, BUDDY_PAGESIZE, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    assert(blocker == old_base);
+
+    pool = pbuddy_pool_open_named(IPARAM(PMEM_DIR), "offset_pool", NULL, 0, 0);
+    assert(pool != NULL && pool->map_addr != old_base);
+    root = pbuddy_pool_get_root(pool);
+    str = pbuddy_pool_off2ptr(pool, root[0]);
+    assert(strcmp(str, "relocatable") == 0);
+    assert(pbuddy_pool_owns(pool, str));
+
+    pbuddy_pool_free(pool, str);
+    pbuddy_pool_free(pool, root);
+    assert(pbuddy_pool_close(pool) == 0);
+    munmap(blocker, BUDDY_PAGESIZE);
+    unlink(path);
+}
+
 int main()
 {
     IPARAM(PMEM_DIR) = "/workspace/develop/code_test/pmem_tmp";
     IPARAM(PMEM_MAX_SIZE) = 512L * 1024L * 1024L;
     IPARAM(PMEM_ALLOC_SIZE) = 512L * 1024L * 1024L;
+    IPARAM(_PMEM_ARENA_CNT) = 4;
 
     tballoc_init();
 
@@ -187,9 +1255,34 @@ int main()
     alloc_api();
     allocator_delete_example();
     multi_thread_alloc();
+    pmem_buddy_magazine();
+    pmem_buddy_magazine_reclaim();
+    pmem_buddy_magazine_many();
+    pmem_buddy_arena();
+    pmem_buddy_exact();
+    pmem_buddy_free_check();
+    pmem_buddy_stat();
+    pmem_multi_pool();
+    pmem_striped_pool();
+    pmem_prefault();
+    pmem_map_align();
+    pmem_page_geometry();
+    pmem_persist();
+    pmem_nt_store();
+    hybrid_alloc();
+    placement_policy();
+    alloc_hint();
+    handle_migration();
+    move_alloc();
 
     tballoc_clear();
 
     alloc_fail();
+    pmem_huge_alloc();
+    pmem_buddy_punch();
+    pmem_named_pool();
+    pmem_pool_recover();
+    pmem_tx();
+    pmem_offset_ptr();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,527 @@
+/**
+ * @file    handle_alloc.c
+ * @brief   handle 기반 객체와 DRAM/pmem 사이의 background migration
+ *
+ * 객체의 주소는 DRAM에 있는 table에만 두므로 pin 되지 않은 객체는 table의
+ * 주소만 바꿔서 옮길 수 있다. table의 각 entry는 pin_cnt로 보호한다.
+ * migration과 tb_hfree는 pin_cnt를 0에서 HHEAP_PIN_MOVING으로 바꾼 뒤에만
+ * 객체를 옮기거나 free 하고, tb_hpin은 HHEAP_PIN_MOVING인 동안 기다린다.
+ * table lock은 entry를 찾는 동안만 잡으므로 복사가 길어져도 tb_halloc,
+ * tb_hfree를 막지 않는다.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "iparam.h"
+#include "handle_alloc.h"
+#include "pmem_persist.h"
+
+#define HANDLE_SLOT(handle) ((uint32_t)((handle) & 0xffffffffULL))
+#define HANDLE_GEN(handle)  ((uint32_t)((handle) >> 32))
+#define HANDLE_MAKE(slot, gen) (((uint64_t)(gen) << 32) | ((uint64_t)(slot) + 1))
+
+static __thread uint32_t hheap_pin_tick = 0;
+
+static void *hheap_migrate_thread(void *arg);
+
+static inline allocator_t *hheap_tier_alloc(tb_hheap_t *hheap, alloc_tier_t tier)
+{
+    return (tier == ALLOC_TIER_PMEM) ? hheap->pmem_alloc : hheap->dram_alloc;
+}
+
+/* slot 번호(0부터)의 entry */
+static inline tb_hentry_t *hheap_slot(tb_hheap_t *hheap, uint32_t slot)
+{
+    uint32_t hi = slot >> HHEAP_SEG0_SHIFT;
+    int seg;
+
+    if (hi == 0)
+        return &hheap->segs[0][slot];
+
+    seg = 32 - __builtin_clz(hi);
+    return &hheap->segs[seg][slot - (HHEAP_SEG0_CNT << (seg - 1))];
+}
+
+/* handle이 가리키는 entry. 잘못되었거나 free 된 handle이면 NULL. lock을 잡고 부른다. */
+static tb_hentry_t *hheap_entry(tb_hheap_t *hheap, tb_handle_t handle)
+{
+    uint32_t slot = HANDLE_SLOT(handle);
+    tb_hentry_t *entry;
+
+    if (slot == 0 || slot > hheap->table_cnt)
+        return NULL;
+
+    entry = hheap_slot(hheap, slot - 1);
+    if (entry->ptr == NULL || entry->gen != HANDLE_GEN(handle))
+        return NULL;
+
+    return entry;
+}
+
+/* segment를 하나 더 붙이고 새 slot들을 빈 slot list에 넣는다. 이미 있는 entry는
+ * 옮기지 않는다. write lock을 잡고 부른다. */
+static bool hheap_grow_table(tb_hheap_t *hheap)
+{
+    int seg = hheap->seg_cnt;
+    uint32_t cnt, i;
+    tb_hentry_t *entries;
+
+    if (seg >= HHEAP_MAX_SEGS)
+        return false;
+
+    cnt = (seg == 0) ? HHEAP_SEG0_CNT : HHEAP_SEG0_CNT << (seg - 1);
+    entries = calloc(cnt, sizeof(tb_hentry_t));
+    if (entries == NULL)
+        return false;
+
+    for (i = cnt; i > 0; i--)
+    {
+        entries[i - 1].next_free = hheap->free_head;
+        hheap->free_head = hheap->table_cnt + i;
+    }
+
+    hheap->segs[seg] = entries;
+    hheap->seg_cnt = seg + 1;
+    hheap->table_cnt += cnt;
+    return true;
+}
+
+/**
+ * @brief handle allocator를 만든다.
+ *
+ * dram_alloc은 region allocator(REGION_ALLOC_SYS), pmem_alloc은 pmem region
+ * allocator(REGION_ALLOC_PMEM)여야 한다. _HANDLE_MIGRATE_INTERVAL이 0보다 크면
+ * migration thread를 띄운다.
+ */
+tb_hheap_t *tb_hheap_new(allocator_t *dram_alloc, allocator_t *pmem_alloc,
+                         uint64_t dram_budget)
+{
+    tb_hheap_t *hheap;
+    pthread_rwlockattr_t attr;
+
+    if (dram_alloc == NULL || dram_alloc->alloc_type != ALLOC_TYPE_REGION_SYS ||
+        pmem_alloc == NULL || pmem_alloc->alloc_type != ALLOC_TYPE_REGION_PMEM)
+    {
+        printf("tb_hheap_new: needs a DRAM and a pmem region allocator\n");
+        return NULL;
+    }
+
+    if (IPARAM(_HANDLE_MIGRATE_INTERVAL) > 0 &&
+        (!dram_alloc->use_mutex || !pmem_alloc->use_mutex))
+    {
+        printf("tb_hheap_new: allocators must use mutex for background migration\n");
+        return NULL;
+    }
+
+    hheap = calloc(1, sizeof(tb_hheap_t));
+    if (hheap == NULL)
+        return NULL;
+
+    hheap->dram_alloc = dram_alloc;
+    hheap->pmem_alloc = pmem_alloc;
+    hheap->dram_budget = (dram_budget > 0) ? dram_budget : IPARAM(_HYBRID_DRAM_BUDGET);
+    /* glibc 기본값은 reader 우선이라 tb_hpin이 계속 들어오면 tb_halloc/tb_hfree가
+     * 굶을 수 있다. */
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&hheap->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&hheap->stop_mutex, NULL);
+    pthread_cond_init(&hheap->stop_cond, NULL);
+
+    if (!hheap_grow_table(hheap))
+    {
+        tb_hheap_delete(hheap);
+        return NULL;
+    }
+
+    if (IPARAM(_HANDLE_MIGRATE_INTERVAL) > 0)
+    {
+        if (pthread_create(&hheap->thread, NULL, hheap_migrate_thread, hheap) != 0)
+        {
+            printf("tb_hheap_new: could not start migration thread\n");
+            tb_hheap_delete(hheap);
+            return NULL;
+        }
+        hheap->thread_running = true;
+    }
+
+    return hheap;
+}
+
+/* migration thread를 멈추고 남아 있는 객체를 모두 free 한다. */
+void tb_hheap_delete(tb_hheap_t *hheap)
+{
+    tb_hentry_t *entry;
+    uint32_t i;
+    int seg;
+
+    if (hheap->thread_running)
+    {
+        pthread_mutex_lock(&hheap->stop_mutex);
+        hheap->stop = true;
+        pthread_cond_signal(&hheap->stop_cond);
+        pthread_mutex_unlock(&hheap->stop_mutex);
+        pthread_join(hheap->thread, NULL);
+    }
+
+    for (i = 0; i < hheap->table_cnt; i++)
+    {
+        entry = hheap_slot(hheap, i);
+        if (entry->ptr != NULL)
+            tb_free(hheap_tier_alloc(hheap, entry->tier), entry->ptr);
+    }
+
+    for (seg = 0; seg < hheap->seg_cnt; seg++)
+        free(hheap->segs[seg]);
+    pthread_cond_destroy(&hheap->stop_cond);
+    pthread_mutex_destroy(&hheap->stop_mutex);
+    pthread_rwlock_destroy(&hheap->lock);
+    free(hheap);
+}
+
+/**
+ * @brief bytes 크기의 객체를 할당하고 handle을 돌려준다.
+ *
+ * DRAM budget 안이면 DRAM에, 아니면 pmem에 둔다.
+ *
+ * @return 실패하면 TB_HANDLE_NULL.
+ */
+tb_handle_t tb_halloc(tb_hheap_t *hheap, int64_t bytes)
+{
+    alloc_tier_t tier = ALLOC_TIER_PMEM;
+    tb_hentry_t *entry;
+    uint32_t slot;
+    void *ptr = NULL;
+
+    if (__atomic_add_fetch(&hheap->dram_used, bytes, __ATOMIC_RELAXED) <= hheap->dram_budget)
+    {
+        ptr = tb_malloc(hheap->dram_alloc, bytes);
+        if (ptr != NULL)
+            tier = ALLOC_TIER_DRAM;
+    }
+    if (ptr == NULL)
+    {
+        __atomic_sub_fetch(&hheap->dram_used, bytes, __ATOMIC_RELAXED);
+        ptr = tb_malloc(hheap->pmem_alloc, bytes);
+        if (ptr == NULL)
+            return TB_HANDLE_NULL;
+    }
+
+    pthread_rwlock_wrlock(&hheap->lock);
+
+    if (hheap->free_head == 0 && !hheap_grow_table(hheap))
+    {
+        pthread_rwlock_unlock(&hheap->lock);
+        printf("tb_halloc: could not grow the handle table\n");
+        if (tier == ALLOC_TIER_DRAM)
+            __atomic_sub_fetch(&hheap->dram_used, bytes, __ATOMIC_RELAXED);
+        tb_free(hheap_tier_alloc(hheap, tier), ptr);
+        return TB_HANDLE_NULL;
+    }
+
+    slot = hheap->free_head - 1;
+    entry = hheap_slot(hheap, slot);
+    hheap->free_head = entry->next_free;
+
+    entry->ptr = ptr;
+    entry->size = bytes;
+    entry->pin_cnt = 0;
+    entry->heat = 0;
+    entry->idle_scans = 0;
+    entry->tier = tier;
+    entry->next_free = 0;
+
+    pthread_rwlock_unlock(&hheap->lock);
+
+    return HANDLE_MAKE(slot, entry->gen);
+}
+
+/* 객체를 free 한다. pin 되어 있으면 free 하지 않는다. */
+void tb_hfree(tb_hheap_t *hheap, tb_handle_t handle)
+{
+    tb_hentry_t *entry;
+    uint32_t unpinned;
+    alloc_tier_t tier;
+    void *ptr;
+
+    for (;;)
+    {
+        pthread_rwlock_wrlock(&hheap->lock);
+
+        entry = hheap_entry(hheap, handle);
+        if (entry == NULL)
+        {
+            pthread_rwlock_unlock(&hheap->lock);
+            printf("tb_hfree: invalid handle 0x%" PRIx64 "\n", handle);
+            return;
+        }
+
+        unpinned = 0;
+        if (__atomic_compare_exchange_n(&entry->pin_cnt, &unpinned, HHEAP_PIN_MOVING,
+                                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+
+        pthread_rwlock_unlock(&hheap->lock);
+        if (unpinned != HHEAP_PIN_MOVING)
+        {
+            printf("tb_hfree: handle 0x%" PRIx64 " is pinned\n", handle);
+            return;
+        }
+        /* migration이 옮기는 중이면 끝날 때까지 기다린다. */
+        sched_yield();
+    }
+
+    ptr = entry->ptr;
+    tier = entry->tier;
+    if (tier == ALLOC_TIER_DRAM)
+        __atomic_sub_fetch(&hheap->dram_used, entry->size, __ATOMIC_RELAXED);
+
+    entry->ptr = NULL;
+    entry->gen++;
+    entry->next_free = hheap->free_head;
+    hheap->free_head = HANDLE_SLOT(handle);
+    __atomic_store_n(&entry->pin_cnt, 0, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&hheap->lock);
+
+    tb_free(hheap_tier_alloc(hheap, tier), ptr);
+}
+
+/**
+ * @brief 객체의 주소를 돌려준다. tb_hunpin 할 때까지 객체는 옮겨지지 않는다.
+ *
+ * @return 잘못된 handle이면 NULL.
+ */
+void *tb_hpin(tb_hheap_t *hheap, tb_handle_t handle)
+{
+    tb_hentry_t *entry;
+    uint32_t pin_cnt;
+    void *ptr;
+
+    for (;;)
+    {
+        pthread_rwlock_rdlock(&hheap->lock);
+
+        entry = hheap_entry(hheap, handle);
+        if (entry == NULL)
+        {
+            pthread_rwlock_unlock(&hheap->lock);
+            printf("tb_hpin: invalid handle 0x%" PRIx64 "\n", handle);
+            return NULL;
+        }
+
+        pin_cnt = __atomic_load_n(&entry->pin_cnt, __ATOMIC_ACQUIRE);
+        if (pin_cnt != HHEAP_PIN_MOVING &&
+            __atomic_compare_exchange_n(&entry->pin_cnt, &pin_cnt, pin_cnt + 1,
+                                        false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            break;
+
+        /* 옮기는 중이면 lock을 놓고 기다린다. */
+        pthread_rwlock_unlock(&hheap->lock);
+        if (pin_cnt == HHEAP_PIN_MOVING)
+            sched_yield();
+    }
+
+    /* 매번 세면 table의 cache line을 thread들이 계속 주고받으므로 sampling 한다. */
+    if (++hheap_pin_tick >= (uint32_t)IPARAM(_HANDLE_SAMPLE_RATE))
+    {
+        hheap_pin_tick = 0;
+        __atomic_add_fetch(&entry->heat, 1, __ATOMIC_RELAXED);
+    }
+
+    ptr = entry->ptr;
+    pthread_rwlock_unlock(&hheap->lock);
+
+    return ptr;
+}
+
+void tb_hunpin(tb_hheap_t *hheap, tb_handle_t handle)
+{
+    tb_hentry_t *entry;
+
+    pthread_rwlock_rdlock(&hheap->lock);
+
+    entry = hheap_entry(hheap, handle);
+    if (entry == NULL || __atomic_load_n(&entry->pin_cnt, __ATOMIC_RELAXED) == 0)
+        printf("tb_hunpin: handle 0x%" PRIx64 " is not pinned\n", handle);
+    else
+        __atomic_sub_fetch(&entry->pin_cnt, 1, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&hheap->lock);
+}
+
+/* 객체가 지금 있는 tier. 잘못된 handle이면 ALLOC_TIER_CNT. */
+alloc_tier_t tb_htier(tb_hheap_t *hheap, tb_handle_t handle)
+{
+    tb_hentry_t *entry;
+    alloc_tier_t tier;
+
+    pthread_rwlock_rdlock(&hheap->lock);
+    entry = hheap_entry(hheap, handle);
+    tier = (entry != NULL) ? (alloc_tier_t)entry->tier : ALLOC_TIER_CNT;
+    pthread_rwlock_unlock(&hheap->lock);
+
+    return tier;
+}
+
+/* HHEAP_PIN_MOVING으로 잡아둔 entry의 객체를 tier로 옮긴다. pmem으로는
+ * cache를 거치지 않고 복사한다. */
+static bool hheap_move(tb_hheap_t *hheap, tb_hentry_t *entry, alloc_tier_t tier)
+{
+    void *ptr;
+
+    ptr = tb_malloc(hheap_tier_alloc(hheap, tier), entry->size);
+    if (ptr == NULL)
+        return false;
+
+    /* 객체는 DRAM의 table로만 찾을 수 있어서 다시 열 때 남아 있을 필요가
+     * 없으므로 flush 하지 않는다. */
+    if (tier == ALLOC_TIER_PMEM)
+        tb_pmem_memcpy_as(TB_PERSIST_NONE, ptr, entry->ptr, entry->size);
+    else
+        memcpy(ptr, entry->ptr, entry->size);
+
+    tb_free(hheap_tier_alloc(hheap, entry->tier), entry->ptr);
+    __atomic_store_n(&entry->ptr, ptr, __ATOMIC_RELAXED);
+    entry->tier = tier;
+    entry->idle_scans = 0;
+
+    return true;
+}
+
+/**
+ * @brief table을 한 번 훑으면서 차가운 DRAM 객체를 pmem으로, 뜨거운 pmem
+ *        객체를 DRAM으로 옮긴다.
+ *
+ * pin 되어 있는 객체는 건너뛴다. lock은 entry를 보고 pin_cnt를
+ * HHEAP_PIN_MOVING으로 잡을 때만 잡고, 복사하는 동안에는 놓는다. migration
+ * thread가 부르며, thread 없이 쓸 때는 직접 부른다.
+ *
+ * @return 옮긴 객체 개수
+ */
+int tb_hheap_migrate(tb_hheap_t *hheap)
+{
+    tb_hentry_t *entry;
+    alloc_tier_t target;
+    uint64_t size;
+    uint32_t i, heat, unpinned;
+    bool done;
+    int moved = 0;
+
+    for (i = 0; ; i++)
+    {
+        pthread_rwlock_rdlock(&hheap->lock);
+
+        if (i >= hheap->table_cnt)
+        {
+            pthread_rwlock_unlock(&hheap->lock);
+            break;
+        }
+
+        entry = hheap_slot(hheap, i);
+        if (entry->ptr == NULL)
+        {
+            pthread_rwlock_unlock(&hheap->lock);
+            continue;
+        }
+
+        /* pin을 놓은 뒤에는 tb_hfree가 entry를 재사용할 수 있으므로, budget
+         * 계산에 쓸 크기는 lock을 잡고 있을 때 읽어둔다. */
+        size = entry->size;
+        heat = __atomic_load_n(&entry->heat, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&entry->heat, heat - heat / 2, __ATOMIC_RELAXED);
+
+        target = entry->tier;
+        if (entry->tier == ALLOC_TIER_DRAM)
+        {
+            /* 옮기지 못해도 계속 세므로 넘치지 않게 한다. */
+            if (heat != 0)
+                entry->idle_scans = 0;
+            else if (entry->idle_scans < UINT16_MAX)
+                entry->idle_scans++;
+            if (entry->idle_scans >= IPARAM(_HANDLE_COLD_SCANS))
+                target = ALLOC_TIER_PMEM;
+        }
+        else if (heat >= (uint32_t)IPARAM(_HANDLE_HOT_THRESHOLD))
+        {
+            /* DRAM에 자리가 없으면 pmem에 둔다. */
+            if (__atomic_add_fetch(&hheap->dram_used, size, __ATOMIC_RELAXED) <=
+                hheap->dram_budget)
+                target = ALLOC_TIER_DRAM;
+            else
+                __atomic_sub_fetch(&hheap->dram_used, size, __ATOMIC_RELAXED);
+        }
+
+        if (target == entry->tier)
+        {
+            pthread_rwlock_unlock(&hheap->lock);
+            continue;
+        }
+
+        /* pin 되어 있으면 다음 scan에서 다시 본다. 잡은 뒤에는 tb_hfree도
+         * 기다리므로 lock 없이 옮긴다. */
+        unpinned = 0;
+        done = __atomic_compare_exchange_n(&entry->pin_cnt, &unpinned, HHEAP_PIN_MOVING,
+                                           false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&hheap->lock);
+
+        if (done)
+        {
+            done = hheap_move(hheap, entry, target);
+            __atomic_store_n(&entry->pin_cnt, 0, __ATOMIC_RELEASE);
+        }
+        if (!done)
+        {
+            /* DRAM으로 가져오려고 잡아둔 budget을 돌려준다. */
+            if (target == ALLOC_TIER_DRAM)
+                __atomic_sub_fetch(&hheap->dram_used, size, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (target == ALLOC_TIER_PMEM)
+        {
+            __atomic_sub_fetch(&hheap->dram_used, size, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&hheap->demoted, 1, __ATOMIC_RELAXED);
+        }
+        else
+            __atomic_add_fetch(&hheap->promoted, 1, __ATOMIC_RELAXED);
+        moved++;
+    }
+
+    return moved;
+}
+
+static void *hheap_migrate_thread(void *arg)
+{
+    tb_hheap_t *hheap = (tb_hheap_t *)arg;
+    struct timespec ts;
+    uint64_t nsec;
+
+    pthread_mutex_lock(&hheap->stop_mutex);
+    while (!hheap->stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        nsec = ts.tv_nsec + (uint64_t)IPARAM(_HANDLE_MIGRATE_INTERVAL) * 1000000;
+        ts.tv_sec += nsec / 1000000000;
+        ts.tv_nsec = nsec % 1000000000;
+
+        pthread_cond_timedwait(&hheap->stop_cond, &hheap->stop_mutex, &ts);
+        if (hheap->stop)
+            break;
+
+        pthread_mutex_unlock(&hheap->stop_mutex);
+        tb_hheap_migrate(hheap);
+        pthread_mutex_lock(&hheap->stop_mutex);
+    }
+    pthread_mutex_unlock(&hheap->stop_mutex);
+
+    return NULL;
+}
+
+/* end of handle_alloc.c */
@@ -0,0 +1,93 @@
+/**
+ * @file    handle_alloc.h
+ * @brief   handle로 접근하는 객체를 DRAM과 pmem 사이에서 옮기는 allocator
+ *
+ * tb_halloc은 주소 대신 handle을 돌려주고, 객체를 쓸 때마다 tb_hpin으로
+ * 주소를 받고 다 쓰면 tb_hunpin 한다. handle이 가리키는 주소는 DRAM에 있는
+ * indirection table에만 있으므로, pin 되지 않은 객체는 언제든 다른 tier로
+ * 옮길 수 있다.
+ *
+ * tb_hpin은 _HANDLE_SAMPLE_RATE 번에 한 번씩 객체의 heat를 올린다. migration
+ * thread는 _HANDLE_MIGRATE_INTERVAL마다 table을 훑으면서 heat를 반으로 줄이고,
+ *  - DRAM 객체가 _HANDLE_COLD_SCANS 번 연속 접근되지 않았으면 pmem allocator로
+ *  - pmem 객체의 heat가 _HANDLE_HOT_THRESHOLD 이상이면 DRAM budget 안에서 DRAM
+ *    allocator로
+ * 옮긴다. DRAM으로 옮길 자리가 없으면 pmem에 둔다. 옮기는 중인 객체를 pin 하면
+ * 끝날 때까지 기다린다.
+ *
+ * 두 allocator는 다른 thread와 같이 쓰므로 use_mutex로 만들어야 한다.
+ */
+
+#ifndef _HANDLE_ALLOC_H
+#define _HANDLE_ALLOC_H
+
+#include <pthread.h>
+
+#include "allocator.h"
+
+/* 0이면 잘못된 handle. 하위 32 bit는 slot 번호 + 1, 상위 32 bit는 slot을
+ * 다시 쓸 때마다 바뀌는 generation으로 free 된 handle을 걸러낸다. */
+typedef uint64_t tb_handle_t;
+
+#define TB_HANDLE_NULL ((tb_handle_t)0)
+
+/* pin_cnt가 이 값이면 migration thread가 옮기거나 tb_hfree가 free 하는 중이다. */
+#define HHEAP_PIN_MOVING UINT32_MAX
+
+/* table은 segment 단위로 늘린다. segment 0은 HHEAP_SEG0_CNT개, segment k는
+ * HHEAP_SEG0_CNT << (k - 1)개의 entry를 가지며, 한 번 만든 segment는 옮기지
+ * 않으므로 entry의 주소는 lock 없이도 바뀌지 않는다. */
+#define HHEAP_SEG0_SHIFT 10
+#define HHEAP_SEG0_CNT   (1U << HHEAP_SEG0_SHIFT)
+#define HHEAP_MAX_SEGS   22
+
+typedef struct tb_hentry_s
+{
+    void *ptr;             // NULL이면 빈 slot
+    int64_t size;
+    uint32_t gen;
+    uint32_t pin_cnt;      // HHEAP_PIN_MOVING이면 옮기는 중
+    uint32_t heat;         // sampling 된 접근 횟수. scan마다 반으로 줄인다
+    uint16_t idle_scans;   // 접근 없이 지나간 scan 횟수
+    uint8_t tier;          // alloc_tier_t
+    uint32_t next_free;    // 빈 slot list (slot 번호 + 1, 0이면 끝)
+} tb_hentry_t;
+
+typedef struct tb_hheap_s
+{
+    allocator_t *dram_alloc;
+    allocator_t *pmem_alloc;
+    uint64_t dram_budget;
+    uint64_t dram_used;          // DRAM에 있는 객체 크기의 합
+
+    /* table을 늘리거나 slot을 할당/반납할 때는 write lock, handle로 entry를
+     * 찾을 때는 read lock을 잡는다. 객체를 복사하는 동안에는 잡지 않는다. */
+    pthread_rwlock_t lock;
+    tb_hentry_t *segs[HHEAP_MAX_SEGS];
+    int seg_cnt;
+    uint32_t table_cnt;          // segs에 있는 entry 개수
+    uint32_t free_head;          // 빈 slot list (slot 번호 + 1)
+
+    pthread_t thread;
+    tb_bool_t thread_running;
+    tb_bool_t stop;
+    pthread_mutex_t stop_mutex;
+    pthread_cond_t stop_cond;
+
+    uint64_t demoted;            // pmem으로 옮긴 횟수
+    uint64_t promoted;           // DRAM으로 옮긴 횟수
+} tb_hheap_t;
+
+/* dram_budget이 0이면 _HYBRID_DRAM_BUDGET을 쓴다. */
+tb_hheap_t *tb_hheap_new(allocator_t *dram_alloc, allocator_t *pmem_alloc,
+                         uint64_t dram_budget);
+void tb_hheap_delete(tb_hheap_t *hheap);
+int tb_hheap_migrate(tb_hheap_t *hheap);
+
+tb_handle_t tb_halloc(tb_hheap_t *hheap, int64_t bytes);
+void tb_hfree(tb_hheap_t *hheap, tb_handle_t handle);
+void *tb_hpin(tb_hheap_t *hheap, tb_handle_t handle);
+void tb_hunpin(tb_hheap_t *hheap, tb_handle_t handle);
+alloc_tier_t tb_htier(tb_hheap_t *hheap, tb_handle_t handle);
+
+#endif /* _HANDLE_ALLOC_H */
@@ -20,10 +20,31 @@ uint64_t IPARAM(_REGION_ALLOC_MIN_EXPAND_UPPER_BOUND) = 1048576;
 
 tb_bool_t IPARAM(_FORCE_NATIVE_ALLOC_USE) = false;
 
+uint64_t IPARAM(_HYBRID_DRAM_BUDGET) = 64 * 1024 * 1024;
+
+int IPARAM(_HANDLE_MIGRATE_INTERVAL) = 100;
+int IPARAM(_HANDLE_SAMPLE_RATE) = 16;
+int IPARAM(_HANDLE_HOT_THRESHOLD) = 4;
+int IPARAM(_HANDLE_COLD_SCANS) = 4;
+
 /* unlimited */
 uint64_t IPARAM(_MAX_REQ_MEMORY_SIZE) = 0;
 
 
 char *IPARAM(PMEM_DIR) = "/pmem/tmp";
+char *IPARAM(PMEM_POOL_NAME) = NULL;
+int IPARAM(_PMEM_STRIPE_POLICY) = 0;
 uint64_t IPARAM(PMEM_MAX_SIZE) = 1024 * 1024 * 1024;
-uint64_t IPARAM(PMEM_ALLOC_SIZE) = 1024 * 1024 * 1024;
\ No newline at end of file
+uint64_t IPARAM(PMEM_ALLOC_SIZE) = 1024 * 1024 * 1024;
+int IPARAM(_PMEM_PREFAULT_THREADS) = 0;
+uint64_t IPARAM(_PMEM_MAP_ALIGN) = 2 * 1024 * 1024;
+uint64_t IPARAM(_PMEM_NT_STORE_MIN_SIZE) = 4096;
+int IPARAM(_PMEM_BUDDY_MIN_SHIFT) = 0;
+int IPARAM(_PMEM_BUDDY_MAX_SHIFT) = 0;
+int IPARAM(_PMEM_ARENA_CNT) = 0;
+uint64_t IPARAM(_PMEM_ARENA_MIN_SIZE) = 16 * 1024 * 1024;
+uint64_t IPARAM(_PMEM_PUNCH_MIN_SIZE) = 0;
+uint64_t IPARAM(_PMEM_PUNCH_AGE) = 60;
+tb_bool_t IPARAM(_PMEM_PUNCH_EAGER_REFAULT) = false;
+int IPARAM(_PMEM_MAGAZINE_DEPTH) = 8;
+uint64_t IPARAM(_PMEM_MAGAZINE_MAX_CHUNKSIZE) = 1024 * 1024;
\ No newline at end of file
@@ -31,15 +31,63 @@ extern uint64_t IPARAM(_REGION_ALLOC_MIN_EXPAND_UPPER_BOUND);
 /* root allocator를 사용하더라도 mmap을 사용하지 않고 malloc을 통해 메모리를 받아올지 결정 */
 extern tb_bool_t IPARAM(_FORCE_NATIVE_ALLOC_USE);
 
+/* hybrid region allocator가 DRAM에서 받을 region 크기의 기본 상한.
+ * 넘으면 pmem pool에서 받는다 */
+extern uint64_t IPARAM(_HYBRID_DRAM_BUDGET);
+
+/* handle allocator의 migration thread가 table을 훑는 간격 (ms, 0이면 thread 없이
+ * tb_hheap_migrate를 부를 때만 옮긴다) */
+extern int IPARAM(_HANDLE_MIGRATE_INTERVAL);
+/* tb_hpin 몇 번에 한 번씩 heat를 올릴지 (1이면 매번) */
+extern int IPARAM(_HANDLE_SAMPLE_RATE);
+/* pmem에 있는 객체를 DRAM으로 옮길 heat */
+extern int IPARAM(_HANDLE_HOT_THRESHOLD);
+/* DRAM에 있는 객체를 이 횟수의 scan 동안 접근하지 않으면 pmem으로 옮긴다 */
+extern int IPARAM(_HANDLE_COLD_SCANS);
+
 /* region allocator들의 최대 요청 사이즈 */
 extern uint64_t IPARAM(_MAX_REQ_MEMORY_SIZE);
 
 /* PMEM */
-/* pmem directory */
+/* pmem directory. ','로 여러 개를 주면 pool을 directory마다 만들고 region을
+ * 번갈아 가며 배치한다 (striping, PMEM_POOL_NAME과 같이 쓸 수 없다) */
 extern char *IPARAM(PMEM_DIR);
+/* pmem pool 파일 이름. 지정하면 종료 후에도 파일이 남고 다음 init에서 다시 연다 */
+extern char *IPARAM(PMEM_POOL_NAME);
+/* striping할 때 region을 둘 pool을 고르는 방법 (0: round-robin, 1: free 공간이 가장 큰 pool) */
+extern int IPARAM(_PMEM_STRIPE_POLICY);
 /* pmem 최대 할당 크기 */
 extern uint64_t IPARAM(PMEM_MAX_SIZE);
 /* 사용 가능한 pmem의 최대 크기 */
 extern uint64_t IPARAM(PMEM_ALLOC_SIZE);
+/* pool을 열 때 파일 block을 미리 잡고(fallocate) mapping 전체를 prefault 할
+ * thread 개수 (0이면 하지 않고 처음 접근할 때 page fault가 난다) */
+extern int IPARAM(_PMEM_PREFAULT_THREADS);
+/* pmem mapping과 arena 경계를 맞출 단위 (2M, 1G 등 2^n). DAX에서 PMD/PUD
+ * 크기의 page fault가 나도록 한다. BUDDY_PAGESIZE 이하이면 맞추지 않는다 */
+extern uint64_t IPARAM(_PMEM_MAP_ALIGN);
+/* pmem에 calloc/realloc 할 때 이 크기 이상이면 non-temporal store로 채우거나 복사한다
+ * (0이면 사용 안 함) */
+extern uint64_t IPARAM(_PMEM_NT_STORE_MIN_SIZE);
+/* pmem buddy의 최소 order, 즉 할당 단위 (0이면 12 -> 4K, ex. 16 -> 64K, 21 -> 2M).
+ * 큰 region만 받는 pool이면 크게 잡아서 bitmap과 free list 작업을 줄인다 */
+extern int IPARAM(_PMEM_BUDDY_MIN_SHIFT);
+/* pmem buddy의 최대 order (0이면 arena 크기에 맞춘다, ex. 30 -> 최대 1G chunk) */
+extern int IPARAM(_PMEM_BUDDY_MAX_SHIFT);
+/* pmem pool을 나눌 arena 개수 (0이면 CPU 개수) */
+extern int IPARAM(_PMEM_ARENA_CNT);
+/* arena 하나의 최소 크기. pool이 작으면 arena 개수를 줄인다 */
+extern uint64_t IPARAM(_PMEM_ARENA_MIN_SIZE);
+/* 이 크기 이상의 free chunk는 pmem 파일에서 punch 해서 filesystem에 돌려준다
+ * (0이면 사용 안 함) */
+extern uint64_t IPARAM(_PMEM_PUNCH_MIN_SIZE);
+/* free 된 뒤 이 시간(초)이 지난 chunk만 punch 한다 */
+extern uint64_t IPARAM(_PMEM_PUNCH_AGE);
+/* punch 된 chunk를 다시 줄 때 미리 block을 잡아둘지 (false면 page fault 시) */
+extern tb_bool_t IPARAM(_PMEM_PUNCH_EAGER_REFAULT);
+/* pmem buddy의 thread magazine이 order별로 보관하는 chunk 개수 (0이면 사용 안 함) */
+extern int IPARAM(_PMEM_MAGAZINE_DEPTH);
+/* thread magazine을 사용하는 최대 chunk 크기 */
+extern uint64_t IPARAM(_PMEM_MAGAZINE_MAX_CHUNKSIZE);
 
 #endif /* _IPARAM_H */
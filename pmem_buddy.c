@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
@@ -8,26 +9,291 @@
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 
+#include "iparam.h"
 #include "pmem_buddy.h"
+#include "pmem_persist.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+pbuddy_pool_t *PBUDDY_POOL = NULL;
+
+/* thread별 home arena 번호. pool마다 arena 개수가 다르므로 번호만 정해두고
+ * arena_cnt로 나눈 나머지를 쓴다. */
+static uint32_t PBUDDY_ARENA_TICKET = 0;
+static __thread int pbuddy_thread_ticket = -1;
+
+static void pbuddy_redo_replay(pbuddy_pool_t *pool);
+
+static inline int pbuddy_thread_id(void)
+{
+    if (pbuddy_thread_ticket < 0)
+        pbuddy_thread_ticket =
+            (int)(__atomic_fetch_add(&PBUDDY_ARENA_TICKET, 1, __ATOMIC_RELAXED) & INT_MAX);
+
+    return pbuddy_thread_ticket;
+}
+
+static inline int pbuddy_home_arena(pbuddy_pool_t *pool)
+{
+    return pbuddy_thread_id() % pool->arena_cnt;
+}
+
+static void pbuddy_setup_magazine(pbuddy_alloc_t *alloc)
+{
+    uint64_t chunk_size;
+
+    /* region 확장에 주로 쓰이는 작은 chunk들은 thread magazine을 거치게 한다. */
+    for (chunk_size = BUDDY_PAGESIZE;
+         chunk_size <= IPARAM(_PMEM_MAGAZINE_MAX_CHUNKSIZE) &&
+         chunk_size <= BUDDY_MAX_CHUNKSIZE;
+         chunk_size <<= 1)
+        buddy_set_magazine_depth(alloc, chunk_size, IPARAM(_PMEM_MAGAZINE_DEPTH));
+}
+
+/* free chunk를 파일에서 punch 하도록 arena들을 설정한다. */
+static void pbuddy_setup_punch(pbuddy_pool_t *pool)
+{
+    int i;
+
+    if (IPARAM(_PMEM_PUNCH_MIN_SIZE) == 0)
+        return;
+
+    for (i = 0; i < pool->arena_cnt; i++)
+        buddy_set_punch(pool->arenas[i], pool->fd,
+                        (pool->page_start - pool->map_addr) + i * pool->arena_size,
+                        IPARAM(_PMEM_PUNCH_MIN_SIZE), IPARAM(_PMEM_PUNCH_AGE),
+                        IPARAM(_PMEM_PUNCH_EAGER_REFAULT));
+}
+
+typedef struct pbuddy_prefault_arg_s
+{
+    char *addr;
+    uint64_t size;
+} pbuddy_prefault_arg_t;
+
+static void *pbuddy_prefault_thread(void *args)
+{
+    pbuddy_prefault_arg_t *arg = (pbuddy_prefault_arg_t *)args;
+    volatile char *page;
+
+    /* 내용을 바꾸지 않고 쓰기 가능한 page로 채운다. 지원하지 않는 kernel이면
+     * page마다 같은 값을 다시 써서 fault를 낸다. */
+    if (madvise(arg->addr, arg->size, MADV_POPULATE_WRITE) == 0)
+        return NULL;
+
+    for (page = arg->addr; page < arg->addr + arg->size; page += BUDDY_PAGESIZE)
+        *page = *page;
+
+    return NULL;
+}
 
-pbuddy_alloc_t *PBUDDY_ALLOC = NULL;
 /**
- * @brief Initialize pmem allocator.
+ * @brief pool 파일의 block을 미리 할당하고 mapping 전체를 prefault 한다.
  *
- * @param[in] dir
- * @param base_ptr Base address of the allocator. If NULL, it will be allocated.
- * @param max_size Size of the pool.
- * @param size
- * @return pbuddy_alloc_t* Pointer to the allocator.
+ * 처음 쓰는 region마다 page fault와 filesystem block 할당이 할당 경로 안에서
+ * 일어나지 않도록, pool을 열 때 _PMEM_PREFAULT_THREADS 개의 thread로 나눠서
+ * 한꺼번에 처리한다. 실패해도 pool은 그대로 쓸 수 있으므로 메시지만 남긴다.
  */
-pbuddy_alloc_t *pbuddy_alloc_init(const char *dir, void *base_ptr, size_t max_size, size_t size)
+static void pbuddy_prefault(int fd, char *addr, uint64_t size)
 {
-    int fd;
-    void *addr;
+    pbuddy_prefault_arg_t args[PBUDDY_MAX_ARENAS];
+    pthread_t tids[PBUDDY_MAX_ARENAS];
+    bool started[PBUDDY_MAX_ARENAS];
+    uint64_t slice;
+    int thr_cnt, i;
+
+    thr_cnt = MIN(IPARAM(_PMEM_PREFAULT_THREADS), PBUDDY_MAX_ARENAS);
+    if (thr_cnt <= 0)
+        return;
+
+    if (fallocate(fd, 0, 0, size))
+        printf("fallocate failed (errno:%d, %s)\n", errno, strerror(errno));
+
+    /* 2M 단위로 잘라서 thread 사이에 huge page가 쪼개지지 않게 한다. */
+    slice = ((size / thr_cnt) + (2UL << 20) - 1) & ~((2UL << 20) - 1);
+    for (i = 0; i < thr_cnt; i++)
+    {
+        args[i].addr = addr + MIN(i * slice, size);
+        args[i].size = MIN(slice, size - MIN(i * slice, size));
+        started[i] = (args[i].size > 0 &&
+                      pthread_create(&tids[i], NULL, pbuddy_prefault_thread, &args[i]) == 0);
+        if (!started[i] && args[i].size > 0)
+            pbuddy_prefault_thread(&args[i]);
+    }
+
+    for (i = 0; i < thr_cnt; i++)
+    {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+/* mapping과 arena 경계를 맞출 단위. arena가 그보다 작으면 page 단위로 둔다. */
+static uint64_t pbuddy_map_align(uint64_t arena_size)
+{
+    uint64_t align = IPARAM(_PMEM_MAP_ALIGN);
+
+    if (align <= BUDDY_PAGESIZE || (align & (align - 1)) != 0 || arena_size < align)
+        return BUDDY_PAGESIZE;
+
+    return align;
+}
+
+/**
+ * @brief pool 파일을 mapping 한다.
+ *
+ * 주소를 지정하지 않으면 _PMEM_MAP_ALIGN 만큼 더 큰 가상 주소 영역을 잡아서
+ * 정렬된 위치에 파일을 MAP_FIXED로 올리고 남는 앞뒤 영역을 돌려준다. 그래야
+ * DAX filesystem이 2M/1G 단위로 mapping 해서 TLB miss가 줄어든다.
+ *
+ * volatile pool은 내용이 남을 필요가 없으므로 MAP_SYNC 없이 올린다.
+ * persistent pool인데 DAX가 아니어서 MAP_SYNC를 쓸 수 없으면 일반 shared
+ * mapping으로 올리고, 이 mapping은 msync로 persist 하도록 *persist에
+ * 알려준다. 다른 pool의 persist 방식에는 영향이 없다.
+ */
+static char *pbuddy_map_file(void *base_ptr, uint64_t size, int fd, int mode,
+                             int *persist)
+{
+    uint64_t align = pbuddy_map_align(size);
+    char *resv = MAP_FAILED, *addr, *end;
+    int flags;
+
+#if defined(PMEM_TEST)
+    flags = MAP_SHARED;
+#else
+    if (mode == PBUDDY_POOL_PERSISTENT)
+        flags = MAP_SHARED_VALIDATE | MAP_SYNC;
+    else
+        flags = MAP_SHARED;
+#endif
+
+    if (base_ptr == NULL && align > BUDDY_PAGESIZE)
+    {
+        resv = mmap(NULL, size + align, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (resv != MAP_FAILED)
+        {
+            base_ptr = (void *)(((uintptr_t)resv + align - 1) & ~(align - 1));
+            flags |= MAP_FIXED;
+        }
+    }
+
+    if (mode == PBUDDY_POOL_PERSISTENT)
+        *persist = (flags & MAP_SYNC) ? TB_PERSIST_CPU : TB_PERSIST_MSYNC;
+    else
+        *persist = TB_PERSIST_NONE;
+
+    addr = mmap(base_ptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+#if !defined(PMEM_TEST)
+    if (addr == MAP_FAILED && errno == EOPNOTSUPP && mode == PBUDDY_POOL_PERSISTENT)
+    {
+        printf("pmem file is not on a DAX filesystem, falling back to msync\n");
+        flags = (flags & ~(MAP_SHARED_VALIDATE | MAP_SYNC)) | MAP_SHARED;
+        addr = mmap(base_ptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        *persist = TB_PERSIST_MSYNC;
+    }
+#endif
+
+    if (resv != MAP_FAILED)
+    {
+        if (addr == MAP_FAILED)
+            munmap(resv, size + align);
+        else
+        {
+            end = resv + size + align;
+            if (addr > resv)
+                munmap(resv, addr - resv);
+            if (addr + size < end)
+                munmap(addr + size, end - (addr + size));
+        }
+    }
+
+    return addr;
+}
+
+/* pages_size 만큼의 page 영역을 몇 개(max_cnt 이하)의 arena로 나눌지 정한다. */
+static int pbuddy_arena_count(uint64_t pages_size, int max_cnt)
+{
+    int64_t cnt;
+    uint64_t min_size;
+
+    cnt = IPARAM(_PMEM_ARENA_CNT);
+    if (cnt <= 0)
+        cnt = sysconf(_SC_NPROCESSORS_ONLN);
+
+    min_size = MAX(IPARAM(_PMEM_ARENA_MIN_SIZE), BUDDY_PAGESIZE);
+    cnt = MIN(cnt, (int64_t)(pages_size / min_size));
+    cnt = MIN(cnt, max_cnt);
+
+    return (int)MAX(cnt, 1);
+}
+
+/* fd는 hole punching에 쓰므로 pool이 닫힐 때까지 열어둔다. */
+static pbuddy_pool_t *pbuddy_pool_new(char *file_fullpath, int fd, char *map_addr,
+                                      uint64_t map_size, char *page_start,
+                                      uint64_t arena_size, int arena_cnt)
+{
+    pbuddy_pool_t *pool;
+    int i;
+
+    pool = (pbuddy_pool_t *)calloc(1, sizeof(pbuddy_pool_t));
+    if (pool == NULL)
+        return NULL;
+
+    pool->file_fullpath = file_fullpath;
+    pool->fd = fd;
+    pool->map_addr = map_addr;
+    pool->map_size = map_size;
+    pool->page_start = page_start;
+    pool->arena_size = arena_size;
+    pool->arena_cnt = arena_cnt;
+
+    for (i = 0; i < PBUDDY_REDO_LOGS; i++)
+        pthread_mutex_init(&pool->log_mutex[i], NULL);
+
+    return pool;
+}
+
+/* arena들을 정리하고 pool 구조체를 해제한다. mapping과 파일은 건드리지 않는다. */
+static void pbuddy_pool_delete(pbuddy_pool_t *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        if (pool->arenas[i] != NULL)
+            buddy_allocator_delete(pool->arenas[i]);
+    }
+
+    for (i = 0; i < PBUDDY_REDO_LOGS; i++)
+        pthread_mutex_destroy(&pool->log_mutex[i]);
+
+    free(pool);
+}
+
+/* arena 하나에서 처음에 쓸 수 있는 크기 */
+static uint64_t pbuddy_arena_avail(uint64_t size, uint64_t arena_size, int arena_cnt)
+{
+    return MIN(arena_size, (size / arena_cnt) & ~(BUDDY_PAGESIZE - 1));
+}
+
+/* dir에 임시 파일을 만들어 pool을 생성한다. 파일은 pool을 닫을 때 지운다. */
+static pbuddy_pool_t *pbuddy_pool_create(const char *dir, void *base_ptr,
+                                         uint64_t max_size, uint64_t size,
+                                         int max_arenas)
+{
+    int fd = -1, persist;
+    char *addr = MAP_FAILED;
     static char template[] = "/pmem.XXXXXX";
     int dir_len;
     char *file_fullpath;
+    pbuddy_pool_t *pool = NULL;
+    uint64_t arena_size;
+    int arena_cnt, i;
 
     dir_len = strlen(dir);
 
@@ -64,58 +330,1129 @@ pbuddy_alloc_t *pbuddy_alloc_init(const char *dir, void *base_ptr, size_t max_si
     }
 
     // 파일을 메모리에 매핑한다.
-#if defined(PMEM_TEST)
-    addr = mmap(base_ptr, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-#else
-    addr = mmap(base_ptr, max_size, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
-#endif
+    addr = pbuddy_map_file(base_ptr, max_size, fd, PBUDDY_POOL_VOLATILE, &persist);
     if (addr == MAP_FAILED)
     {
         printf("mmap failed(errno:%d, %s)\n", errno, strerror(errno));
         goto exit;
     }
-    close(fd);
-    PBUDDY_ALLOC = buddy_allocator_new(addr, max_size, size, file_fullpath);
-    if (PBUDDY_ALLOC == NULL)
-    {
-        printf("buddy_allocator_new failed\n");
+    pbuddy_prefault(fd, addr, max_size);
+
+    arena_cnt = pbuddy_arena_count(max_size, max_arenas);
+    arena_size = max_size / arena_cnt;
+    arena_size &= ~(pbuddy_map_align(arena_size) - 1);
+
+    pool = pbuddy_pool_new(file_fullpath, fd, addr, max_size, addr, arena_size, arena_cnt);
+    if (pool == NULL)
         goto exit;
+    pool->persist = persist;
+
+    for (i = 0; i < arena_cnt; i++)
+    {
+        pool->arenas[i] = buddy_allocator_new(addr + i * arena_size, arena_size,
+                                              pbuddy_arena_avail(size, arena_size, arena_cnt),
+                                              IPARAM(_PMEM_BUDDY_MIN_SHIFT),
+                                              IPARAM(_PMEM_BUDDY_MAX_SHIFT), file_fullpath);
+        if (pool->arenas[i] == NULL)
+        {
+            printf("buddy_allocator_new failed\n");
+            goto exit;
+        }
+        pbuddy_setup_magazine(pool->arenas[i]);
     }
+    pbuddy_setup_punch(pool);
 
-    return PBUDDY_ALLOC;
+    return pool;
 
 exit:
+    if (pool != NULL)
+        pbuddy_pool_delete(pool);
+    if (addr != MAP_FAILED)
+        munmap(addr, max_size);
     if (fd != -1)
         (void)close(fd);
     if (file_fullpath != NULL)
+    {
+        unlink(file_fullpath);
         free(file_fullpath);
+    }
     return NULL;
 }
 
+/**
+ * @brief Initialize pmem allocator.
+ *
+ * 기본 pool(PBUDDY_POOL)을 만든다. pbuddy_malloc/pbuddy_free와
+ * region_pallocator_new로 만든 allocator는 이 pool을 쓴다.
+ *
+ * @param[in] dir
+ * @param base_ptr Base address of the allocator. If NULL, it will be allocated.
+ * @param max_size Size of the pool.
+ * @param size
+ * @return pbuddy_pool_t* Pointer to the pool.
+ */
+pbuddy_pool_t *pbuddy_alloc_init(const char *dir, void *base_ptr, uint64_t max_size, uint64_t size)
+{
+    const char *dirs[PBUDDY_MAX_STRIPES];
+    char *dir_list, *token, *saveptr;
+    int dir_cnt = 0;
+
+    if (strchr(dir, ',') == NULL)
+    {
+        PBUDDY_POOL = pbuddy_pool_create(dir, base_ptr, max_size, size, PBUDDY_MAX_ARENAS);
+        return PBUDDY_POOL;
+    }
+
+    /* "dir1,dir2,..." 이면 max_size를 directory 개수로 나눠 striped pool을 만든다. */
+    dir_list = strdup(dir);
+    if (dir_list == NULL)
+        return NULL;
+
+    for (token = strtok_r(dir_list, ",", &saveptr); token != NULL;
+         token = strtok_r(NULL, ",", &saveptr))
+    {
+        if (dir_cnt == PBUDDY_MAX_STRIPES)
+        {
+            printf("too many pmem directories (max %d)\n", PBUDDY_MAX_STRIPES);
+            free(dir_list);
+            return NULL;
+        }
+        dirs[dir_cnt++] = token;
+    }
+
+    if (dir_cnt > 0)
+        PBUDDY_POOL = pbuddy_pool_open_striped(dirs, dir_cnt,
+                                               (max_size / dir_cnt) & ~(BUDDY_PAGESIZE - 1));
+    free(dir_list);
+
+    return PBUDDY_POOL;
+}
+
+/**
+ * @brief 기본 pool과 별개인 pool을 하나 더 만든다.
+ *
+ * DAX namespace나 socket마다 pool을 따로 두려면 각 device의 dir로 pool을
+ * 열고, region_pallocator_new_pool로 그 pool을 쓰는 allocator를 만든다.
+ * pbuddy_pool_malloc/pbuddy_pool_free 등 pool을 받는 함수는 모두 쓸 수 있다.
+ * 파일은 임시 파일이며 pbuddy_pool_close에서 지운다.
+ *
+ * @param[in] dir   pool 파일을 만들 directory
+ * @param size      pool 크기 (전부 buddy_malloc으로 쓸 수 있다)
+ * @return pool, 실패하면 NULL
+ */
+pbuddy_pool_t *pbuddy_pool_open(const char *dir, uint64_t size)
+{
+    return pbuddy_pool_create(dir, NULL, size, size, PBUDDY_MAX_ARENAS);
+}
+
+/**
+ * @brief directory마다 pool을 만들고 하나의 striped pool로 묶는다.
+ *
+ * pbuddy_pool_malloc은 할당마다 member pool을 하나 골라서 받아오므로, region
+ * allocator의 region들이 여러 device에 흩어져 전체 bandwidth를 쓰게 된다.
+ * member마다 arena를 따로 가지며, arena 개수는 합쳐서 PBUDDY_MAX_ARENAS를
+ * 넘지 않게 나눈다.
+ *
+ * @param[in] dirs      pool 파일을 만들 directory들
+ * @param dir_cnt       directory 개수 (PBUDDY_MAX_STRIPES 이하)
+ * @param size          member pool 하나의 크기
+ * @return pool, 실패하면 NULL
+ */
+pbuddy_pool_t *pbuddy_pool_open_striped(const char **dirs, int dir_cnt, uint64_t size)
+{
+    pbuddy_pool_t *pool, *member;
+    int i, j;
+
+    if (dir_cnt <= 0 || dir_cnt > PBUDDY_MAX_STRIPES)
+    {
+        printf("pbuddy_pool_open_striped: invalid directory count (%d)\n", dir_cnt);
+        return NULL;
+    }
+
+    pool = (pbuddy_pool_t *)calloc(1, sizeof(pbuddy_pool_t));
+    if (pool == NULL)
+        return NULL;
+    pool->fd = -1;
+
+    for (i = 0; i < dir_cnt; i++)
+    {
+        member = pbuddy_pool_create(dirs[i], NULL, size, size,
+                                    PBUDDY_MAX_ARENAS / dir_cnt);
+        if (member == NULL)
+        {
+            printf("pbuddy_pool_open_striped: could not create pool in %s\n", dirs[i]);
+            pbuddy_pool_close(pool);
+            return NULL;
+        }
+
+        pool->stripes[pool->stripe_cnt++] = member;
+        for (j = 0; j < member->arena_cnt; j++)
+            pool->arenas[pool->arena_cnt++] = member->arenas[j];
+    }
+
+    return pool;
+}
+
+/* 다음 할당을 받아올 member pool의 번호 */
+static int pbuddy_stripe_pick(pbuddy_pool_t *pool)
+{
+    pbuddy_pool_t *member;
+    uint64_t free_size, best_size = 0;
+    int best = 0, i, j;
+
+    if (IPARAM(_PMEM_STRIPE_POLICY) != PBUDDY_STRIPE_MOST_FREE)
+        return (int)(__atomic_fetch_add(&pool->stripe_next, 1, __ATOMIC_RELAXED) %
+                     pool->stripe_cnt);
+
+    /* lock 없이 읽으므로 대략적인 값이지만, 배치를 고르는 데는 충분하다. */
+    for (i = 0; i < pool->stripe_cnt; i++)
+    {
+        member = pool->stripes[i];
+        free_size = 0;
+        for (j = 0; j < member->arena_cnt; j++)
+            free_size += member->arenas[j]->available_size - member->arenas[j]->total_used;
+
+        if (free_size > best_size)
+        {
+            best_size = free_size;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+/* 고른 member pool에서 먼저 받고, 실패하면 나머지 member에서 받는다. */
+static void *pbuddy_stripe_malloc(pbuddy_pool_t *pool, uint64_t size, bool exact)
+{
+    pbuddy_pool_t *member;
+    void *ptr = NULL;
+    int first, i;
+
+    first = pbuddy_stripe_pick(pool);
+    for (i = 0; ptr == NULL && i < pool->stripe_cnt; i++)
+    {
+        member = pool->stripes[(first + i) % pool->stripe_cnt];
+        if (exact)
+            ptr = pbuddy_pool_malloc_exact(member, size);
+        else
+            ptr = pbuddy_pool_malloc(member, size);
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Open (or create) a named pmem pool.
+ *
+ * dir/name 파일이 없으면 새로 만들고, 있으면 superblock을 확인한 뒤 그대로
+ * 다시 연다. arena header와 bitmap이 파일 안에 있으므로, 재시작 후에도
+ * 이전에 할당했던 chunk들의 내용과 할당 상태가 유지된다.
+ * 다시 열 때는 이전에 mapping 했던 주소를 우선 시도하며, 다른 주소에
+ * mapping 되더라도 pbuddy_get_root는 offset으로 찾으므로 문제없다.
+ * arena 개수는 만들 때 정해지며, 다시 열 때는 파일에 기록된 값을 쓴다.
+ *
+ * @param[in] dir
+ * @param[in] name      pool 파일 이름
+ * @param base_ptr      Base address of the pool. If NULL, the previous one is tried.
+ * @param max_size      Size of the pool file (새로 만들 때만 사용).
+ * @param size          buddy_malloc으로 쓸 수 있는 크기 (새로 만들 때만 사용).
+ * @return pbuddy_pool_t* Pointer to the pool.
+ */
+pbuddy_pool_t *pbuddy_pool_open_named(const char *dir, const char *name, void *base_ptr,
+                                      uint64_t max_size, uint64_t size)
+{
+    int fd = -1, persist;
+    char *addr = MAP_FAILED;
+    char *file_fullpath;
+    pbuddy_superblock_t sb, *sbp;
+    pbuddy_pool_t *pool = NULL;
+    bool created = false;
+    uint64_t arena_size, meta_stride, page_offset, align;
+    uint64_t recovered = 0;
+    int arena_cnt, i;
+
+    if (access(dir, F_OK))
+        return NULL;
+
+    if (strlen(dir) + strlen(name) + 1 > PATH_MAX)
+    {
+        printf("Could not open pool file: too long path.");
+        return NULL;
+    }
+
+    file_fullpath = malloc(strlen(dir) + strlen(name) + 2);
+    if (file_fullpath == NULL)
+    {
+        printf("file patch malloc failed\n");
+        return NULL;
+    }
+    sprintf(file_fullpath, "%s/%s", dir, name);
+
+    if ((fd = open(file_fullpath, O_RDWR)) >= 0)
+    {
+        if (pread(fd, &sb, sizeof(sb), 0) != sizeof(sb) ||
+            sb.magic != PBUDDY_POOL_MAGIC || sb.version != PBUDDY_POOL_VERSION ||
+            sb.arena_cnt == 0 || sb.arena_cnt > PBUDDY_MAX_ARENAS)
+        {
+            printf("invalid pmem pool file (%s)\n", file_fullpath);
+            goto exit;
+        }
+
+        max_size = sb.pool_size;
+        if (base_ptr == NULL)
+            base_ptr = (void *)sb.base_addr;
+    }
+    else if (errno == ENOENT)
+    {
+        if ((fd = open(file_fullpath, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        {
+            printf("Could not create pool file (errno:%d, %s)\n", errno, strerror(errno));
+            goto exit;
+        }
+        created = true;
+
+        if (ftruncate(fd, max_size)) // 파일의 크기 설정
+        {
+            printf("ftruncate failed\n");
+            goto exit;
+        }
+    }
+    else
+    {
+        printf("Could not open pool file (errno:%d, %s)\n", errno, strerror(errno));
+        goto exit;
+    }
+
+    addr = pbuddy_map_file(base_ptr, max_size, fd, PBUDDY_POOL_PERSISTENT, &persist);
+    if (addr == MAP_FAILED)
+    {
+        printf("mmap failed(errno:%d, %s)\n", errno, strerror(errno));
+        goto exit;
+    }
+    pbuddy_prefault(fd, addr, max_size);
+
+    sbp = (pbuddy_superblock_t *)addr;
+
+    if (created)
+    {
+        /* arena header의 크기가 arena 크기에 따라 달라지므로, 전체 크기로
+         * 넉넉히 잡은 뒤 남는 page 영역을 나눈다. */
+        arena_cnt = pbuddy_arena_count(max_size, PBUDDY_MAX_ARENAS);
+        meta_stride = (buddy_allocator_metasize(max_size / arena_cnt,
+                                                IPARAM(_PMEM_BUDDY_MIN_SHIFT),
+                                                IPARAM(_PMEM_BUDDY_MAX_SHIFT)) +
+                       BUDDY_PAGESIZE - 1) &
+                      ~(BUDDY_PAGESIZE - 1);
+        page_offset = 2 * BUDDY_PAGESIZE + arena_cnt * meta_stride;
+
+        if (page_offset + arena_cnt * BUDDY_PAGESIZE > max_size)
+        {
+            printf("pmem pool is too small\n");
+            goto exit;
+        }
+
+        /* page 영역의 file offset과 arena 경계를 mapping 단위에 맞춘다. */
+        align = pbuddy_map_align((max_size - page_offset) / arena_cnt);
+        page_offset = (page_offset + align - 1) & ~(align - 1);
+        arena_size = (page_offset < max_size) ?
+                     ((max_size - page_offset) / arena_cnt) & ~(align - 1) : 0;
+        if (arena_size == 0)
+        {
+            printf("pmem pool is too small\n");
+            goto exit;
+        }
+
+        sbp->pool_size = max_size;
+        sbp->log_offset = BUDDY_PAGESIZE;
+        sbp->meta_offset = 2 * BUDDY_PAGESIZE;
+        sbp->meta_stride = meta_stride;
+        sbp->page_offset = page_offset;
+        sbp->arena_size = arena_size;
+        sbp->arena_cnt = arena_cnt;
+        sbp->root_offset = 0;
+    }
+
+    pool = pbuddy_pool_new(file_fullpath, fd, addr, max_size, addr + sbp->page_offset,
+                           sbp->arena_size, sbp->arena_cnt);
+    if (pool == NULL)
+        goto exit;
+    pool->sb = sbp;
+    pool->mode = PBUDDY_POOL_PERSISTENT;
+    pool->persist = persist;
+    pool->logs = (pbuddy_redo_log_t *)(addr + sbp->log_offset);
+
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        void *meta = addr + sbp->meta_offset + i * sbp->meta_stride;
+        void *page_start = pool->page_start + i * pool->arena_size;
+
+        if (created)
+            pool->arenas[i] = buddy_allocator_init(meta, page_start, pool->arena_size,
+                                                   pbuddy_arena_avail(size, pool->arena_size,
+                                                                      pool->arena_cnt),
+                                                   IPARAM(_PMEM_BUDDY_MIN_SHIFT),
+                                                   IPARAM(_PMEM_BUDDY_MAX_SHIFT),
+                                                   file_fullpath);
+        else
+            pool->arenas[i] = buddy_allocator_attach(meta, page_start, file_fullpath);
+        buddy_set_persist(pool->arenas[i], pool->persist);
+    }
+
+    /* 정상 종료되지 않았으면 redo log를 order map에 반영한 뒤, order map에
+     * 남은 할당만 살려서 다시 만든다. */
+    if (!created && !sbp->clean)
+    {
+        pbuddy_redo_replay(pool);
+        for (i = 0; i < pool->arena_cnt; i++)
+            recovered += buddy_allocator_recover(pool->arenas[i]);
+        printf("pmem pool (%s) was not closed cleanly, recovered %zu bytes\n",
+               file_fullpath, recovered);
+    }
+
+    for (i = 0; i < pool->arena_cnt; i++)
+        pbuddy_setup_magazine(pool->arenas[i]);
+    pbuddy_setup_punch(pool);
+
+    if (created)
+    {
+        /* 나머지가 모두 기록된 뒤에 magic을 쓴다. */
+        sbp->version = PBUDDY_POOL_VERSION;
+        pbuddy_pool_persist(pool, addr, sbp->page_offset);
+        sbp->magic = PBUDDY_POOL_MAGIC;
+    }
+
+    sbp->base_addr = (uint64_t)addr;
+    sbp->clean = 0;
+    pbuddy_pool_persist(pool, sbp, sizeof(pbuddy_superblock_t));
+
+    return pool;
+
+exit:
+    if (pool != NULL)
+        pbuddy_pool_delete(pool);
+    if (addr != MAP_FAILED)
+        munmap(addr, max_size);
+    if (fd != -1)
+        (void)close(fd);
+    if (created)
+        unlink(file_fullpath);
+    free(file_fullpath);
+    return NULL;
+}
+
+/* named pool을 기본 pool(PBUDDY_POOL)로 연다. */
+pbuddy_pool_t *pbuddy_alloc_open(const char *dir, const char *name, void *base_ptr,
+                                 uint64_t max_size, uint64_t size)
+{
+    PBUDDY_POOL = pbuddy_pool_open_named(dir, name, base_ptr, max_size, size);
+
+    return PBUDDY_POOL;
+}
+
+/* arena 하나의 최대 chunk보다 커서 이웃한 arena들에 걸쳐 받아야 하는 크기인지 */
+static inline bool pbuddy_is_span(pbuddy_pool_t *pool, uint64_t size)
+{
+    return size > get_buddy_max_chunksize(pool->arenas[0]);
+}
+
+/**
+ * @brief arena 하나의 최대 chunk보다 큰 size를 이웃한 arena들에 걸쳐 떼어온다.
+ *
+ * 전부 free인 arena들을 앞에서부터 buddy_reserve_all로 차례로 떼어오고,
+ * 하나라도 실패하면 떼어온 arena들을 돌려준 뒤 그 다음 arena부터 다시
+ * 찾는다. 마지막 arena에서 쓰지 않는 뒷부분은 바로 돌려준다. 할당은 arena
+ * 경계에서 시작하므로 2^n 정렬은 보장하지 않는다. order map에는 기록하지
+ * 않는다 (pbuddy_omap_set).
+ */
+static char *pbuddy_span_reserve(pbuddy_pool_t *pool, uint64_t size)
+{
+    pbuddy_alloc_t *arena;
+    uint64_t last, page_size;
+    int cnt, first, i, j;
+
+    cnt = (int)((size + pool->arena_size - 1) / pool->arena_size);
+    page_size = get_buddy_page_size(pool->arenas[0]);
+    last = size - (uint64_t)(cnt - 1) * pool->arena_size;
+    last = (last + page_size - 1) & ~(page_size - 1);
+
+    for (first = 0; first + cnt <= pool->arena_cnt; first = i + 1)
+    {
+        for (i = first; i < first + cnt; i++)
+        {
+            arena = pool->arenas[i];
+            if (arena->available_size < ((i < first + cnt - 1) ? pool->arena_size : last) ||
+                !buddy_reserve_all(arena))
+                break;
+        }
+
+        if (i == first + cnt)
+        {
+            arena = pool->arenas[i - 1];
+            if (last < arena->available_size)
+                buddy_release(arena, arena->page_start + last,
+                              arena->available_size - last);
+            return pool->arenas[first]->page_start;
+        }
+
+        for (j = first; j < i; j++)
+            buddy_release(pool->arenas[j], pool->arenas[j]->page_start,
+                          pool->arenas[j]->available_size);
+    }
+
+    return NULL;
+}
+
+/* [ptr, ptr + size)를 arena마다 나누어 order map에 기록한다. 첫 arena 뒤의
+ * 부분은 앞 arena의 할당에 이어지는 것으로 기록한다. */
+static bool pbuddy_omap_set(pbuddy_pool_t *pool, char *ptr, uint64_t size)
+{
+    pbuddy_alloc_t *arena;
+    uint64_t part;
+    bool cont = false;
+
+    while (size > 0)
+    {
+        arena = pbuddy_arena_of(pool, ptr);
+        part = MIN(size, (uint64_t)(arena->page_start + pool->arena_size - ptr));
+        if (!buddy_omap_set(arena, ptr, part, cont))
+            return false;
+
+        ptr += part;
+        size -= part;
+        cont = true;
+    }
+
+    return true;
+}
+
+/* ptr의 할당을 order map에서 지운다. arena 끝까지 차 있으면 다음 arena의 첫
+ * page가 이어지는 조각인지 보고 같이 지운다. 지운 크기를 돌려준다. */
+static uint64_t pbuddy_omap_clear(pbuddy_pool_t *pool, char *ptr)
+{
+    pbuddy_alloc_t *arena = pbuddy_arena_of(pool, ptr);
+    uint64_t part, size;
+    int i = (int)((ptr - pool->page_start) / pool->arena_size);
+
+    size = buddy_omap_clear(arena, ptr, false);
+    part = size;
+    while (part > 0 && ptr + size == arena->page_start + pool->arena_size &&
+           ++i < pool->arena_cnt)
+    {
+        arena = pool->arenas[i];
+        part = buddy_omap_clear(arena, arena->page_start, true);
+        size += part;
+    }
+
+    return size;
+}
+
+/* pbuddy_omap_clear로 지운 할당을 arena마다 나누어 돌려준다. */
+static void pbuddy_release(pbuddy_pool_t *pool, char *ptr, uint64_t size)
+{
+    pbuddy_alloc_t *arena;
+    uint64_t part;
+
+    while (size > 0)
+    {
+        arena = pbuddy_arena_of(pool, ptr);
+        part = MIN(size, (uint64_t)(arena->page_start + pool->arena_size - ptr));
+        buddy_release(arena, ptr, part);
+
+        ptr += part;
+        size -= part;
+    }
+}
+
+/* 이웃한 arena들에 걸쳐 할당하고 order map에 기록한다. */
+static void *pbuddy_span_malloc(pbuddy_pool_t *pool, uint64_t size)
+{
+    char *ptr;
+
+    ptr = pbuddy_span_reserve(pool, size);
+    if (ptr != NULL)
+        (void)pbuddy_omap_set(pool, ptr, size);
+
+    return ptr;
+}
+
+/**
+ * @brief pool에서 size 크기(2^n으로 올림)의 chunk를 할당한다.
+ *
+ * home arena에서 먼저 찾고, 없으면 다음 arena부터 차례로 찾아본다.
+ * arena 하나의 최대 chunk(arena 크기 이하의 가장 큰 2^n, 또는
+ * _PMEM_BUDDY_MAX_SHIFT)보다 큰 요청은 전부 free인 이웃 arena들을 묶어서
+ * 할당한다 (pbuddy_span_reserve).
+ */
+void *pbuddy_pool_malloc(pbuddy_pool_t *pool, uint64_t size)
+{
+    void *ptr;
+    int home, i;
+
+    if (pool->stripe_cnt > 0)
+        return pbuddy_stripe_malloc(pool, size, false);
+
+    size = get_buddy_alloc_size(size);
+    if (pbuddy_is_span(pool, size))
+        return pbuddy_span_malloc(pool, size);
+
+    home = pbuddy_home_arena(pool);
+
+    ptr = buddy_malloc(pool->arenas[home], size);
+    for (i = 1; ptr == NULL && i < pool->arena_cnt; i++)
+        ptr = buddy_malloc(pool->arenas[(home + i) % pool->arena_cnt], size);
+
+    return ptr;
+}
+
+/**
+ * @brief pool에서 받은 메모리를 반납한다. 크기는 arena의 order map에서 찾는다.
+ *
+ * @return pool이 준 주소가 아니거나 이미 free 된 주소이면 false.
+ */
+bool pbuddy_pool_free(pbuddy_pool_t *pool, void *ptr)
+{
+    uint64_t size;
+
+    if (!pbuddy_in_pool(pool, ptr))
+    {
+        printf("pbuddy_free: %p is not in the pmem pool\n", ptr);
+        return false;
+    }
+
+    pool = pbuddy_pool_of(pool, ptr);
+    size = pbuddy_omap_clear(pool, ptr);
+    if (size == 0)
+    {
+        printf("pbuddy_free: %p is not allocated from the pmem pool (double free?)\n",
+               ptr);
+        return false;
+    }
+
+    pbuddy_release(pool, ptr, size);
+
+    return true;
+}
+
+/* ptr이 pool에서 할당되어 아직 free 되지 않은 주소인지 확인 */
+bool pbuddy_pool_owns(pbuddy_pool_t *pool, void *ptr)
+{
+    if (!pbuddy_in_pool(pool, ptr))
+        return false;
+
+    pool = pbuddy_pool_of(pool, ptr);
+    return buddy_owns(pbuddy_arena_of(pool, ptr), ptr);
+}
+
+/* ptr에 할당된 크기. 할당된 주소가 아니면 0 */
+uint64_t get_pbuddy_chunk_size(pbuddy_pool_t *pool, void *ptr)
+{
+    pbuddy_alloc_t *arena;
+    uint64_t size, part;
+    int i;
+
+    if (!pbuddy_in_pool(pool, ptr))
+        return 0;
+
+    pool = pbuddy_pool_of(pool, ptr);
+    arena = pbuddy_arena_of(pool, ptr);
+    size = get_buddy_chunk_size(arena, ptr);
+    part = size;
+    i = (int)(((char *)ptr - pool->page_start) / pool->arena_size);
+    while (part > 0 && (char *)ptr + size == arena->page_start + pool->arena_size &&
+           ++i < pool->arena_cnt)
+    {
+        arena = pool->arenas[i];
+        part = get_buddy_cont_size(arena);
+        size += part;
+    }
+
+    return size;
+}
+
+/* pbuddy_pool_malloc과 같지만 page 단위로 할당한다 (buddy_malloc_exact).
+ * 반납은 pbuddy_pool_free로 한다. */
+void *pbuddy_pool_malloc_exact(pbuddy_pool_t *pool, uint64_t size)
+{
+    uint64_t page_size;
+    void *ptr;
+    int home, i;
+
+    if (pool->stripe_cnt > 0)
+        return pbuddy_stripe_malloc(pool, size, true);
+
+    if (pbuddy_is_span(pool, get_buddy_alloc_size(size)))
+    {
+        page_size = get_buddy_page_size(pool->arenas[0]);
+        return pbuddy_span_malloc(pool, (size + page_size - 1) & ~(page_size - 1));
+    }
+
+    home = pbuddy_home_arena(pool);
+
+    ptr = buddy_malloc_exact(pool->arenas[home], size);
+    for (i = 1; ptr == NULL && i < pool->arena_cnt; i++)
+        ptr = buddy_malloc_exact(pool->arenas[(home + i) % pool->arena_cnt], size);
+
+    return ptr;
+}
+
+/* pool의 mapping 방식(pool->persist)으로 flush 한다. 완료는 pbuddy_drain으로 기다린다. */
+static inline void pbuddy_flush(pbuddy_pool_t *pool, const void *addr, size_t len)
+{
+    tb_flush_as(pool->persist, addr, len);
+}
+
+static inline void pbuddy_drain(pbuddy_pool_t *pool)
+{
+    tb_drain_as(pool->persist);
+}
+
+/**
+ * @brief pool 안의 [addr, addr + len)을 persist 한다.
+ *
+ * MAP_SYNC로 올린 pool은 CPU cache flush로, 일반 shared mapping으로 올린
+ * pool은 msync로 내보낸다. volatile pool에서는 아무것도 하지 않는다.
+ */
+void pbuddy_pool_persist(pbuddy_pool_t *pool, const void *addr, size_t len)
+{
+    tb_persist_as(pool->persist, addr, len);
+}
+
+/* tx 함수를 쓸 수 있는 pool과 dest인지 확인 */
+static bool pbuddy_tx_check(pbuddy_pool_t *pool, uint64_t *dest)
+{
+    if (pool == NULL || pool->logs == NULL)
+    {
+        printf("pbuddy_tx: transactions need a named pool\n");
+        return false;
+    }
+
+    if ((char *)dest < pool->map_addr ||
+        (char *)dest + sizeof(uint64_t) > pool->map_addr + pool->map_size ||
+        ((uintptr_t)dest & (sizeof(uint64_t) - 1)) != 0)
+    {
+        printf("pbuddy_tx: %p is not an aligned location in the pmem pool\n", dest);
+        return false;
+    }
+
+    return true;
+}
+
+/* pool의 arena에서 order map에 기록하지 않고 chunk를 떼어온다 (buddy_reserve). */
+static void *pbuddy_pool_reserve(pbuddy_pool_t *pool, uint64_t size)
+{
+    void *ptr;
+    int home, i;
+
+    home = pbuddy_home_arena(pool);
+
+    ptr = buddy_reserve(pool->arenas[home], size);
+    for (i = 1; ptr == NULL && i < pool->arena_cnt; i++)
+        ptr = buddy_reserve(pool->arenas[(home + i) % pool->arena_cnt], size);
+
+    return ptr;
+}
+
+/**
+ * @brief chunk를 할당하고 그 pool offset을 dest에 기록한다. 중간에 죽어도
+ *        다시 열었을 때 "할당되어 dest에 연결됨"과 "할당되지 않음" 중 하나가 된다.
+ *
+ * chunk는 order map에 기록하지 않고 떼어온 뒤, redo record를 한 번에
+ * persist 한다 (fence 1). 그 다음에 order map과 dest를 쓰고 같이 persist 하고
+ * (fence 2), record를 비운다 (fence 3). order map은 record가 durable 해진
+ * 뒤에만 쓰므로, record 없이 order map만 남는 경우는 없다. record가 durable
+ * 해지기 전에 죽으면 chunk는 order map 복구 때 회수된다.
+ *
+ * fence는 합칠 수 없다. 1과 2를 합치면 record 없이 order map만 남아 chunk가
+ * 샐 수 있고, 2와 3을 합치면 record가 먼저 지워져 같은 문제가 생긴다. 3을
+ * 미루면 남은 record가 나중에 다시 쓰인 dest를 덮어쓸 수 있다. DAX가 아니면
+ * fence 대신 msync이고 order map과 dest도 따로 msync 하므로 op마다 네 번이다.
+ * pmem_bench로 일반 malloc/free와 비교할 수 있다.
+ *
+ * @param dest  pool 안의 8 byte 정렬된 위치 (예: root object의 field)
+ * @return 할당한 주소. 실패하면 NULL이고 dest는 그대로이다.
+ */
+void *pbuddy_pool_tx_malloc(pbuddy_pool_t *pool, uint64_t size, uint64_t *dest)
+{
+    pbuddy_redo_log_t *log;
+    char *ptr;
+    int slot;
+
+    if (!pbuddy_tx_check(pool, dest))
+        return NULL;
+
+    size = MAX(get_buddy_alloc_size(size), get_buddy_page_size(pool->arenas[0]));
+    if (pbuddy_is_span(pool, size))
+        ptr = pbuddy_span_reserve(pool, size);
+    else
+        ptr = pbuddy_pool_reserve(pool, size);
+    if (ptr == NULL)
+        return NULL;
+
+    slot = pbuddy_thread_id() % PBUDDY_REDO_LOGS;
+    log = &pool->logs[slot];
+    pthread_mutex_lock(&pool->log_mutex[slot]);
+
+    log->dest_offset = (uint64_t)((char *)dest - pool->map_addr);
+    log->value = (uint64_t)(ptr - pool->map_addr);
+    log->size = size;
+    log->state = log->value | PBUDDY_REDO_COMMITTED;
+    log->checksum = pbuddy_redo_checksum(log);
+    pbuddy_pool_persist(pool, log, sizeof(pbuddy_redo_log_t));
+
+    (void)pbuddy_omap_set(pool, ptr, size);
+    *dest = log->value;
+    pbuddy_pool_persist(pool, dest, sizeof(uint64_t));
+
+    log->state = 0;
+    pbuddy_pool_persist(pool, &log->state, sizeof(uint64_t));
+
+    pthread_mutex_unlock(&pool->log_mutex[slot]);
+
+    return ptr;
+}
+
+/**
+ * @brief dest가 가리키는 chunk를 반납하고 dest를 0으로 만든다.
+ *
+ * redo record를 persist 한 뒤 (fence 1), dest를 0으로 만들고 chunk를 order
+ * map에서 지워서 같이 persist 하고 (fence 2), record를 비운다 (fence 3).
+ * chunk는 record를 비운 뒤에 allocator에 돌려주므로, record가 남아 있는 동안
+ * 다른 thread가 그 chunk를 받아갈 수 없다. 그 사이에 죽으면 다시 열 때
+ * order map에서 다시 지운다.
+ *
+ * @return dest가 0이거나 pool에서 할당된 chunk가 아니면 false.
+ */
+bool pbuddy_pool_tx_free(pbuddy_pool_t *pool, uint64_t *dest)
+{
+    pbuddy_redo_log_t *log;
+    uint64_t offset, size;
+    char *ptr;
+    int slot;
+
+    if (!pbuddy_tx_check(pool, dest))
+        return false;
+
+    offset = *dest;
+    ptr = pool->map_addr + offset;
+    if (offset == 0 || !pbuddy_pool_owns(pool, ptr))
+    {
+        printf("pbuddy_tx_free: %p is not allocated from the pmem pool\n", ptr);
+        return false;
+    }
+
+    slot = pbuddy_thread_id() % PBUDDY_REDO_LOGS;
+    log = &pool->logs[slot];
+    pthread_mutex_lock(&pool->log_mutex[slot]);
+
+    log->dest_offset = (uint64_t)((char *)dest - pool->map_addr);
+    log->value = 0;
+    log->size = get_pbuddy_chunk_size(pool, ptr);
+    log->state = offset | PBUDDY_REDO_COMMITTED | PBUDDY_REDO_FREE;
+    log->checksum = pbuddy_redo_checksum(log);
+    pbuddy_pool_persist(pool, log, sizeof(pbuddy_redo_log_t));
+
+    *dest = 0;
+    size = pbuddy_omap_clear(pool, ptr);
+    pbuddy_pool_persist(pool, dest, sizeof(uint64_t));
+
+    log->state = 0;
+    pbuddy_pool_persist(pool, &log->state, sizeof(uint64_t));
+
+    pthread_mutex_unlock(&pool->log_mutex[slot]);
+
+    /* 다른 thread가 같은 chunk를 먼저 지웠으면 size는 0이다. */
+    if (size > 0)
+        pbuddy_release(pool, ptr, size);
+
+    return true;
+}
+
+/**
+ * @brief 정상 종료되지 않은 pool을 다시 열 때 redo log에 남은 record를 마저 처리한다.
+ *
+ * checksum이 맞는 record는 chunk를 order map에 기록하거나 (FREE이면) 지우고,
+ * dest에 value를 다시 쓴다. 모두 여러 번 해도 같다. 쓰다 만 record의 chunk는
+ * 아직 order map에 기록되지 않았으므로 그냥 버린다. arena를 attach 한 뒤,
+ * order map 복구 전에 부른다.
+ */
+static void pbuddy_redo_replay(pbuddy_pool_t *pool)
+{
+    pbuddy_redo_log_t *log;
+    uint64_t state;
+    char *chunk;
+    int i, replayed = 0;
+
+    for (i = 0; i < PBUDDY_REDO_LOGS; i++)
+    {
+        log = &pool->logs[i];
+        state = log->state;
+        if (state == 0 || !(state & PBUDDY_REDO_COMMITTED) ||
+            log->checksum != pbuddy_redo_checksum(log))
+            continue;
+
+        chunk = pool->map_addr + (state & ~PBUDDY_REDO_FLAGS);
+        if (!pbuddy_in_pool(pool, chunk) ||
+            log->size > (uint64_t)(pool->page_start + pool->arena_cnt * pool->arena_size - chunk) ||
+            log->dest_offset + sizeof(uint64_t) > pool->map_size)
+            continue;
+
+        if (state & PBUDDY_REDO_FREE)
+            (void)pbuddy_omap_clear(pool, chunk);
+        else if (!pbuddy_omap_set(pool, chunk, log->size))
+            continue;
+
+        *(uint64_t *)(pool->map_addr + log->dest_offset) = log->value;
+        pbuddy_flush(pool, pool->map_addr + log->dest_offset, sizeof(uint64_t));
+        replayed++;
+    }
+    pbuddy_drain(pool);
+
+    /* 다시 한 내용이 durable 해진 뒤에 record를 비운다. */
+    for (i = 0; i < PBUDDY_REDO_LOGS; i++)
+    {
+        if (pool->logs[i].state == 0)
+            continue;
+
+        pool->logs[i].state = 0;
+        pbuddy_flush(pool, &pool->logs[i].state, sizeof(uint64_t));
+    }
+    pbuddy_drain(pool);
+
+    if (replayed > 0)
+        printf("pmem pool (%s) replayed %d redo log records\n",
+               pool->file_fullpath, replayed);
+}
+
+/**
+ * @brief 사용자 root object를 지정한다. named pool을 다시 열었을 때
+ *        pbuddy_pool_get_root로 찾을 수 있다.
+ *
+ * @param ptr pool 안의 주소. NULL이면 root를 지운다.
+ */
+void pbuddy_pool_set_root(pbuddy_pool_t *pool, void *ptr)
+{
+    pbuddy_superblock_t *sb;
+
+    if (pool == NULL || pool->sb == NULL)
+        return;
+
+    /* pbuddy_pool_malloc이 flush 해둔 root chunk의 order map이 root_offset보다
+     * 먼저 durable 해야 다시 열었을 때 root가 free chunk를 가리키지 않는다. */
+    pbuddy_drain(pool);
+
+    sb = pool->sb;
+    sb->root_offset = (ptr == NULL) ? 0 : (uint64_t)((char *)ptr - (char *)sb);
+    pbuddy_pool_persist(pool, &sb->root_offset, sizeof(uint64_t));
+}
+
+void *pbuddy_pool_get_root(pbuddy_pool_t *pool)
+{
+    pbuddy_superblock_t *sb;
+
+    if (pool == NULL || pool->sb == NULL)
+        return NULL;
+
+    sb = pool->sb;
+    if (sb->root_offset == 0)
+        return NULL;
+
+    return (char *)sb + sb->root_offset;
+}
+
+void pbuddy_set_root(void *ptr)
+{
+    pbuddy_pool_set_root(PBUDDY_POOL, ptr);
+}
+
+void *pbuddy_get_root(void)
+{
+    return pbuddy_pool_get_root(PBUDDY_POOL);
+}
+
+/**
+ * @brief min_size 이상인 free chunk들을 age와 상관없이 바로 punch 한다.
+ *
+ * _PMEM_PUNCH_MIN_SIZE로 hole punching을 켠 pool에서만 동작한다.
+ * @return punch 한 크기
+ */
+uint64_t pbuddy_pool_trim(pbuddy_pool_t *pool, uint64_t min_size)
+{
+    uint64_t bytes = 0;
+    int i;
+
+    for (i = 0; i < pool->arena_cnt; i++)
+        bytes += buddy_trim(pool->arenas[i], min_size, 0);
+
+    return bytes;
+}
+
+/* arena 전체의 hole punching 통계 (누적 횟수, 지금 free 상태로 punch 되어
+ * 있는 크기) */
+void get_pbuddy_punch_state(pbuddy_pool_t *pool, uint64_t *punch_cnt,
+                            uint64_t *punched_bytes)
+{
+    uint64_t cnt, bytes;
+    int i;
+
+    *punch_cnt = 0;
+    *punched_bytes = 0;
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        get_buddy_punch_state(pool->arenas[i], &cnt, &bytes);
+        *punch_cnt += cnt;
+        *punched_bytes += bytes;
+    }
+}
+
+/* arena 전체의 사용량 */
+void get_pbuddy_alloc_state(pbuddy_pool_t *pool, uint64_t *total_size,
+                            uint64_t *used_size)
+{
+    uint64_t total, used;
+    int i;
+
+    *total_size = 0;
+    *used_size = 0;
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        get_buddy_alloc_state(pool->arenas[i], &total, &used);
+        *total_size += total;
+        *used_size += used;
+    }
+}
+
+/**
+ * @brief       arena 전체의 free 공간 분포와 조각화 정도
+ *
+ * largest_free는 arena 하나에서 받을 수 있는 가장 큰 chunk이다. arena마다
+ * peak 시점이 다르므로 peak_used는 arena별 peak의 합(상한값)이다.
+ */
+void get_pbuddy_alloc_stat(pbuddy_pool_t *pool, buddy_stat_t *stat)
+{
+    buddy_stat_t arena;
+    int i, j;
+
+    memset(stat, 0, sizeof(buddy_stat_t));
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        get_buddy_alloc_stat(pool->arenas[i], &arena);
+        stat->total_size += arena.total_size;
+        stat->used_size += arena.used_size;
+        stat->free_size += arena.free_size;
+        stat->peak_used += arena.peak_used;
+        if (arena.largest_free > stat->largest_free)
+            stat->largest_free = arena.largest_free;
+        if (arena.bins_cnt > stat->bins_cnt)
+            stat->bins_cnt = arena.bins_cnt;
+        for (j = 0; j < arena.bins_cnt; j++)
+            stat->free_bytes[j] += arena.free_bytes[j];
+    }
+
+    if (stat->free_size > 0)
+        stat->frag_index = 1.0 - (double)stat->largest_free / stat->free_size;
+}
+
+void pbuddy_reset_peak_used(pbuddy_pool_t *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->arena_cnt; i++)
+        buddy_reset_peak_used(pool->arenas[i]);
+}
+
+/* arena 전체의 thread magazine 통계 */
+void get_pbuddy_alloc_cache_state(pbuddy_pool_t *pool, uint64_t *hit_cnt,
+                                  uint64_t *miss_cnt, uint64_t *cached_size)
+{
+    uint64_t hit, miss, cached;
+    int i;
+
+    *hit_cnt = 0;
+    *miss_cnt = 0;
+    *cached_size = 0;
+    for (i = 0; i < pool->arena_cnt; i++)
+    {
+        get_buddy_alloc_cache_state(pool->arenas[i], &hit, &miss, &cached);
+        *hit_cnt += hit;
+        *miss_cnt += miss;
+        *cached_size += cached;
+    }
+}
+
 /**
  * @brief 메모리를 unmap하고 파일을 삭제한다.
  *
- * @param alloc_ptr pmem_alloc 구조체의 주소.
+ * named pool이면 파일을 지우지 않고, metadata를 모두 기록한 뒤 닫는다.
+ * 이 pool을 쓰는 region allocator들은 먼저 지워야 한다.
+ *
  * @return int 성공시 0, 실패시 -1.
  */
-int pbuddy_alloc_destroy()
+int pbuddy_pool_close(pbuddy_pool_t *pool)
 {
-    pbuddy_alloc_t *alloc_ptr = PBUDDY_ALLOC;
+    pbuddy_superblock_t *sb;
+    char *file_fullpath;
+    char *map_addr;
+    uint64_t map_size;
+    int fd;
 
-    if (alloc_ptr == NULL) return -1;
+    if (pool == NULL) return -1;
 
-    if (munmap((void *)((alloc_ptr)->page_start), (alloc_ptr)->alloc_size))
+    /* striped pool은 member pool들만 닫으면 된다. */
+    if (pool->stripe_cnt > 0 || pool->map_addr == NULL)
+    {
+        int i, ret = 0;
+
+        for (i = 0; i < pool->stripe_cnt; i++)
+        {
+            if (pbuddy_pool_close(pool->stripes[i]))
+                ret = -1;
+        }
+        free(pool);
+        return ret;
+    }
+
+    sb = pool->sb;
+    file_fullpath = pool->file_fullpath;
+    map_addr = pool->map_addr;
+    map_size = pool->map_size;
+    fd = pool->fd;
+
+    /* named pool이면 thread magazine의 chunk들이 bitmap에 반영된다. */
+    pbuddy_pool_delete(pool);
+
+    if (sb != NULL)
+    {
+        sb->clean = 1;
+        if (msync(map_addr, map_size, MS_SYNC))
+        {
+            printf("msync failed (errno:%d, %s)\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    (void)close(fd);
+    if (munmap(map_addr, map_size))
     {
         printf("munmap failed (errno:%d, %s)\n", errno, strerror(errno));
         return -1;
     }
-    if (unlink((alloc_ptr)->file_fullpath))
+    if (sb == NULL && unlink(file_fullpath))
     {
         printf("unlink failed\n");
         return -1;
     }
-    free(alloc_ptr->file_fullpath);
-    free(alloc_ptr);
+    free(file_fullpath);
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* 기본 pool(PBUDDY_POOL)을 닫는다. */
+int pbuddy_alloc_destroy()
+{
+    pbuddy_pool_t *pool = PBUDDY_POOL;
+
+    PBUDDY_POOL = NULL;
+
+    return pbuddy_pool_close(pool);
+}
@@ -1,24 +1,262 @@
 #include <stddef.h>
 #include <stdio.h>
+#include <assert.h>
 
 #include "buddy_alloc.h"
 
-extern pbuddy_alloc_t *PBUDDY_ALLOC;
+/* pool은 page 영역을 arena_size 크기로 잘라서 arena(pbuddy_alloc_t) 여러 개로
+ * 나눠 쓴다. arena마다 mutex, bin, bitmap이 따로 있으므로 서로 다른 arena를
+ * 쓰는 thread끼리는 buddy lock을 두고 경합하지 않는다.
+ *
+ * thread는 처음 쓸 때 round-robin으로 정해진 home arena에서 먼저 할당받고,
+ * 그 arena가 가득 차면 다음 arena들에서 가져온다(stealing). free는 주소로
+ * arena를 찾아서 원래 arena로 돌려준다.
+ */
+#define PBUDDY_MAX_ARENAS 64
 
-pbuddy_alloc_t *pbuddy_alloc_init(const char *dir, void *base_ptr, uint64_t max_size, uint64_t size);
+/* striped pool은 directory(DAX device)마다 pool을 하나씩 두고, 할당마다
+ * _PMEM_STRIPE_POLICY에 따라 member pool을 골라서 받아온다. 자체 page 영역은
+ * 없으며, arenas[]에는 통계 등을 위해 member들의 arena를 모아둔다.
+ */
+#define PBUDDY_MAX_STRIPES 8
+#define PBUDDY_STRIPE_ROUND_ROBIN 0
+#define PBUDDY_STRIPE_MOST_FREE   1
+
+/* volatile pool은 pmem을 용량으로만 쓴다. 임시 파일이고 metadata는 DRAM에
+ * 있으며, MAP_SYNC나 flush 없이 쓴다. persistent pool(named pool)은 파일에
+ * metadata가 남고, MAP_SYNC로 mapping 하며, 정상 종료되지 않았으면 다시 열 때
+ * 복구한다. */
+#define PBUDDY_POOL_VOLATILE   0
+#define PBUDDY_POOL_PERSISTENT 1
+
+/* named pool 파일의 구성. superblock은 맨 앞 page에, redo log는 그 다음
+ * page에 들어간다.
+ *
+ *   +------------+----------+----------------------+-----+----------+-----+
+ *   | superblock | redo log | arena #0 header+bits | ... | arena #0 | ... |
+ *   +------------+----------+----------------------+-----+----------+-----+
+ *   0            log_offset meta_offset                  page_offset       pool_size
+ */
+#define PBUDDY_POOL_MAGIC   0x5944445542504254ULL /* "TBPBUDDY" */
+#define PBUDDY_POOL_VERSION 9
+
+/* pbuddy_pool_tx_malloc/pbuddy_pool_tx_free가 쓰는 redo log. thread마다 slot
+ * 하나를 쓰고, record는 cache line 하나에 들어간다.
+ *
+ * state는 chunk의 pool offset과 flag를 합친 값이다 (chunk는 page 단위이므로
+ * 하위 bit가 비어 있다). record 전체를 한 번에 persist 하므로, checksum이
+ * 맞지 않으면 쓰다 만 record로 보고 버린다.
+ *   0                          : 비어 있음
+ *   offset | COMMITTED         : chunk를 order map에 기록하고 dest에 value를 쓴다
+ *   offset | COMMITTED | FREE  : dest에 value(0)를 쓰고 chunk를 order map에서 지운다
+ * 다시 열 때 order map 복구 전에 위 동작을 다시 한다 (여러 번 해도 같다).
+ */
+#define PBUDDY_REDO_LOGS      64
+#define PBUDDY_REDO_COMMITTED 0x1ULL
+#define PBUDDY_REDO_FREE      0x2ULL
+#define PBUDDY_REDO_FLAGS     (PBUDDY_REDO_COMMITTED | PBUDDY_REDO_FREE)
+
+typedef struct pbuddy_redo_log_s
+{
+    uint64_t state;
+    uint64_t dest_offset;  // 갱신할 8 byte 위치의 pool offset
+    uint64_t value;        // dest에 쓸 값
+    uint64_t size;         // order map에 기록할 chunk 크기 (FREE이면 참고용)
+    uint64_t checksum;     // pbuddy_redo_checksum
+    uint64_t reserved[3];
+} __attribute__((aligned(64))) pbuddy_redo_log_t;
+
+/* record의 앞 네 field로 만든 checksum */
+static inline uint64_t pbuddy_redo_checksum(const pbuddy_redo_log_t *log)
+{
+    uint64_t sum = 0xcbf29ce484222325ULL;
+
+    sum = (sum ^ log->state) * 0x100000001b3ULL;
+    sum = (sum ^ log->dest_offset) * 0x100000001b3ULL;
+    sum = (sum ^ log->value) * 0x100000001b3ULL;
+    sum = (sum ^ log->size) * 0x100000001b3ULL;
+
+    return sum ^ (sum >> 32);
+}
+
+typedef struct pbuddy_superblock_s
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clean;        // 1이면 pbuddy_alloc_destroy로 정상 종료됨
+    uint64_t pool_size;    // 파일 전체 크기
+    uint64_t meta_offset;  // arena #0 header 위치
+    uint64_t meta_stride;  // arena header 사이의 간격
+    uint64_t page_offset;  // arena #0 page 영역 시작 위치
+    uint64_t arena_size;   // arena 하나의 page 영역 크기
+    uint32_t arena_cnt;
+    uint32_t reserved;
+    uint64_t root_offset;  // 사용자 root object 위치 (0이면 없음)
+    uint64_t base_addr;    // 마지막으로 mapping 했던 주소
+    uint64_t log_offset;   // redo log 위치
+} pbuddy_superblock_t;
+
+#ifndef _PBUDDY_POOL_T
+#define _PBUDDY_POOL_T
+typedef struct pbuddy_pool_s pbuddy_pool_t;
+#endif /* _PBUDDY_POOL_T */
+
+struct pbuddy_pool_s
+{
+    char *file_fullpath;         // 파일의 전체 경로
+    int fd;                      // hole punching용, pool을 닫을 때 close
+    char *map_addr;              // mmap 시작 주소
+    uint64_t map_size;
+    pbuddy_superblock_t *sb;     // named pool일 때만 설정
+    int mode;                    // PBUDDY_POOL_VOLATILE, PBUDDY_POOL_PERSISTENT
+    int persist;                 // mapping의 persist 방식 (TB_PERSIST_*)
+    pbuddy_redo_log_t *logs;     // named pool일 때만 설정
+    pthread_mutex_t log_mutex[PBUDDY_REDO_LOGS];
+
+    char *page_start;            // arena #0의 page 시작 주소
+    uint64_t arena_size;
+    int arena_cnt;
+    pbuddy_alloc_t *arenas[PBUDDY_MAX_ARENAS];
+
+    int stripe_cnt;              // striped pool이면 member pool 개수, 아니면 0
+    uint32_t stripe_next;        // round-robin 순번
+    pbuddy_pool_t *stripes[PBUDDY_MAX_STRIPES];
+};
+
+/* 기본 pool. tballoc_init에서 만들고, pbuddy_malloc/pbuddy_free 등 pool을
+ * 받지 않는 함수들이 쓴다. 그 외의 pool은 pbuddy_pool_open으로 연다. */
+extern pbuddy_pool_t *PBUDDY_POOL;
+
+pbuddy_pool_t *pbuddy_alloc_init(const char *dir, void *base_ptr, uint64_t max_size, uint64_t size);
+pbuddy_pool_t *pbuddy_alloc_open(const char *dir, const char *name, void *base_ptr,
+                                 uint64_t max_size, uint64_t size);
 int pbuddy_alloc_destroy();
 
+pbuddy_pool_t *pbuddy_pool_open(const char *dir, uint64_t size);
+pbuddy_pool_t *pbuddy_pool_open_striped(const char **dirs, int dir_cnt, uint64_t size);
+pbuddy_pool_t *pbuddy_pool_open_named(const char *dir, const char *name, void *base_ptr,
+                                      uint64_t max_size, uint64_t size);
+int pbuddy_pool_close(pbuddy_pool_t *pool);
+
+void *pbuddy_pool_malloc(pbuddy_pool_t *pool, uint64_t size);
+bool pbuddy_pool_free(pbuddy_pool_t *pool, void *ptr);
+void *pbuddy_pool_malloc_exact(pbuddy_pool_t *pool, uint64_t size);
+bool pbuddy_pool_owns(pbuddy_pool_t *pool, void *ptr);
+uint64_t get_pbuddy_chunk_size(pbuddy_pool_t *pool, void *ptr);
+
+void pbuddy_pool_persist(pbuddy_pool_t *pool, const void *addr, size_t len);
+
+void *pbuddy_pool_tx_malloc(pbuddy_pool_t *pool, uint64_t size, uint64_t *dest);
+bool pbuddy_pool_tx_free(pbuddy_pool_t *pool, uint64_t *dest);
+
+void pbuddy_pool_set_root(pbuddy_pool_t *pool, void *ptr);
+void *pbuddy_pool_get_root(pbuddy_pool_t *pool);
+void pbuddy_set_root(void *ptr);
+void *pbuddy_get_root(void);
+
+void get_pbuddy_alloc_state(pbuddy_pool_t *pool, uint64_t *total_size,
+                            uint64_t *used_size);
+void get_pbuddy_alloc_cache_state(pbuddy_pool_t *pool, uint64_t *hit_cnt,
+                                  uint64_t *miss_cnt, uint64_t *cached_size);
+void get_pbuddy_alloc_stat(pbuddy_pool_t *pool, buddy_stat_t *stat);
+void pbuddy_reset_peak_used(pbuddy_pool_t *pool);
+
+uint64_t pbuddy_pool_trim(pbuddy_pool_t *pool, uint64_t min_size);
+void get_pbuddy_punch_state(pbuddy_pool_t *pool, uint64_t *punch_cnt,
+                            uint64_t *punched_bytes);
+
+/* ptr이 pool의 page 영역 안에 있는지 */
+static inline bool pbuddy_in_pool(pbuddy_pool_t *pool, void *ptr)
+{
+    int i;
+
+    for (i = 0; i < pool->stripe_cnt; i++)
+    {
+        if (pbuddy_in_pool(pool->stripes[i], ptr))
+            return true;
+    }
+
+    return (char *)ptr >= pool->page_start &&
+           (char *)ptr < pool->page_start + pool->arena_cnt * pool->arena_size;
+};
+
+/* ptr이 들어있는 pool. striped pool이면 member pool을 찾는다. */
+static inline pbuddy_pool_t *pbuddy_pool_of(pbuddy_pool_t *pool, void *ptr)
+{
+    int i;
+
+    for (i = 0; i < pool->stripe_cnt; i++)
+    {
+        if (pbuddy_in_pool(pool->stripes[i], ptr))
+            return pool->stripes[i];
+    }
+
+    return pool;
+};
+
+/* ptr이 속한 arena */
+static inline pbuddy_alloc_t *pbuddy_arena_of(pbuddy_pool_t *pool, void *ptr)
+{
+    return pool->arenas[((char *)ptr - pool->page_start) / pool->arena_size];
+};
+
+/* pool 안의 주소를 pool 시작으로부터의 offset으로 바꾼다. named pool을 다른
+ * 주소에 다시 열거나 다른 process가 mapping 해도 offset은 그대로 쓸 수 있다.
+ * offset 0은 superblock이므로 NULL을 나타내는 데 쓴다. striped pool의 주소는
+ * 그 주소가 속한 member pool을 넘겨서 바꾼다. root는 mapping이 없고 offset만으로는
+ * member를 알 수 없으므로 넘기면 안 된다. */
+static inline uint64_t pbuddy_pool_ptr2off(pbuddy_pool_t *pool, const void *ptr)
+{
+    assert(pool->stripe_cnt == 0);
+    return (ptr == NULL) ? 0 : (uint64_t)((const char *)ptr - pool->map_addr);
+};
+
+static inline void *pbuddy_pool_off2ptr(pbuddy_pool_t *pool, uint64_t offset)
+{
+    assert(pool->stripe_cnt == 0);
+    return (offset == 0) ? NULL : (void *)(pool->map_addr + offset);
+};
+
+static inline uint64_t pbuddy_ptr2off(const void *ptr)
+{
+    return pbuddy_pool_ptr2off(PBUDDY_POOL, ptr);
+};
+
+static inline void *pbuddy_off2ptr(uint64_t offset)
+{
+    return pbuddy_pool_off2ptr(PBUDDY_POOL, offset);
+};
+
 static inline void *pbuddy_malloc(size_t size)
 {
-    return buddy_malloc(PBUDDY_ALLOC, (uint64_t)size);
+    return pbuddy_pool_malloc(PBUDDY_POOL, (uint64_t)size);
+};
+
+static inline bool pbuddy_free(void *ptr)
+{
+    return pbuddy_pool_free(PBUDDY_POOL, ptr);
 };
 
-static inline void pbuddy_free(void *ptr, size_t size)
+static inline void *pbuddy_malloc_exact(size_t size)
 {
-    buddy_free(PBUDDY_ALLOC, ptr, size);
+    return pbuddy_pool_malloc_exact(PBUDDY_POOL, (uint64_t)size);
 };
 
 static inline size_t get_pbuddy_alloc_size(size_t size)
 {
     return (size_t)get_buddy_alloc_size((uint64_t)size);
+};
+
+static inline size_t get_pbuddy_alloc_exact_size(size_t size)
+{
+    return (size_t)get_buddy_alloc_exact_size((uint64_t)size);
+};
+
+/* pbuddy_pool_malloc_exact가 pool에서 실제로 쓰는 크기 (pool의 page 단위로 올림) */
+static inline size_t get_pbuddy_pool_exact_size(pbuddy_pool_t *pool, size_t size)
+{
+    uint64_t page_size = get_buddy_page_size(pool->arenas[0]);
+
+    return (size_t)((get_buddy_alloc_exact_size((uint64_t)size) + page_size - 1) &
+                    ~(page_size - 1));
 };
\ No newline at end of file
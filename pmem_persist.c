@@ -0,0 +1,414 @@
+/**
+ * @file    pmem_persist.c
+ * @brief   pmem flush/fence API
+ *
+ * flush 방식은 프로그램이 시작할 때 CPUID로 한 번 정한다.
+ *
+ * - CLWB       : cache line을 내보내되 cache에는 남겨둔다. sfence 필요
+ * - CLFLUSHOPT : cache line을 내보내고 invalidate 한다. sfence 필요
+ * - CLFLUSH    : 명령끼리 순서가 보장되므로 fence가 필요 없지만 가장 느리다
+ * - msync      : DAX가 아닌 mapping. page 단위로 파일에 기록한다
+ *
+ * non-temporal copy/fill kernel도 같은 방식으로 시작 시 고른다.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "iparam.h"
+#include "pmem_persist.h"
+
+#define TB_CACHELINE_SIZE 64
+
+static void tb_flush_msync(const void *addr, size_t len);
+static void tb_drain_none(void);
+
+static void (*tb_flush_func)(const void *addr, size_t len) = tb_flush_msync;
+static void (*tb_drain_func)(void) = tb_drain_none;
+static const char *tb_persist_name = "msync";
+
+/* dst가 cache line에 정렬된 상태에서 64 byte 단위 block들을 쓰는 kernel */
+static void tb_nt_copy_none(char *dst, const char *src, size_t blocks);
+static void tb_nt_fill_none(char *dst, int c, size_t blocks);
+
+static void (*tb_nt_copy_func)(char *dst, const char *src, size_t blocks) = tb_nt_copy_none;
+static void (*tb_nt_fill_func)(char *dst, int c, size_t blocks) = tb_nt_fill_none;
+static const char *tb_nt_name = "none";
+
+#define _LINE_START(addr) ((uintptr_t)(addr) & ~((uintptr_t)TB_CACHELINE_SIZE - 1))
+
+/* addr을 포함하는 page부터 msync. 실패해도 호출한 쪽에서 할 수 있는 게 없으므로
+ * 메시지만 남긴다. */
+static void tb_flush_msync(const void *addr, size_t len)
+{
+    uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t start = (uintptr_t)addr & ~page_mask;
+
+    if (len == 0)
+        return;
+
+    if (msync((void *)start, (uintptr_t)addr + len - start, MS_SYNC))
+        printf("tb_flush: msync(%p, %zu) failed\n", addr, len);
+}
+
+static void tb_drain_none(void)
+{
+}
+
+static void tb_nt_copy_none(char *dst, const char *src, size_t blocks)
+{
+    memcpy(dst, src, blocks * TB_CACHELINE_SIZE);
+}
+
+static void tb_nt_fill_none(char *dst, int c, size_t blocks)
+{
+    memset(dst, c, blocks * TB_CACHELINE_SIZE);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx512f")))
+static void tb_nt_copy_avx512(char *dst, const char *src, size_t blocks)
+{
+    size_t i;
+
+    for (i = 0; i < blocks; i++, dst += 64, src += 64)
+        _mm512_stream_si512((__m512i *)dst, _mm512_loadu_si512(src));
+}
+
+__attribute__((target("avx512f")))
+static void tb_nt_fill_avx512(char *dst, int c, size_t blocks)
+{
+    __m512i v = _mm512_set1_epi8((char)c);
+    size_t i;
+
+    for (i = 0; i < blocks; i++, dst += 64)
+        _mm512_stream_si512((__m512i *)dst, v);
+}
+
+__attribute__((target("avx2")))
+static void tb_nt_copy_avx2(char *dst, const char *src, size_t blocks)
+{
+    size_t i;
+
+    for (i = 0; i < blocks; i++, dst += 64, src += 64)
+    {
+        _mm256_stream_si256((__m256i *)dst, _mm256_loadu_si256((const __m256i *)src));
+        _mm256_stream_si256((__m256i *)(dst + 32),
+                            _mm256_loadu_si256((const __m256i *)(src + 32)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void tb_nt_fill_avx2(char *dst, int c, size_t blocks)
+{
+    __m256i v = _mm256_set1_epi8((char)c);
+    size_t i;
+
+    for (i = 0; i < blocks; i++, dst += 64)
+    {
+        _mm256_stream_si256((__m256i *)dst, v);
+        _mm256_stream_si256((__m256i *)(dst + 32), v);
+    }
+}
+
+/* SSE2는 x86-64에서 항상 지원한다. */
+static void tb_nt_copy_sse2(char *dst, const char *src, size_t blocks)
+{
+    size_t i;
+    int j;
+
+    for (i = 0; i < blocks; i++, dst += 64, src += 64)
+    {
+        for (j = 0; j < 64; j += 16)
+            _mm_stream_si128((__m128i *)(dst + j),
+                             _mm_loadu_si128((const __m128i *)(src + j)));
+    }
+}
+
+static void tb_nt_fill_sse2(char *dst, int c, size_t blocks)
+{
+    __m128i v = _mm_set1_epi8((char)c);
+    size_t i;
+    int j;
+
+    for (i = 0; i < blocks; i++, dst += 64)
+    {
+        for (j = 0; j < 64; j += 16)
+            _mm_stream_si128((__m128i *)(dst + j), v);
+    }
+}
+
+__attribute__((target("clwb")))
+static void tb_flush_clwb(const void *addr, size_t len)
+{
+    uintptr_t line;
+
+    for (line = _LINE_START(addr); line < (uintptr_t)addr + len;
+         line += TB_CACHELINE_SIZE)
+        _mm_clwb((void *)line);
+}
+
+__attribute__((target("clflushopt")))
+static void tb_flush_clflushopt(const void *addr, size_t len)
+{
+    uintptr_t line;
+
+    for (line = _LINE_START(addr); line < (uintptr_t)addr + len;
+         line += TB_CACHELINE_SIZE)
+        _mm_clflushopt((void *)line);
+}
+
+static void tb_flush_clflush(const void *addr, size_t len)
+{
+    uintptr_t line;
+
+    for (line = _LINE_START(addr); line < (uintptr_t)addr + len;
+         line += TB_CACHELINE_SIZE)
+        _mm_clflush((void *)line);
+}
+
+static void tb_drain_sfence(void)
+{
+    _mm_sfence();
+}
+#endif /* __x86_64__ */
+
+/* CPU가 지원하는 가장 넓은 non-temporal store를 고른다. */
+static void tb_nt_detect(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        tb_nt_copy_func = tb_nt_copy_avx512;
+        tb_nt_fill_func = tb_nt_fill_avx512;
+        tb_nt_name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        tb_nt_copy_func = tb_nt_copy_avx2;
+        tb_nt_fill_func = tb_nt_fill_avx2;
+        tb_nt_name = "avx2";
+    }
+    else
+    {
+        tb_nt_copy_func = tb_nt_copy_sse2;
+        tb_nt_fill_func = tb_nt_fill_sse2;
+        tb_nt_name = "sse2";
+    }
+#endif
+}
+
+/* CPU가 지원하는 가장 나은 flush 명령을 고른다. */
+static void tb_persist_detect(void)
+{
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        if (ebx & bit_CLWB)
+        {
+            tb_flush_func = tb_flush_clwb;
+            tb_drain_func = tb_drain_sfence;
+            tb_persist_name = "clwb";
+            return;
+        }
+        if (ebx & bit_CLFLUSHOPT)
+        {
+            tb_flush_func = tb_flush_clflushopt;
+            tb_drain_func = tb_drain_sfence;
+            tb_persist_name = "clflushopt";
+            return;
+        }
+    }
+
+    /* CLFLUSH는 x86-64에서 항상 지원한다. */
+    tb_flush_func = tb_flush_clflush;
+    tb_drain_func = tb_drain_none;
+    tb_persist_name = "clflush";
+#endif
+}
+
+__attribute__((constructor))
+static void tb_persist_init(void)
+{
+    tb_persist_detect();
+    tb_nt_detect();
+}
+
+/* TB_PERSIST_CPU일 때 쓰는 flush 명령의 이름 */
+const char *tb_persist_method(void)
+{
+    return tb_persist_name;
+}
+
+/* [addr, addr + len)을 포함하는 cache line들을 내보낸다. 완료는 tb_drain으로 기다린다. */
+void tb_flush(const void *addr, size_t len)
+{
+    tb_flush_func(addr, len);
+}
+
+/* 앞서 tb_flush 한 내용이 모두 durable 해질 때까지 기다린다. */
+void tb_drain(void)
+{
+    tb_drain_func();
+}
+
+void tb_persist(const void *addr, size_t len)
+{
+    tb_flush_func(addr, len);
+    tb_drain_func();
+}
+
+/**
+ * @brief mapping의 persist 방식(TB_PERSIST_*)에 따라 flush 한다.
+ *
+ * TB_PERSIST_MSYNC이면 msync가 끝날 때까지 기다리므로 tb_drain_as는 할 일이
+ * 없다. TB_PERSIST_NONE이면 아무것도 하지 않는다.
+ */
+void tb_flush_as(int method, const void *addr, size_t len)
+{
+    if (method == TB_PERSIST_CPU)
+        tb_flush_func(addr, len);
+    else if (method == TB_PERSIST_MSYNC)
+        tb_flush_msync(addr, len);
+}
+
+void tb_drain_as(int method)
+{
+    if (method == TB_PERSIST_CPU)
+        tb_drain_func();
+}
+
+void tb_persist_as(int method, const void *addr, size_t len)
+{
+    tb_flush_as(method, addr, len);
+    tb_drain_as(method);
+}
+
+/* 여러 구간을 flush 한 뒤 fence는 한 번만 한다. */
+void tb_persist_ranges(const tb_persist_range_t *ranges, int cnt)
+{
+    int i;
+
+    for (i = 0; i < cnt; i++)
+        tb_flush_func(ranges[i].addr, ranges[i].len);
+    tb_drain_func();
+}
+
+/* non-temporal store kernel의 이름 */
+const char *tb_pmem_nt_method(void)
+{
+    return tb_nt_name;
+}
+
+/* non-temporal store를 쓸 크기인지 */
+static inline bool tb_use_nt(size_t len)
+{
+    return IPARAM(_PMEM_NT_STORE_MIN_SIZE) > 0 &&
+           len >= IPARAM(_PMEM_NT_STORE_MIN_SIZE) &&
+           len >= 2 * TB_CACHELINE_SIZE;
+}
+
+/*
+ * non-temporal store로 [dst, dst + len)을 쓴 뒤 mapping의 persist 방식에 맞게
+ * 마무리한다. 앞(head)과 뒤(tail)는 일반 store로 써서 cache에 남아 있다.
+ * non-temporal store는 이후의 store와 순서가 보장되지 않으므로 volatile이어도
+ * sfence는 한다.
+ */
+static void tb_pmem_nt_finish(int method, void *dst, size_t len, size_t head,
+                              const void *tail, size_t tail_len)
+{
+    if (method == TB_PERSIST_CPU)
+    {
+        tb_flush_func(dst, head);
+        tb_flush_func(tail, tail_len);
+    }
+#if defined(__x86_64__)
+    _mm_sfence();
+#endif
+    if (method == TB_PERSIST_MSYNC)
+        tb_flush_msync(dst, len);
+}
+
+/* DAX mapping으로 복사한다. tb_pmem_memcpy_as(TB_PERSIST_CPU, ...)와 같다. */
+void *tb_pmem_memcpy(void *dst, const void *src, size_t len)
+{
+    return tb_pmem_memcpy_as(TB_PERSIST_CPU, dst, src, len);
+}
+
+/**
+ * @brief pmem으로 복사한다. 작으면 memcpy와 같다.
+ *
+ * dst가 cache line에 정렬될 때까지의 앞부분과 64 byte가 안 되는 뒷부분은
+ * memcpy로, 나머지는 non-temporal store로 쓴다. method가 TB_PERSIST_CPU이면
+ * cache에 남은 앞뒤 cache line을 flush 하고, TB_PERSIST_MSYNC이면 전체를
+ * msync 한다. TB_PERSIST_NONE이면 sfence만 한다.
+ */
+void *tb_pmem_memcpy_as(int method, void *dst, const void *src, size_t len)
+{
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+    size_t total = len, head, blocks;
+
+    if (!tb_use_nt(len))
+        return memcpy(dst, src, len);
+
+    head = (TB_CACHELINE_SIZE - ((uintptr_t)d & (TB_CACHELINE_SIZE - 1))) &
+           (TB_CACHELINE_SIZE - 1);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+
+    blocks = len / TB_CACHELINE_SIZE;
+    tb_nt_copy_func(d, s, blocks);
+    d += blocks * TB_CACHELINE_SIZE;
+    s += blocks * TB_CACHELINE_SIZE;
+
+    memcpy(d, s, len - blocks * TB_CACHELINE_SIZE);
+    tb_pmem_nt_finish(method, dst, total, head, d, len - blocks * TB_CACHELINE_SIZE);
+
+    return dst;
+}
+
+/* DAX mapping을 c로 채운다. tb_pmem_memset_as(TB_PERSIST_CPU, ...)와 같다. */
+void *tb_pmem_memset(void *dst, int c, size_t len)
+{
+    return tb_pmem_memset_as(TB_PERSIST_CPU, dst, c, len);
+}
+
+/* pmem을 c로 채운다. 작으면 memset과 같다. 마무리는 tb_pmem_memcpy_as와 같다. */
+void *tb_pmem_memset_as(int method, void *dst, int c, size_t len)
+{
+    char *d = (char *)dst;
+    size_t total = len, head, blocks;
+
+    if (!tb_use_nt(len))
+        return memset(dst, c, len);
+
+    head = (TB_CACHELINE_SIZE - ((uintptr_t)d & (TB_CACHELINE_SIZE - 1))) &
+           (TB_CACHELINE_SIZE - 1);
+    memset(d, c, head);
+    d += head;
+    len -= head;
+
+    blocks = len / TB_CACHELINE_SIZE;
+    tb_nt_fill_func(d, c, blocks);
+    d += blocks * TB_CACHELINE_SIZE;
+
+    memset(d, c, len - blocks * TB_CACHELINE_SIZE);
+    tb_pmem_nt_finish(method, dst, total, head, d, len - blocks * TB_CACHELINE_SIZE);
+
+    return dst;
+}
+
+/* end of pmem_persist.c */
@@ -0,0 +1,58 @@
+/**
+ * @file    pmem_persist.h
+ * @brief   pmem에 쓴 내용을 durable 하게 만드는 flush/fence API
+ *
+ * tb_flush로 cache line들을 내보내고 tb_drain으로 끝날 때까지 기다린다.
+ * tb_persist는 둘을 합친 것이다. CPU가 지원하는 명령 중 가장 나은 것
+ * (CLWB > CLFLUSHOPT > CLFLUSH)을 프로그램 시작 시 골라서 함수 pointer로
+ * 부른다.
+ *
+ * DAX(MAP_SYNC)가 아닌 mapping에서는 cache flush만으로는 파일에 반영되지
+ * 않으므로 msync를 써야 한다. 이는 mapping마다 다르므로 process 전체를
+ * 바꾸지 않고, mapping을 가진 쪽(pbuddy pool)이 TB_PERSIST_* 방식을 기억해
+ * 두었다가 tb_flush_as/tb_drain_as/tb_persist_as로 넘긴다.
+ *
+ * tb_pmem_memcpy/tb_pmem_memset은 _PMEM_NT_STORE_MIN_SIZE 이상이면 cache를
+ * 거치지 않는 non-temporal store(AVX-512 > AVX2 > SSE2)로 쓴다. LLC를 오염시키지
+ * 않고 read-for-ownership도 생기지 않는다. cache line에 맞지 않는 앞뒤
+ * 부분은 일반 store로 쓰고 flush 한 뒤, 끝나기 전에 sfence를 하므로 DAX
+ * mapping이면 따로 flush 하지 않아도 durable 하다. 그보다 작으면 일반
+ * memcpy/memset이므로 tb_persist 해야 한다. _as 변형은 mapping의 persist
+ * 방식을 받아서, volatile이면 flush 하지 않고 msync mapping이면 msync 한다.
+ */
+
+#ifndef _PMEM_PERSIST_H
+#define _PMEM_PERSIST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* mapping별 persist 방식 */
+#define TB_PERSIST_NONE  0   /* 내용이 남을 필요 없음 (volatile), 아무것도 안 함 */
+#define TB_PERSIST_CPU   1   /* DAX(MAP_SYNC) mapping, cache flush 명령 */
+#define TB_PERSIST_MSYNC 2   /* DAX가 아닌 shared mapping, msync */
+
+typedef struct tb_persist_range_s
+{
+    const void *addr;
+    size_t len;
+} tb_persist_range_t;
+
+void tb_flush(const void *addr, size_t len);
+void tb_drain(void);
+void tb_persist(const void *addr, size_t len);
+void tb_persist_ranges(const tb_persist_range_t *ranges, int cnt);
+
+void tb_flush_as(int method, const void *addr, size_t len);
+void tb_drain_as(int method);
+void tb_persist_as(int method, const void *addr, size_t len);
+
+const char *tb_persist_method(void);
+
+void *tb_pmem_memcpy(void *dst, const void *src, size_t len);
+void *tb_pmem_memset(void *dst, int c, size_t len);
+void *tb_pmem_memcpy_as(int method, void *dst, const void *src, size_t len);
+void *tb_pmem_memset_as(int method, void *dst, int c, size_t len);
+const char *tb_pmem_nt_method(void);
+
+#endif /* _PMEM_PERSIST_H */
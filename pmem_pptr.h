@@ -0,0 +1,110 @@
+/**
+ * @file    pmem_pptr.h
+ * @brief   pmem pool 안의 객체를 가리키는 C++ pointer (header-only)
+ *
+ * tb::pptr<T>는 주소 대신 pool offset을 저장하므로 pool 안에 그대로 두어도
+ * pool을 다른 주소에 다시 열거나 다른 process가 열었을 때 유효하다. 크기는
+ * 8 byte로 pbuddy_pool_ptr2off의 offset과 같으며, pbuddy_pool_tx_malloc의
+ * dest로 쓸 수 있다.
+ *
+ * 주소로 바꿀 때는 thread별로 cache 해둔 pool 시작 주소에 offset을 더한다.
+ * 기본은 PBUDDY_POOL이고, 다른 pool을 쓰거나 pool을 다시 열었으면 그 thread에서
+ * tb::pptr_set_pool을 불러야 한다. striped pool의 root는 mapping이 없으므로
+ * member pool을 넘겨야 한다.
+ */
+
+#ifndef _PMEM_PPTR_H
+#define _PMEM_PPTR_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+extern "C" {
+#include "pmem_buddy.h"
+}
+
+namespace tb {
+
+namespace detail {
+
+inline char *&pptr_base_cache()
+{
+    static thread_local char *base = nullptr;
+    return base;
+}
+
+} // namespace detail
+
+/* 이 thread의 pptr들이 가리킬 pool. NULL이면 다시 PBUDDY_POOL을 쓴다. */
+inline void pptr_set_pool(pbuddy_pool_t *pool)
+{
+    assert(pool == NULL || pool->stripe_cnt == 0);
+    detail::pptr_base_cache() = (pool == NULL) ? NULL : pool->map_addr;
+}
+
+inline char *pptr_base()
+{
+    char *&base = detail::pptr_base_cache();
+
+    if (__builtin_expect(base == NULL, 0))
+    {
+        assert(PBUDDY_POOL->stripe_cnt == 0);
+        base = PBUDDY_POOL->map_addr;
+    }
+    return base;
+}
+
+template <typename T>
+class pptr
+{
+public:
+    typedef typename std::add_lvalue_reference<T>::type reference;
+
+    pptr() noexcept : off_(0) {}
+    pptr(std::nullptr_t) noexcept : off_(0) {}
+    explicit pptr(T *ptr) noexcept
+        : off_(ptr == NULL ? 0 : (uint64_t)((char *)ptr - pptr_base())) {}
+
+    static pptr from_offset(uint64_t offset) noexcept
+    {
+        pptr p;
+        p.off_ = offset;
+        return p;
+    }
+
+    T *get() const noexcept
+    {
+        return off_ == 0 ? NULL : (T *)(pptr_base() + off_);
+    }
+
+    reference operator*() const noexcept { return *get(); }
+    T *operator->() const noexcept { return get(); }
+    explicit operator bool() const noexcept { return off_ != 0; }
+
+    template <typename U = T>
+    typename std::enable_if<!std::is_void<U>::value, U &>::type
+    operator[](std::ptrdiff_t i) const noexcept
+    {
+        return get()[i];
+    }
+
+    uint64_t offset() const noexcept { return off_; }
+
+    /* pbuddy_pool_tx_malloc/pbuddy_pool_tx_free의 dest로 넘길 위치 */
+    uint64_t *offset_ptr() noexcept { return &off_; }
+
+    bool operator==(const pptr &o) const noexcept { return off_ == o.off_; }
+    bool operator!=(const pptr &o) const noexcept { return off_ != o.off_; }
+
+private:
+    uint64_t off_;
+};
+
+static_assert(sizeof(pptr<int>) == sizeof(uint64_t), "pptr must stay 8 bytes");
+static_assert(std::is_standard_layout<pptr<int> >::value, "pptr is stored in pmem");
+
+} // namespace tb
+
+#endif /* _PMEM_PPTR_H */
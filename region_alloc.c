@@ -30,6 +30,7 @@
 #include "allocator.h"
 
 #include "pmem_buddy.h"
+#include "pmem_persist.h"
 
 #include "alloc_dbginfo.h"
 #include "alloc_dbginfo_dump.h"
@@ -50,6 +51,10 @@ static void region_delete(allocator_t *allocator, const char *file_delete, int l
 
 static void region_tracedump(dstream_t *dstrem, allocator_t *allocator, const char *indent);
 static void region_throw(allocator_t *allocator);
+static void *region_malloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                                const char *file, int line);
+static void *region_calloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                                const char *file, int line);
 
 static const allocator_desc_t region_allocator_desc = {
     region_malloc,
@@ -59,7 +64,9 @@ static const allocator_desc_t region_allocator_desc = {
     region_free,
     region_delete,
     region_tracedump,
-    region_throw
+    region_throw,
+    region_malloc_hint,
+    region_calloc_hint
 };
 
 alloc_parent_t *ROOT_ALLOC_PARENT = NULL;
@@ -82,8 +89,8 @@ static void region_previous_chunk_dump(dstream_t *ds, allocator_t *allocator,
 
 static allocator_t *
 sys_region_allocator_init(alloc_t *alloc, allocator_t *parent,
-                               tb_bool_t use_mutex, tb_bool_t use_pmem,
-                               const char *file, int line);
+                               tb_bool_t use_mutex, region_alloctype_t alloctype,
+                               pbuddy_pool_t *pool, const char *file, int line);
 
 /*************************************************************************
  * {{{ Allocator constructor/destructor
@@ -176,6 +183,9 @@ root_allocator_new(void)
         child->alloc_idx = n;
         child->total_size = 0;
         child->total_used = 0;
+        child->place_rule_cnt = 0;
+        memset(child->sub_heaps, 0, sizeof(child->sub_heaps));
+        memset(child->tier_used, 0, sizeof(child->tier_used));
 
         region = &(child->regions);
         region->prev = region->next = region;
@@ -207,8 +217,8 @@ system_allocator_new(tb_bool_t use_pmem, const char *file, int line)
 
 static allocator_t *
 sys_region_allocator_init(alloc_t *alloc, allocator_t *parent,
-                          tb_bool_t use_mutex, tb_bool_t use_pmem,
-                          const char *file, int line)
+                          tb_bool_t use_mutex, region_alloctype_t alloctype,
+                          pbuddy_pool_t *pool, const char *file, int line)
 {
     region_t *region;
     chunk_t *bin;
@@ -217,7 +227,9 @@ sys_region_allocator_init(alloc_t *alloc, allocator_t *parent,
     alloc->super.alloc_owner_id = (int)tb_get_thrid();
     alloc->super.logging = false;
 
-    if (use_pmem)
+    if (alloctype == REGION_ALLOC_HYBRID)
+        alloc->super.alloc_type = ALLOC_TYPE_REGION_HYBRID;
+    else if (alloctype == REGION_ALLOC_PMEM)
         alloc->super.alloc_type = ALLOC_TYPE_REGION_PMEM;
     else
         alloc->super.alloc_type = ALLOC_TYPE_REGION_SYS;
@@ -225,13 +237,17 @@ sys_region_allocator_init(alloc_t *alloc, allocator_t *parent,
     alloc->super.desc = &region_allocator_desc;
 
     if (parent) {
-        if (use_pmem)
+        if (alloctype == REGION_ALLOC_HYBRID)
+            strcpy(alloc->super.name, "(HYBRID region allocator)");
+        else if (alloctype == REGION_ALLOC_PMEM)
             strcpy(alloc->super.name, "(PMEM region allocator)");
         else
             strcpy(alloc->super.name, "(region allocator)");
     }
     else {
-        if (use_pmem)
+        if (alloctype == REGION_ALLOC_HYBRID)
+            strcpy(alloc->super.name, "(HYBRID SYSTEM ALLOC)");
+        else if (alloctype == REGION_ALLOC_PMEM)
             strcpy(alloc->super.name, "(PMEM SYSTEM ALLOC)");
         else
             strcpy(alloc->super.name, "(SYSTEM ALLOC)");
@@ -262,10 +278,13 @@ sys_region_allocator_init(alloc_t *alloc, allocator_t *parent,
     if (parent != NULL)
         list_add_tail(&alloc->super.link, &parent->child);
 
-    if (use_pmem)
-        alloc->alloctype = REGION_ALLOC_PMEM;
-    else
-        alloc->alloctype = REGION_ALLOC_SYS;
+    alloc->alloctype = alloctype;
+    alloc->pool = pool;
+    alloc->dram_budget = 0;
+    alloc->dram_size = 0;
+    alloc->place_rule_cnt = 0;
+    memset(alloc->sub_heaps, 0, sizeof(alloc->sub_heaps));
+    memset(alloc->tier_used, 0, sizeof(alloc->tier_used));
     alloc->alloc_idx = 0;
     alloc->total_size = 0;
     alloc->total_used = 0;
@@ -306,6 +325,36 @@ region_allocator_new_internal(allocator_t *parent,
                               tb_bool_t use_mutex,
                               tb_bool_t use_pmem,
                               const char *file, int line)
+{
+    pbuddy_pool_t *pool = NULL;
+
+    /* PMEM, HYBRID allocator의 child는 parent와 같은 pool을 쓴다. */
+    if (use_pmem) {
+        if (parent != NULL && (parent->alloc_type == ALLOC_TYPE_REGION_PMEM ||
+                               parent->alloc_type == ALLOC_TYPE_REGION_HYBRID))
+            pool = ((alloc_t *)parent)->pool;
+        else
+            pool = PBUDDY_POOL;
+
+        if (pool == NULL)
+            return NULL;
+    }
+
+    return region_pool_allocator_new_internal(parent, use_mutex, pool, file,
+                                              line);
+} /* real_sys_region_allocator_new */
+
+/**
+ * @brief   pool에서 region을 받는 PMEM region allocator를 생성한다.
+ *
+ * @param[in]   pool    pmem pool. NULL이면 system memory를 쓰는 region
+ *                      allocator를 만든다.
+ */
+allocator_t *
+region_pool_allocator_new_internal(allocator_t *parent,
+                                   tb_bool_t use_mutex,
+                                   pbuddy_pool_t *pool,
+                                   const char *file, int line)
 {
     alloc_t *alloc;
 
@@ -315,10 +364,98 @@ region_allocator_new_internal(allocator_t *parent,
     if (alloc == NULL)
         return NULL;
 
-    sys_region_allocator_init(alloc, parent, use_mutex, use_pmem, file,
-                                   line);
+    sys_region_allocator_init(alloc, parent, use_mutex,
+                              pool != NULL ? REGION_ALLOC_PMEM : REGION_ALLOC_SYS,
+                              pool, file, line);
     return &alloc->super;
-} /* real_sys_region_allocator_new */
+} /* region_pool_allocator_new_internal */
+
+/**
+ * @brief   DRAM과 pmem에서 region을 받는 hybrid region allocator를 생성한다.
+ *
+ * @param[in]   dram_budget  DRAM에서 받을 region 크기의 합의 상한.
+ *                           0이면 _HYBRID_DRAM_BUDGET.
+ *
+ * 새 region이 budget 안에 들어가면 DRAM에서, 넘으면 pmem pool에서 받는다.
+ * DRAM region이 반납되면 그만큼 다시 DRAM에서 받을 수 있다. pool은 parent가
+ * PMEM, HYBRID allocator이면 parent의 pool, 아니면 PBUDDY_POOL을 쓴다.
+ */
+allocator_t *
+region_hybrid_allocator_new_internal(allocator_t *parent,
+                                     tb_bool_t use_mutex,
+                                     uint64_t dram_budget,
+                                     const char *file, int line)
+{
+    alloc_t *alloc;
+    pbuddy_pool_t *pool;
+
+    if (parent != NULL && (parent->alloc_type == ALLOC_TYPE_REGION_PMEM ||
+                           parent->alloc_type == ALLOC_TYPE_REGION_HYBRID))
+        pool = ((alloc_t *)parent)->pool;
+    else
+        pool = PBUDDY_POOL;
+
+    if (pool == NULL)
+        return NULL;
+
+    alloc = malloc(sizeof(alloc_t));
+
+    if (alloc == NULL)
+        return NULL;
+
+    sys_region_allocator_init(alloc, parent, use_mutex, REGION_ALLOC_HYBRID,
+                              pool, file, line);
+    alloc->dram_budget = (dram_budget != 0) ? dram_budget
+                                            : IPARAM(_HYBRID_DRAM_BUDGET);
+    return &alloc->super;
+} /* region_hybrid_allocator_new_internal */
+
+/* alloc의 region이 기본으로 놓이는 tier. hybrid는 DRAM을 먼저 쓴다. */
+static inline alloc_tier_t
+region_home_tier(alloc_t *alloc)
+{
+    return (alloc->alloctype == REGION_ALLOC_PMEM) ? ALLOC_TIER_PMEM
+                                                   : ALLOC_TIER_DRAM;
+}
+
+/**
+ * @brief   alloc의 n번째 sub heap을 돌려준다. 없으면 만든다.
+ *
+ * sub heap은 allocator tree에는 넣지 않고 alloc의 mutex로 같이 보호한다.
+ * PMEM sub heap은 alloc의 pool(없으면 PBUDDY_POOL)에서 region을 받는다.
+ *
+ * @return  만들 수 없으면 NULL.
+ */
+static alloc_t *
+region_sub_heap(alloc_t *alloc, int n)
+{
+    alloc_t *heap = alloc->sub_heaps[n];
+    pbuddy_pool_t *pool = (alloc->pool != NULL) ? alloc->pool : PBUDDY_POOL;
+    region_alloctype_t type;
+
+    if (heap != NULL)
+        return heap;
+
+    type = (n % ALLOC_TIER_CNT == ALLOC_TIER_PMEM) ? REGION_ALLOC_PMEM
+                                                   : REGION_ALLOC_SYS;
+    if (type == REGION_ALLOC_PMEM && pool == NULL)
+        return NULL;
+
+    heap = malloc(sizeof(alloc_t));
+    if (heap == NULL)
+        return NULL;
+
+    sys_region_allocator_init(heap, NULL, false, type,
+                              (type == REGION_ALLOC_PMEM) ? pool : NULL,
+                              alloc->super.file, alloc->super.line);
+    heap->alloc_idx = ALLOC_SUB_HEAP_IDX(n);
+    allocator_setname(&heap->super, "(%s%s sub heap)",
+                      (type == REGION_ALLOC_PMEM) ? "PMEM" : "DRAM",
+                      (n >= ALLOC_TIER_CNT) ? " transient" : "");
+
+    alloc->sub_heaps[n] = heap;
+    return heap;
+} /* region_sub_heap */
 
 
 #ifdef TB_DEBUG
@@ -367,6 +504,51 @@ region_redzone_check(allocator_t *allocator, region_t *region)
 #endif
 
 
+/* sub heap들의 region을 모두 반납하고 sub heap을 지운다. */
+static void
+region_sub_heaps_delete(alloc_t *alloc)
+{
+    alloc_t *heap;
+    region_t *head, *region, *next;
+    int n;
+
+    for (n = 0; n < ALLOC_SUB_HEAP_CNT; n++) {
+        heap = alloc->sub_heaps[n];
+        if (heap == NULL)
+            continue;
+
+        head = &(heap->regions);
+        for (region = head->next; region != head; region = next) {
+            next = region->next;
+            region_redzone_check(&(alloc->super), region);
+            if (alloc_in_pmem(heap, region))
+                pbuddy_pool_free(heap->pool, region);
+            else if (use_root_allocator)
+                tb_root_free(region);
+            else
+                free_page(region, region->size);
+        }
+
+        free(heap);
+        alloc->sub_heaps[n] = NULL;
+    }
+} /* region_sub_heaps_delete */
+
+/* sub heap들이 받아둔 region 크기의 합 */
+static uint64_t
+region_sub_heaps_size(alloc_t *alloc)
+{
+    uint64_t size = 0;
+    int n;
+
+    for (n = 0; n < ALLOC_SUB_HEAP_CNT; n++) {
+        if (alloc->sub_heaps[n] != NULL)
+            size += alloc->sub_heaps[n]->total_size;
+    }
+
+    return size;
+} /* region_sub_heaps_size */
+
 /**
  * @brief   region allocator를 삭제한다.
  *
@@ -415,19 +597,21 @@ region_delete(allocator_t *allocator, const char *file_delete, int line_delete)
     switch (alloc->alloctype) {
     case REGION_ALLOC_SYS:
     case REGION_ALLOC_PMEM:
+    case REGION_ALLOC_HYBRID:
         head = &(alloc->regions);
         for (region = head->next; region != head; region = next) {
             next = region->next;
 #ifdef TB_DEBUG
             region_redzone_check(allocator, region);
 #endif
-            if (alloc->alloctype == REGION_ALLOC_PMEM)
-                pbuddy_free(region, region->size);
+            if (alloc_in_pmem(alloc, region))
+                pbuddy_pool_free(alloc->pool, region);
             else if (use_root_allocator)
                 tb_root_free(region);
             else
                 free_page(region, region->size);
         }
+        region_sub_heaps_delete(alloc);
 
         if (allocator->use_mutex)
             MUTEX_DESTROY(&(allocator->mutex));
@@ -521,24 +705,29 @@ allocator_cleanup(allocator_t *allocator)
     switch (alloc->alloctype) {
     case REGION_ALLOC_SYS:
     case REGION_ALLOC_PMEM:
+    case REGION_ALLOC_HYBRID:
         /* 이미 cleanup 된 allocator라면 아래 작업들도 생략해 주자. */
-        if (alloc->total_size == 0)
+        if (alloc->total_size == 0 && region_sub_heaps_size(alloc) == 0)
             break;
 
         head = &(alloc->regions);
         for (region = head->next; region != head; region = next) {
             next = region->next;
             region_redzone_check(allocator, region);
-            if (alloc->alloctype == REGION_ALLOC_PMEM)
-                pbuddy_free(region, region->size);
+            if (alloc_in_pmem(alloc, region))
+                pbuddy_pool_free(alloc->pool, region);
             else if (use_root_allocator)
                 tb_root_free(region);
             else
                 free_page(region, region->size);
         }
 
+        region_sub_heaps_delete(alloc);
+
         alloc->total_size = 0;
         alloc->total_used = 0;
+        alloc->dram_size = 0;
+        memset(alloc->tier_used, 0, sizeof(alloc->tier_used));
 
         region = &(alloc->regions);
         region->prev = region->next = region;
@@ -618,7 +807,12 @@ root_allocator_delete()
 tb_bool_t tballoc_init_internal(const char *file, int line)
 {
     root_allocator_new();
-    if (pbuddy_alloc_init(IPARAM(PMEM_DIR), NULL, IPARAM(PMEM_MAX_SIZE), IPARAM(PMEM_ALLOC_SIZE)) == NULL)
+    if (IPARAM(PMEM_POOL_NAME) != NULL) {
+        if (pbuddy_alloc_open(IPARAM(PMEM_DIR), IPARAM(PMEM_POOL_NAME), NULL,
+                              IPARAM(PMEM_MAX_SIZE), IPARAM(PMEM_ALLOC_SIZE)) == NULL)
+            goto error;
+    }
+    else if (pbuddy_alloc_init(IPARAM(PMEM_DIR), NULL, IPARAM(PMEM_MAX_SIZE), IPARAM(PMEM_ALLOC_SIZE)) == NULL)
         goto error;
 
     SYSTEM_ALLOC = system_allocator_new(false, file, line);
@@ -728,19 +922,106 @@ tb_root_free(void *in_ptr)
  * {{{ Public allocator API
  *************************************************************************/
 
+/**
+ * @brief   hint와 placement policy에 따라 bytes 크기의 요청을 받을 heap을 고른다.
+ *
+ * HOT은 DRAM, COLD는 PMEM으로 정하고 (둘 다 주면 HOT), 아니면 policy를
+ * 따르며 policy도 없으면 alloc 자신의 tier다. alloc 자신의 tier로 정해지면
+ * alloc을, 아니면 그 tier의 sub heap을 돌려준다. TRANSIENT는 수명이 짧은
+ * 객체가 오래 사는 객체 사이에 구멍을 남기지 않도록 tier마다 따로 둔 sub
+ * heap에서 받는다. HYBRID allocator는 DRAM budget을 넘으면 pool로 넘어가므로
+ * HOT이면 DRAM sub heap에서 받는다. sub heap을 만들 수 없으면 alloc에서
+ * 받는다. mutex를 잡고 부른다.
+ */
+static inline alloc_t *
+region_hint_heap(alloc_t *alloc, int64_t bytes, int flags)
+{
+    alloc_tier_t home = region_home_tier(alloc);
+    alloc_tier_t tier = home;
+    tb_bool_t transient = (flags & TB_ALLOC_HINT_TRANSIENT) != 0;
+    alloc_t *heap;
+    int i;
+
+    if (flags & TB_ALLOC_HINT_HOT) {
+        tier = ALLOC_TIER_DRAM;
+    } else if (flags & TB_ALLOC_HINT_COLD) {
+        tier = ALLOC_TIER_PMEM;
+    } else if (alloc->place_rule_cnt > 0) {
+        for (i = 0; i < alloc->place_rule_cnt - 1; i++) {
+            if ((uint64_t)bytes <= alloc->place_rules[i].max_size)
+                break;
+        }
+        tier = alloc->place_rules[i].tier;
+    }
+
+    /* ROOT allocator는 alloc_idx를 child 번호로 쓰므로 sub heap을 두지 않는다. */
+    if (alloc->alloctype == REGION_ALLOC_ROOT)
+        return alloc;
+
+    if (!transient && tier == home &&
+        !((flags & TB_ALLOC_HINT_HOT) && alloc->alloctype == REGION_ALLOC_HYBRID))
+        return alloc;
+
+    heap = region_sub_heap(alloc, ALLOC_SUB_HEAP(tier, transient));
+
+    return (heap != NULL) ? heap : alloc;
+} /* region_hint_heap */
+
+/* chunk를 할당한 heap (alloc 또는 alloc의 sub heap) */
+static inline alloc_t *
+region_heap_of(alloc_t *alloc, chunk_t *chunk)
+{
+    int idx = GET_ALLOC_IDX(chunk);
+
+    if (idx >= ALLOC_SUB_HEAP_IDX(0) &&
+        idx < ALLOC_SUB_HEAP_IDX(ALLOC_SUB_HEAP_CNT) &&
+        alloc->sub_heaps[idx - ALLOC_SUB_HEAP_IDX(0)] != NULL)
+        return alloc->sub_heaps[idx - ALLOC_SUB_HEAP_IDX(0)];
+
+    return alloc;
+} /* region_heap_of */
+
+/* chunk가 놓인 tier */
+static inline alloc_tier_t
+region_chunk_tier(alloc_t *heap, chunk_t *chunk)
+{
+    return alloc_in_pmem(heap, chunk) ? ALLOC_TIER_PMEM : ALLOC_TIER_DRAM;
+}
+
+/* region_malloc이 돌려준 ptr이 놓인 tier */
+static inline alloc_tier_t
+region_mem_tier(alloc_t *alloc, void *ptr)
+{
+    chunk_t *chunk = MEM2CHUNK(_ALLOC_MEM2DBGINFO(ptr));
+
+    return region_chunk_tier(region_heap_of(alloc, chunk), chunk);
+}
+
+/* pmem tier에 있는 ptr이 놓인 pool의 persist 방식 */
+static inline int
+region_mem_persist(alloc_t *alloc, void *ptr)
+{
+    chunk_t *chunk = MEM2CHUNK(_ALLOC_MEM2DBGINFO(ptr));
+
+    return alloc_pmem_persist(region_heap_of(alloc, chunk), ptr);
+}
+
 /**
  * @brief   malloc과 valloc이 거의 동일하므로 공통 루틴을 뽑아냈다.
  *
  * @param[in]   allocator
  * @param[in]   bytes
  * @param[in]   valloc      : true면 valloc, false면 일반 malloc
+ * @param[in]   flags       : TB_ALLOC_HINT_*
  */
 static inline void *
 region_malloc_internal(allocator_t *allocator, int64_t bytes,
-                       const tb_bool_t valloc, const char *file, int line)
+                       const tb_bool_t valloc, int flags,
+                       const char *file, int line)
 {
     uint64_t req_size;
     alloc_t *alloc = (alloc_t *) allocator;
+    alloc_t *heap;
     chunk_t *chunk;
     char *mem;
     csize_t chunksize;
@@ -761,7 +1042,8 @@ region_malloc_internal(allocator_t *allocator, int64_t bytes,
     TB_THR_ASSERT4(req_size < MAX_CHUNK_SIZE,
                    bytes, req_size, MAX_CHUNK_SIZE, line);
 
-    chunk = malloc_internal (alloc, req_size);
+    heap = region_hint_heap(alloc, bytes, flags);
+    chunk = malloc_internal (heap, req_size);
 
     if (chunk == NULL) {
         if (alloc->super.use_mutex)
@@ -784,6 +1066,7 @@ region_malloc_internal(allocator_t *allocator, int64_t bytes,
 
     chunksize = GET_CHUNKSIZE(chunk);
     alloc->total_used += chunksize;
+    alloc->tier_used[region_chunk_tier(heap, chunk)] += chunksize;
 
 #ifdef _ALLOC_USE_DBGINFO
     alloc_init_redzone(&(alloc->super), mem, bytes, valloc, file, line);
@@ -811,9 +1094,21 @@ region_malloc_internal(allocator_t *allocator, int64_t bytes,
 static void *
 region_malloc(allocator_t *allocator, int64_t bytes, const char *file, int line)
 {
-    return region_malloc_internal(allocator, bytes, false, file, line);
+    return region_malloc_internal(allocator, bytes, false, 0, file, line);
 } /* region_malloc */
 
+/**
+ * @brief   flags(TB_ALLOC_HINT_*)에 따라 tier와 region을 골라 할당한다.
+ *
+ * STREAMING은 초기화할 때만 의미가 있으므로 region_calloc_hint에서 쓴다.
+ */
+static void *
+region_malloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                   const char *file, int line)
+{
+    return region_malloc_internal(allocator, bytes, false, flags, file, line);
+} /* region_malloc_hint */
+
 static inline void *
 tb_valloc_internal(allocator_t *alloc, uint bytes, const char* file, int line)
 {
@@ -904,12 +1199,46 @@ region_calloc(allocator_t *allocator, int64_t bytes, const char *file, int line)
     void *ptr;
 
     ptr = region_malloc(allocator, bytes, file, line);
-    if (ptr != NULL)
+    if (ptr == NULL)
+        return NULL;
+
+    /* pmem은 큰 크기면 cache를 거치지 않고 채운다. */
+    if (region_mem_tier((alloc_t *)allocator, ptr) == ALLOC_TIER_PMEM)
+        tb_pmem_memset_as(region_mem_persist((alloc_t *)allocator, ptr), ptr,
+                          0x00, bytes);
+    else
         memset(ptr, 0x00, bytes);
 
     return ptr;
 } /* region_calloc */
 
+/**
+ * @brief   region_malloc_hint 후 0으로 초기화한다.
+ *
+ * STREAMING이면 다시 읽지 않을 buffer로 cache를 채우지 않도록 tier와 상관없이
+ * non-temporal store로 채운다.
+ */
+static void *
+region_calloc_hint(allocator_t *allocator, int64_t bytes, int flags,
+                   const char *file, int line)
+{
+    void *ptr;
+
+    ptr = region_malloc_hint(allocator, bytes, flags, file, line);
+    if (ptr == NULL)
+        return NULL;
+
+    if (region_mem_tier((alloc_t *)allocator, ptr) == ALLOC_TIER_PMEM)
+        tb_pmem_memset_as(region_mem_persist((alloc_t *)allocator, ptr), ptr,
+                          0x00, bytes);
+    else if (flags & TB_ALLOC_HINT_STREAMING)
+        tb_pmem_memset_as(TB_PERSIST_NONE, ptr, 0x00, bytes);
+    else
+        memset(ptr, 0x00, bytes);
+
+    return ptr;
+} /* region_calloc_hint */
+
 
 /**
  * @brief   할당받은 memory의 크기를 바꾸는 함수
@@ -924,9 +1253,11 @@ static void *
 region_realloc(allocator_t *allocator, void *ptr, int64_t bytes, const char *file, int line)
 {
     alloc_t *alloc = (alloc_t *)allocator;
+    alloc_t *heap;
     chunk_t *chunk;
     csize_t oldsize;
     csize_t newsize;
+    alloc_tier_t oldtier;
     char *mem;
     void *base = ptr;
     dstream_t *ds = &debug_dstream;
@@ -959,7 +1290,10 @@ region_realloc(allocator_t *allocator, void *ptr, int64_t bytes, const char *fil
                        alloc->total_used, oldsize);
     }
 
-    chunk = realloc_internal(alloc, MEM2CHUNK(base),
+    /* sub heap의 chunk는 sub heap 안에서 옮긴다. */
+    heap = region_heap_of(alloc, MEM2CHUNK(base));
+    oldtier = region_chunk_tier(heap, MEM2CHUNK(base));
+    chunk = realloc_internal(heap, MEM2CHUNK(base),
                              REQUEST2SIZE(_ALLOC_ADD_DBGINFO_SIZE(bytes)));
 
     if (chunk == NULL) {
@@ -983,6 +1317,8 @@ region_realloc(allocator_t *allocator, void *ptr, int64_t bytes, const char *fil
     newsize = GET_CHUNKSIZE(chunk);
     alloc->total_used -= oldsize;
     alloc->total_used += newsize;
+    alloc->tier_used[oldtier] -= oldsize;
+    alloc->tier_used[region_chunk_tier(heap, chunk)] += newsize;
 
 #ifdef _ALLOC_USE_DBGINFO
     alloc_init_redzone(&(alloc->super), mem, bytes, false, file, line);
@@ -1010,6 +1346,7 @@ region_free(allocator_t *allocator, void *ptr, const char *file, int line)
     chunk_t *chunk;
     csize_t chunksize;
     alloc_t *alloc = (alloc_t *) allocator;
+    alloc_t *heap;
     dstream_t *ds = &debug_dstream;
     tb_bool_t reuse;
 
@@ -1071,17 +1408,271 @@ region_free(allocator_t *allocator, void *ptr, const char *file, int line)
     }
     alloc->total_used -= chunksize;
 
+    heap = region_heap_of(alloc, chunk);
+    alloc->tier_used[region_chunk_tier(heap, chunk)] -= chunksize;
+
     /* 재사용을 위해서 실제로 해제하지 않는 경우. */
     reuse = (alloc->alloctype == REGION_ALLOC_ROOT &&
              alloc->total_size <= IPARAM(_ROOT_ALLOCATOR_RUSZE_SIZE));
 
-    free_internal(alloc, MEM2CHUNK(base), reuse);
+    free_internal(heap, MEM2CHUNK(base), reuse);
 
     if (alloc->super.use_mutex)
         MUTEX_UNLOCK(&alloc->super.mutex);
 
 } /* region_free */
 
+/* 두 allocator의 mutex를 주소 순서로 잡는다. */
+static void
+region_lock_pair(alloc_t *a, alloc_t *b)
+{
+    alloc_t *first = (a < b) ? a : b;
+    alloc_t *second = (a < b) ? b : a;
+
+    if (first->super.use_mutex)
+        MUTEX_LOCK(&first->super.mutex);
+    if (second != first && second->super.use_mutex)
+        MUTEX_LOCK(&second->super.mutex);
+} /* region_lock_pair */
+
+static void
+region_unlock_pair(alloc_t *a, alloc_t *b)
+{
+    if (a->super.use_mutex)
+        MUTEX_UNLOCK(&a->super.mutex);
+    if (b != a && b->super.use_mutex)
+        MUTEX_UNLOCK(&b->super.mutex);
+} /* region_unlock_pair */
+
+/* region을 heap의 region 목록에서 찾는다. chunk가 region의 첫 chunk일 때만
+ * 돌려준다. */
+static region_t *
+region_first_chunk_of(alloc_t *heap, chunk_t *chunk)
+{
+    region_t *head = &(heap->regions);
+    region_t *region;
+
+    for (region = head->next; region != head; region = region->next) {
+        if (REGION2CHUNK(region) == chunk)
+            return region;
+    }
+
+    return NULL;
+} /* region_first_chunk_of */
+
+/* region을 복사하지 않고 to가 받을 수 있는지. region은 이미 to가 region을
+ * 받는 tier와 pool에 있어야 한다. */
+static tb_bool_t
+region_can_adopt(alloc_t *from, alloc_t *to, region_t *region)
+{
+    tb_bool_t in_pmem = alloc_in_pmem(from, region);
+
+    switch (to->alloctype) {
+    case REGION_ALLOC_SYS:
+        return !in_pmem;
+    case REGION_ALLOC_PMEM:
+        return in_pmem && from->pool == to->pool;
+    case REGION_ALLOC_HYBRID:
+        if (in_pmem)
+            return from->pool == to->pool;
+        return to->dram_size + region->size <= to->dram_budget;
+    default:
+        return false;
+    }
+} /* region_can_adopt */
+
+/**
+ * @brief   chunk 하나가 region 전체를 차지하면 region째로 from에서 to로
+ *          넘긴다. 두 allocator의 mutex를 잡고 부른다.
+ *
+ * chunk 뒤에 region을 채우지 못한 free chunk가 하나 있어도 같이 넘긴다.
+ *
+ * @return  넘기지 못했으면 false. 이때는 아무것도 바뀌지 않는다.
+ */
+static tb_bool_t
+region_hand_off(alloc_t *from, alloc_t *to, chunk_t *chunk, int64_t bytes)
+{
+    alloc_t *fheap = region_heap_of(from, chunk);
+    alloc_t *theap;
+    region_t *region;
+    chunk_t *next;
+    csize_t chunksize = GET_CHUNKSIZE(chunk);
+    csize_t nextsize = 0;
+    alloc_tier_t tier;
+
+    if (from->alloctype == REGION_ALLOC_ROOT || to->alloctype == REGION_ALLOC_ROOT)
+        return false;
+
+    region = region_first_chunk_of(fheap, chunk);
+    if (region == NULL)
+        return false;
+
+    next = CHUNK_PLUS_OFFSET(chunk, chunksize);
+    if ((next->head & FOOTER_BIT) == 0) {
+        if (CINUSE(next))
+            return false;
+        nextsize = GET_FREECHUNKSIZE(next);
+        if ((CHUNK_PLUS_OFFSET(next, nextsize)->head & FOOTER_BIT) == 0)
+            return false;
+    }
+
+    theap = region_hint_heap(to, bytes, 0);
+    if (!region_can_adopt(fheap, theap, region))
+        return false;
+
+    tier = region_chunk_tier(fheap, chunk);
+
+    /* 뒤의 free chunk는 from의 bin에서 빼서 to의 bin에 넣는다. */
+    if (nextsize > 0) {
+        if (next == fheap->dv) {
+            fheap->dv = NULL;
+            fheap->dvsize = 0;
+        }
+        else
+            unlink_chunk(fheap, next, nextsize);
+        insert_chunk(theap, next, nextsize);
+    }
+
+    region->prev->next = region->next;
+    region->next->prev = region->prev;
+    fheap->total_size -= region->size;
+    if (fheap->alloctype == REGION_ALLOC_HYBRID && tier == ALLOC_TIER_DRAM)
+        fheap->dram_size -= region->size;
+
+    region->prev = &(theap->regions);
+    region->next = theap->regions.next;
+    theap->regions.next->prev = region;
+    theap->regions.next = region;
+    theap->total_size += region->size;
+    if (theap->alloctype == REGION_ALLOC_HYBRID && tier == ALLOC_TIER_DRAM)
+        theap->dram_size += region->size;
+
+    chunk->head = (chunk->head & ~ALLOC_IDX_MASK) |
+                  ALLOC_CHUNK_BITS(theap->alloc_idx);
+
+    from->total_used -= chunksize;
+    from->tier_used[tier] -= chunksize;
+    to->total_used += chunksize;
+    to->tier_used[tier] += chunksize;
+
+    return true;
+} /* region_hand_off */
+
+/**
+ * @brief   from에서 할당받은 ptr을 to로 옮긴다.
+ *
+ * realloc처럼 옮긴 주소를 돌려주며, 실패하면 NULL을 돌려주고 ptr은 from에
+ * 그대로 남는다. 성공하면 ptr은 to에서 free 해야 한다.
+ *
+ * chunk 하나가 region 전체를 차지하고 region이 이미 to가 쓰는 tier(pmem이면
+ * 같은 pool)에 있으면 region째로 넘기므로 주소가 바뀌지 않는다. 아니면 to에서
+ * 새로 받아 복사하고 from에서 free 한다. pmem으로는 cache를 거치지 않고
+ * 복사한다. valloc으로 받은 memory는 옮길 수 없다.
+ */
+void *
+tb_move_internal(void *ptr, allocator_t *from_alloc, allocator_t *to_alloc,
+                 const char *file, int line)
+{
+    alloc_t *from = (alloc_t *) from_alloc;
+    alloc_t *to = (alloc_t *) to_alloc;
+    void *base;
+    chunk_t *chunk;
+    int64_t bytes;
+    void *newptr;
+    tb_bool_t moved;
+
+    if (ptr == NULL || from == to)
+        return ptr;
+
+    base = _ALLOC_MEM2DBGINFO(ptr);
+    chunk = MEM2CHUNK(base);
+    if (GET_CHUNKSIZE(chunk) == 0) {
+        fprintf(stderr, "tb_move: cannot move valloc memory %p. "
+                "file: %s line: %d\n", ptr, file, line);
+        return NULL;
+    }
+
+#ifdef _ALLOC_USE_DBGINFO
+    bytes = ((alloc_dbginfo_t *) base)->size;
+#else
+    bytes = GET_CHUNKSIZE(chunk) - CHUNK_OVERHEAD;
+#endif
+
+    region_lock_pair(from, to);
+#ifdef _ALLOC_USE_DBGINFO
+    alloc_check_redzone(&(from->super), base, false);
+#endif
+    moved = region_hand_off(from, to, chunk, bytes);
+#ifdef _ALLOC_USE_DBGINFO
+    if (moved)
+        alloc_init_redzone(&(to->super), base, bytes, false, file, line);
+#endif
+    region_unlock_pair(from, to);
+
+    if (moved)
+        return ptr;
+
+    newptr = region_malloc(to_alloc, bytes, file, line);
+    if (newptr == NULL)
+        return NULL;
+
+    if (region_mem_tier(to, newptr) == ALLOC_TIER_PMEM)
+        tb_pmem_memcpy_as(region_mem_persist(to, newptr), newptr, ptr, bytes);
+    else
+        memcpy(newptr, ptr, bytes);
+
+    region_free(from_alloc, ptr, file, line);
+
+    return newptr;
+} /* tb_move_internal */
+
+/**
+ * @brief   size별로 DRAM과 PMEM 중 어디에서 받을지 정한다.
+ *
+ * @param[in]   rules     max_size가 커지는 순서. rule_cnt가 0이면 policy를
+ *                        없앤다.
+ *
+ * 요청 크기 이하인 첫 줄의 tier를 따르고, 마지막 줄보다 크면 마지막 줄의
+ * tier를 따른다. allocator 자신과 다른 tier는 내부 sub heap에서 받으므로
+ * allocator 하나로 두 tier를 모두 쓸 수 있다. 이미 할당된 chunk는 옮기지
+ * 않으며, realloc은 원래 chunk가 있던 heap 안에서 한다.
+ *
+ * @return  region allocator가 아니거나 rules가 잘못되었으면 false.
+ */
+tb_bool_t
+allocator_set_placement(allocator_t *allocator,
+                        const alloc_place_rule_t *rules, int rule_cnt)
+{
+    alloc_t *alloc = (alloc_t *) allocator;
+    int i;
+
+    if (allocator->alloc_type != ALLOC_TYPE_REGION_SYS &&
+        allocator->alloc_type != ALLOC_TYPE_REGION_PMEM &&
+        allocator->alloc_type != ALLOC_TYPE_REGION_HYBRID)
+        return false;
+
+    if (rule_cnt < 0 || rule_cnt > ALLOC_PLACE_MAX_RULES)
+        return false;
+
+    for (i = 0; i < rule_cnt; i++) {
+        if (rules[i].tier != ALLOC_TIER_DRAM && rules[i].tier != ALLOC_TIER_PMEM)
+            return false;
+        if (i > 0 && rules[i].max_size <= rules[i - 1].max_size)
+            return false;
+    }
+
+    if (alloc->super.use_mutex)
+        MUTEX_LOCK(&alloc->super.mutex);
+
+    memcpy(alloc->place_rules, rules, sizeof(alloc_place_rule_t) * rule_cnt);
+    alloc->place_rule_cnt = rule_cnt;
+
+    if (alloc->super.use_mutex)
+        MUTEX_UNLOCK(&alloc->super.mutex);
+
+    return true;
+} /* allocator_set_placement */
+
 /**
  * @brief   allocator의 상태를 출력하는 함수
  *
@@ -1103,6 +1694,17 @@ region_tracedump(dstream_t *dstream, allocator_t *allocator, const char *indent)
             indent, (uint64_t) alloc->total_size,
             indent, (uint64_t) alloc->total_used);
 
+    dprint(dstream,
+           "%s  "LLU" bytes are used in DRAM, "LLU" bytes in PMEM.\n",
+           indent, (uint64_t) alloc->tier_used[ALLOC_TIER_DRAM],
+           (uint64_t) alloc->tier_used[ALLOC_TIER_PMEM]);
+
+    if (alloc->alloctype == REGION_ALLOC_HYBRID)
+        dprint(dstream,
+               "%s  "LLU" bytes are in DRAM regions (budget "LLU").\n",
+               indent, (uint64_t) alloc->dram_size,
+               (uint64_t) alloc->dram_budget);
+
     dprint(dstream, "%s  beginning sanity check...\n", indent);
 } /* region_tracedump */
 
@@ -1255,7 +1857,8 @@ get_alloc_used_size_including_childs(allocator_t *allocator)
 uint64_t 
 get_total_size(allocator_t *alloc)
 {
-    return ((alloc_t *)alloc)->total_size;
+    return ((alloc_t *)alloc)->total_size +
+           region_sub_heaps_size((alloc_t *)alloc);
 }
 
 uint64_t get_total_used(allocator_t *alloc)
@@ -1263,6 +1866,11 @@ uint64_t get_total_used(allocator_t *alloc)
     return ((alloc_t *)alloc)->total_used;
 }
 
+uint64_t get_tier_used(allocator_t *alloc, alloc_tier_t tier)
+{
+    return ((alloc_t *)alloc)->tier_used[tier];
+}
+
 uint64_t get_chunk_size(uint64_t req_size)
 {
     return REQUEST2SIZE(_ALLOC_ADD_DBGINFO_SIZE(req_size));